@@ -0,0 +1,54 @@
+#ifndef COMMISSION_H
+#define COMMISSION_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class InstrumentCache;
+
+// Which lots a plain Close takes on the exchange.
+enum EnumCloseRuleType
+{
+    CloseBySpecifiedFlag,   // SHFE/INE: CloseToday and Close(Yesterday) are chosen by the order
+    CloseTodayFirst,        // CFFEX
+    CloseYesterdayFirst     // DCE, CZCE
+};
+
+// Per lot commission inputs of a symbol, from the cached instrument and commission rate.
+struct OffsetCost {
+    bool isKnown{ false };
+    EnumCloseRuleType rule{ CloseBySpecifiedFlag };
+    int multiple{ 1 };
+    double openByMoney{ 0 };
+    double openByVolume{ 0 };
+    double closeByMoney{ 0 };
+    double closeByVolume{ 0 };
+    double closeTodayByMoney{ 0 };
+    double closeTodayByVolume{ 0 };
+
+    double open(double price) const { return openByMoney * price * multiple + openByVolume; }
+    double close(double price) const { return closeByMoney * price * multiple + closeByVolume; }
+    double closeToday(double price) const { return closeTodayByMoney * price * multiple + closeTodayByVolume; }
+};
+
+// Commission of trades and of orders not sent yet. Rates come from the instrument cache,
+// by instrument or else by product, and are kept per symbol once known, so a fee is a hash
+// lookup and a multiplication. Costs are copied out under a lock, as `oms fee` asks from
+// the GUI thread while orders are priced on the worker thread.
+class CommissionEngine {
+public:
+    void setInstrumentCache(InstrumentCache *cache);
+    OffsetCost costs(const std::string &sym);
+
+    double fee(const std::string &sym, char offsetFlag, double price, int volume);
+    double openFee(const std::string &sym, double price, int volume);
+    double closeFee(const std::string &sym, bool isToday, double price, int volume);
+
+private:
+    std::unordered_map<std::string, OffsetCost> costCache;
+    std::mutex mu;
+    InstrumentCache *instrumentCache{ nullptr };
+};
+
+#endif // COMMISSION_H
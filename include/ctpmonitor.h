@@ -1,7 +1,10 @@
 #ifndef CTPMONITOR_H
 #define CTPMONITOR_H
 
+#include <QTimer>
+
 #include "ui_ctpmonitor.h"
+#include "uisnapshot.h"
 
 class CtpMonitor : public QMainWindow {
 	Q_OBJECT
@@ -11,11 +14,15 @@ public:
 	~CtpMonitor();
 
 	Ui::CtpMonitorClass getui();
+	void setSnapshotPublisher(SnapshotPublisher *sp, int fps);
 
 signals:
 	void sendCmdLineToTrader(QString cmdLine);
 	void sendCmdLineToMdspi(QString cmdLine);
 	void sendCmdLineToOms(QString cmdLine);
+	void sendCmdLineToRm(QString cmdLine);
+	void sendCmdLineToPortfolio(QString cmdLine);
+	void frameUpdated(const UiSnapshot &snap);
 
 public slots:
     void recCmdLine();
@@ -29,11 +36,16 @@ public slots:
 private slots:
 
     void on_stlinfoButton_clicked();
+    void onFrame();
 
 private:
     // CtpMonotorClass is sub-class of UI_CtpMonitorClass, which creates
     // mainwindow components and sets ui
 	Ui::CtpMonitorClass ui;
+
+	SnapshotPublisher *publisher{ nullptr };
+	QTimer frameTimer;
+	uint64_t shownSeq{ 0 };
 };
 
 #endif // CTPMONITOR_H
@@ -0,0 +1,77 @@
+#ifndef EXCHANGEBUDGET_H
+#define EXCHANGEBUDGET_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+struct BudgetCounter {
+    std::atomic<int> orders{ 0 };
+    std::atomic<int> cancels{ 0 };
+    std::atomic<int> selfTrades{ 0 };
+};
+
+// Daily caps of an exchange, 0 is no cap. Set from the command line while the order path reads them.
+struct BudgetLimits {
+    std::atomic<int> maxOrders{ 0 };
+    std::atomic<int> maxCancels{ 0 };
+    std::atomic<int> maxSelfTrades{ 0 };
+    bool isPerProduct{ false };     // caps count the whole product, e.g. CFFEX
+};
+
+struct InstrumentBudget {
+    BudgetCounter *instrument{ nullptr };
+    BudgetCounter *product{ nullptr };
+    std::string exchangeID;
+};
+
+// Counters are laid out once per contract info snapshot and never move afterwards.
+struct BudgetTable {
+    std::deque<BudgetCounter> counters;
+    std::unordered_map<std::string, InstrumentBudget> instruments;
+};
+
+// Daily order, cancel and self-trade counts per instrument and product, checked against
+// the exchange caps. The table is swapped in whole when contracts change, counting and
+// checking are atomic operations on it, so the order path takes no lock.
+class ExchangeBudget {
+public:
+    ExchangeBudget();
+
+    void setInstruments(const std::vector<CThostFtdcInstrumentField> &infos);
+    void loadOrders(const std::vector<CThostFtdcOrderField> &orders);
+    void onOrderInsert(const std::string &sym);
+    void onCancel(const std::string &sym);
+    void onTrade(CThostFtdcTradeField *td);
+
+    bool canOrder(const std::string &sym);
+    bool canCancel(const std::string &sym);
+    double orderHeadroom(const std::string &sym);
+    double cancelHeadroom(const std::string &sym);
+
+    bool setLimit(const std::string &exchangeID, const std::string &kind, int value);
+    QString summary(const std::string &sym = "");
+
+private:
+    const BudgetLimits *find(const std::string &sym, InstrumentBudget &ib);
+    BudgetCounter *counted(const InstrumentBudget &ib, const BudgetLimits &lim) const;
+    void setExchange(const std::string &exchangeID, int maxCancels, int maxSelfTrades, bool isPerProduct);
+
+    std::shared_ptr<BudgetTable> table;
+    std::map<std::string, BudgetLimits> exchangeLimits;     // keys fixed in the constructor
+    std::unordered_map<std::string, char> tradeDirections;   // ExchangeID+TradeID, both sides of a self-trade come back
+    std::string tradingDay;
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // EXCHANGEBUDGET_H
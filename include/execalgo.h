@@ -0,0 +1,94 @@
+#ifndef EXECALGO_H
+#define EXECALGO_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#include <QString>
+#include <QStringList>
+
+#include "ThostFtdcUserApiStruct.h"
+#include "spdlog/spdlog.h"
+
+class OMS;
+class InstrumentCache;
+
+enum EnumExecAlgoType
+{
+    AlgoTWAP,
+    AlgoVWAP,
+    AlgoPOV
+};
+
+namespace mymap
+{
+    const std::map<EnumExecAlgoType, std::string> execAlgo_string{
+        {AlgoTWAP, "TWAP"},
+        {AlgoVWAP, "VWAP"},
+        {AlgoPOV, "POV"}
+    };
+}
+
+// One parent target worked over time. The algo only moves the OMS target of sym
+// step by step, OMS keeps sending and cancelling orders for the gap as before.
+struct AlgoOrder {
+    std::string sym;
+    EnumExecAlgoType type{ AlgoTWAP };
+    int finalTarget{ 0 };
+    int durationMs{ 0 };        // TWAP/VWAP horizon
+    double participation{ 0 };  // POV share of market volume
+
+    bool isStarted{ false };
+    bool isDone{ false };
+    int startPos{ 0 };
+    int startMs{ 0 };           // exchange time of day
+    int startVolume{ 0 };
+    int childTarget{ 0 };
+    std::string profileKey;     // VWAP volume profile, empty for a time linear schedule
+};
+
+// Historical share of the day's volume traded in each bucket, times are session ms
+// counted from 18:00 so the night session comes first and buckets stay ordered.
+struct VolumeBucket {
+    int beginMs{ 0 };
+    int endMs{ 0 };
+    double cumBefore{ 0 };
+    double share{ 0 };
+};
+
+// Runs algo orders from the market data stream. Ticks are routed by symbol,
+// so a tick costs one hash lookup plus the algos of that symbol only.
+class ExecAlgo {
+public:
+    ExecAlgo();
+
+    void setOMS(OMS *oms);
+    void setInstrumentCache(InstrumentCache *cache);
+    bool loadProfiles(const QString &path);
+    void onTick(CThostFtdcDepthMarketDataField *mkt);
+
+    void start(const AlgoOrder &ao);
+    void stop(const std::string &sym);
+    QString execCmd(const QStringList &argv);
+    QString summary();
+
+private:
+    void step(AlgoOrder &ao, CThostFtdcDepthMarketDataField *mkt);
+    double scheduleFraction(const AlgoOrder &ao, int elapsedMs, int mktVolume) const;
+    double cumVolumeShare(const std::vector<VolumeBucket> &profile, int t) const;
+    std::string profileKeyOf(const std::string &sym);
+    static int timeOfDayMs(CThostFtdcDepthMarketDataField *mkt);
+    static int sessionMs(int timeOfDayMs);
+
+    std::unordered_map<std::string, std::vector<AlgoOrder>> symAlgos;
+    std::mutex mu;  // commands come from the GUI thread, ticks from the worker thread
+    std::unordered_map<std::string, std::vector<VolumeBucket>> profiles;  // by symbol or product
+    OMS *oms{ nullptr };
+    InstrumentCache *instrumentCache{ nullptr };
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // EXECALGO_H
@@ -0,0 +1,54 @@
+#ifndef FILLMODEL_H
+#define FILLMODEL_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ThostFtdcUserApiStruct.h"
+#include "queueestimator.h"
+
+struct FillEvent {
+    size_t order;
+    double price;
+    int volume;
+};
+
+// Resting orders of a symbol as parallel arrays in time priority, a tick runs one pass over them.
+struct RestingOrders {
+    std::vector<size_t> ids;
+    std::vector<char> isBuy;
+    std::vector<double> price;
+    std::vector<int> remaining;
+    std::vector<int> ahead;         // market lots queued ahead, -1 until the level was seen
+    std::vector<int> levelVolume;   // displayed size at the price on the last tick
+};
+
+struct SymbolBook {
+    BookLevels book;
+    bool hasTick{ false };
+    RestingOrders resting;
+};
+
+// Fill model of the paper exchange. Taking orders walk the five levels of the opposite side
+// and use up the displayed size for the rest of the tick. Resting orders queue behind the
+// displayed size at their price, in time priority with our other orders there: trades at the
+// price fill them once those ahead are gone, cancels leave the queue pro rata, and a price
+// traded through or reached by the opposite side fills them up to the size there.
+class FillModel {
+public:
+    bool hasBook(const std::string &sym) const;
+    void onTick(const CThostFtdcDepthMarketDataField &mkt, std::vector<FillEvent> &fills);
+
+    int available(const std::string &sym, bool isBuy, double limit, bool isMarket);
+    int take(const std::string &sym, size_t order, bool isBuy, double limit, bool isMarket, int volume, std::vector<FillEvent> &fills);
+    void rest(const std::string &sym, size_t order, bool isBuy, double price, int volume);
+    void remove(const std::string &sym, size_t order);
+    int getAhead(const std::string &sym, size_t order);
+    size_t restingCount() const;
+
+private:
+    std::unordered_map<std::string, SymbolBook> books;
+};
+
+#endif // FILLMODEL_H
@@ -0,0 +1,78 @@
+#ifndef INSTRUMENTCACHE_H
+#define INSTRUMENTCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+class Dispatcher;
+
+#pragma pack(push, 1)
+struct InstrumentCacheHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    char tradingDay[9];
+    // struct sizes guard against a file written with another CTP api version
+    uint32_t instrumentSize;
+    uint32_t marginRateSize;
+    uint32_t commissionRateSize;
+    uint32_t instrumentCount;
+    uint32_t marginRateCount;
+    uint32_t commissionRateCount;
+};
+#pragma pack(pop)
+
+// Per trading day binary cache of contract info, margin and commission rates,
+// so instruments are known before login and rates need not be queried on every start.
+// Rates are looked up by instrument first, then by product, the way CTP returns them.
+class InstrumentCache {
+public:
+    InstrumentCache(const std::string &dir);
+    ~InstrumentCache();
+
+    bool load();
+    bool save();
+    int postContractInfo(Dispatcher *dispatcher);
+
+    void setTradingDay(const std::string &tradingDay);
+    std::string getTradingDay();
+    bool isFresh(const std::string &tradingDay);
+
+    void setInstruments(const std::vector<CThostFtdcInstrumentField> &infos);
+    void updateMarginRate(CThostFtdcInstrumentMarginRateField *rate);
+    void updateCommissionRate(CThostFtdcInstrumentCommissionRateField *rate);
+
+    bool getInstrument(const std::string &sym, CThostFtdcInstrumentField &info);
+    std::vector<CThostFtdcInstrumentField> getInstruments();
+    bool getMarginRate(const std::string &sym, CThostFtdcInstrumentMarginRateField &rate);
+    bool getCommissionRate(const std::string &sym, CThostFtdcInstrumentCommissionRateField &rate);
+
+    std::vector<std::string> staleMarginRates();
+    std::vector<std::string> staleCommissionRates();
+
+private:
+    std::string filePath(const std::string &day) const;
+
+    std::string dir;
+    std::string tradingDay;
+    std::string cacheDay;   // trading day the loaded file was written for
+
+    std::unordered_map<std::string, CThostFtdcInstrumentField> instruments;
+    std::unordered_map<std::string, CThostFtdcInstrumentMarginRateField> marginRates;
+    std::unordered_map<std::string, CThostFtdcInstrumentCommissionRateField> commissionRates;
+    // keys refreshed for tradingDay, the rest are warm values from an older file
+    std::unordered_set<std::string> freshMarginRates;
+    std::unordered_set<std::string> freshCommissionRates;
+    std::mutex mu;
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // INSTRUMENTCACHE_H
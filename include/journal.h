@@ -0,0 +1,79 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+class Dispatcher;
+
+enum EnumJournalRecordType
+{
+    JournalTradingDay = 1,
+    JournalInputOrder,
+    JournalOrder,
+    JournalTrade,
+    JournalPositionDetail   // whole position detail snapshot in one record
+};
+
+#pragma pack(push, 1)
+struct JournalRecordHeader {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t length;    // payload bytes following the header
+    int64_t timestamp;  // nanoseconds since epoch
+};
+#pragma pack(pop)
+
+// Binary write-ahead journal of order flow. Appends only copy into a memory buffer,
+// a background thread writes and fsyncs in batches.
+class Journal {
+public:
+    Journal(const std::string &path);
+    ~Journal();
+
+    bool open(const std::string &tradingDay);
+    void close();
+    int recover(Dispatcher *dispatcher);
+
+    void append(EnumJournalRecordType type, const void *data, uint32_t length);
+    void append(CThostFtdcInputOrderField *inputOrder) { append(JournalInputOrder, inputOrder, sizeof(CThostFtdcInputOrderField)); }
+    void append(CThostFtdcOrderField *order) { append(JournalOrder, order, sizeof(CThostFtdcOrderField)); }
+    void append(CThostFtdcTradeField *trade) { append(JournalTrade, trade, sizeof(CThostFtdcTradeField)); }
+    void append(const std::vector<CThostFtdcInvestorPositionDetailField> &posDetails) { append(JournalPositionDetail, posDetails.data(), posDetails.size() * sizeof(CThostFtdcInvestorPositionDetailField)); }
+
+    bool isRecovered() const { return recovered; }
+
+    int flushIntervalMs{ 50 };
+    size_t flushBytes{ 64 * 1024 };
+
+private:
+    void run();
+    void flush(std::vector<char> &buf);
+    std::string readTradingDay();
+
+    std::string path;
+    std::string tradingDay;
+    FILE *file{ nullptr };
+    long recoverEnd{ 0 };
+    bool recovered{ false };
+
+    std::vector<char> buffer;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::atomic<bool> isRunning{ false };
+    std::thread writer;
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,97 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+
+#include <QString>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+enum EnumLatencyStageType
+{
+    StageDecision,      // OMS decided to send
+    StageInsert,        // ReqOrderInsert returned
+    StageRspInsert,     // OnRspOrderInsert, only on CTP rejection
+    StageFirstRtn,      // first OnRtnOrder
+    StageAccepted,      // OrderSysID assigned by exchange
+    StageFirstTrade,    // first OnRtnTrade
+    StageCount
+};
+
+namespace mymap
+{
+    const std::map<EnumLatencyStageType, std::string> latencyStage_string{
+        {StageDecision, "Decision"},
+        {StageInsert, "Insert"},
+        {StageRspInsert, "RspInsert"},
+        {StageFirstRtn, "FirstRtn"},
+        {StageAccepted, "Accepted"},
+        {StageFirstTrade, "FirstTrade"}
+    };
+}
+
+// Log2 buckets of microseconds, bucket i holds [2^(i-1), 2^i) us.
+struct LatencyHistogram {
+    static const int BUCKETS = 32;
+
+    void add(double us);
+    double percentile(double p) const;
+    double mean() const { return count == 0 ? 0 : sum / count; }
+
+    int64_t buckets[BUCKETS]{ 0 };
+    int64_t count{ 0 };
+    double sum{ 0 };
+    double max{ 0 };
+};
+
+// Histograms of one instrument or exchange, one per stage measured from StageInsert
+// (StageDecision measures decision to insert).
+struct LatencyStats {
+    LatencyHistogram stages[StageCount];
+};
+
+struct OrderLatency {
+    std::string sym;
+    std::string exchangeID;
+    uint64_t tsc[StageCount]{ 0 };
+    bool isDone{ false };   // all traded, kept until the trade return arrives
+};
+
+// Order round trip latency per stage, timestamped with the TSC so stamping costs a few ns
+// on the order path. Orders are keyed by OrderRef of our own session.
+class LatencyTracker {
+public:
+    LatencyTracker();
+
+    static uint64_t now();
+    static void markDecision();
+    static void clearDecision();
+
+    void onInsert(const char *orderRef, const std::string &sym);
+    void onRspInsert(const char *orderRef);
+    void onOrder(CThostFtdcOrderField *order);
+    void onTrade(CThostFtdcTradeField *trade);
+
+    QString summary(const std::string &key = "");
+    bool dump(const std::string &path);
+
+private:
+    void stamp(OrderLatency &ol, EnumLatencyStageType stage, uint64_t tsc);
+    double toMicroseconds(uint64_t ticks) const { return ticks / ticksPerUs; }
+
+    std::unordered_map<int, OrderLatency> orders;
+    std::unordered_map<std::string, int> sysIDs;    // ExchangeID+OrderSysID to OrderRef, trades only carry these
+    std::map<std::string, LatencyStats> symStats;
+    std::map<std::string, LatencyStats> exchangeStats;
+    double ticksPerUs{ 1000 };
+    std::mutex mu;
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // LATENCY_H
@@ -0,0 +1,94 @@
+#ifndef MARGIN_H
+#define MARGIN_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+class InstrumentCache;
+
+struct ProductMargin {
+    bool isBigSide{ false };    // exchange charges the larger side only, see MaxMarginSideAlgorithm
+    double longMargin{ 0 };
+    double shortMargin{ 0 };
+    double longFrozen{ 0 };
+    double shortFrozen{ 0 };
+    double margin{ 0 };
+    double frozen{ 0 };
+};
+
+struct InstrumentMargin {
+    bool isKnown{ false };
+    bool hasRate{ false };      // rate queried for the account, else the exchange's from the contract
+    int multiple{ 1 };
+    double longByMoney{ 0 };
+    double longByVolume{ 0 };
+    double shortByMoney{ 0 };
+    double shortByVolume{ 0 };
+    int longPos{ 0 };
+    int shortPos{ 0 };
+    double price{ 0 };
+    double longFrozen{ 0 };     // margin of working open orders, at their limit price
+    double shortFrozen{ 0 };
+    double longMargin{ 0 };
+    double shortMargin{ 0 };
+    bool isUnpriced{ false };
+    ProductMargin *product{ nullptr };
+
+    double longPerLot(double px) const { return longByMoney * px * multiple + longByVolume; }
+    double shortPerLot(double px) const { return shortByMoney * px * multiple + shortByVolume; }
+};
+
+struct WorkingOpen {
+    std::string sym;
+    bool isBuy{ true };
+    double price{ 0 };
+    int volume{ 0 };
+    double frozen{ 0 };     // margin added when the order was frozen, released as is
+};
+
+// Margin of the account kept per product, so a tick, a trade or an order only redoes the
+// product of its instrument. Positions are marked at the portfolio's price, working open
+// orders freeze margin at their limit price, and on big side products only the larger of
+// the long and short side, orders included, is charged.
+class MarginEngine {
+public:
+    MarginEngine();
+
+    void setInstrumentCache(InstrumentCache *cache);
+    void setPosition(const std::string &sym, int longPos, int shortPos, double price);
+    void clearPositions();
+    void setPrice(const std::string &sym, double price);
+    void onOrder(const CThostFtdcOrderField *of);
+    void loadOrders(const std::vector<CThostFtdcOrderField> &orders);
+
+    double getMargin() const { return margin; }
+    double getFrozen() const { return frozen; }
+    double getMargin(const std::string &sym) const;
+    bool isComplete() const { return unpriced == 0; }
+    QString summary();
+
+private:
+    InstrumentMargin *find(const std::string &sym);
+    void update(InstrumentMargin &im);
+    void updateProduct(ProductMargin &pm);
+    void freeze(WorkingOpen &wo);
+    void release(const WorkingOpen &wo);
+
+    std::unordered_map<std::string, InstrumentMargin> instruments;
+    std::unordered_map<std::string, ProductMargin> products;
+    std::unordered_map<std::string, WorkingOpen> workingOpens;     // by RM::orderKey
+    InstrumentCache *instrumentCache{ nullptr };
+    double margin{ 0 };
+    double frozen{ 0 };
+    int unpriced{ 0 };      // instruments holding margin but without a price yet
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // MARGIN_H
@@ -21,7 +21,10 @@ enum EnumMyEventType
 	PositionDetailEvent,
 	OrderEvent,
 	TradeEvent,
-	AccountUpdateEvent
+	AccountUpdateEvent,
+	ContractInfoSnapshotEvent,
+	PositionDetailSnapshotEvent,
+	OrderSnapshotEvent
 };
 
 class MyEvent : public QEvent {
@@ -34,6 +37,9 @@ public:
 	MyEvent(EnumMyEventType type, CThostFtdcTradeField *trade);
 	MyEvent(EnumMyEventType type, CThostFtdcOrderField *order);
 	MyEvent(EnumMyEventType type, Account *acc);
+	MyEvent(EnumMyEventType type, ContractInfoSnapshot contractInfos);
+	MyEvent(EnumMyEventType type, PosDetailSnapshot posDetails);
+	MyEvent(EnumMyEventType type, OrderSnapshot orders);
 	~MyEvent();
 
 	EnumMyEventType myType;
@@ -45,6 +51,9 @@ public:
 	CThostFtdcTradeField *trade{ nullptr };
 	CThostFtdcOrderField *order{ nullptr };
 	Account *acc{ nullptr };
+	ContractInfoSnapshot contractInfos;
+	PosDetailSnapshot posDetails;
+	OrderSnapshot orders;
 	bool isLast{ true };
 };
 
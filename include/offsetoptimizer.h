@@ -0,0 +1,34 @@
+#ifndef OFFSETOPTIMIZER_H
+#define OFFSETOPTIMIZER_H
+
+#include <atomic>
+#include <string>
+
+#include "commission.h"
+
+struct SidePosition {
+    int yd{ 0 };
+    int td{ 0 };
+};
+
+// Picks the cheapest offset flags for a position change. Closing today's lots may cost more than
+// locking them, i.e. opening the other side now and closing both as yesterday's lots tomorrow.
+// Costs come from the commission engine, so a decision is a hash lookup and a few multiplications.
+class OffsetOptimizer {
+public:
+    void setCommissionEngine(CommissionEngine *engine);
+    void setLockEnabled(bool isEnabled);
+    bool isLockEnabled() const { return isLocking; }
+
+    int closeVolume(const std::string &sym, double price, int volume, const SidePosition &opposite);
+    void splitClose(const std::string &sym, double price, int volume, const SidePosition &pos, int &closeYd, int &closeTd);
+    EnumCloseRuleType closeRule(const std::string &sym);
+
+private:
+    OffsetCost costs(const std::string &sym);
+
+    CommissionEngine *commission{ nullptr };
+    std::atomic<bool> isLocking{ true };  // switched by `oms lock` on the GUI thread
+};
+
+#endif // OFFSETOPTIMIZER_H
@@ -1,14 +1,22 @@
 #ifndef OMS_H
 #define OMS_H
 
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
 #include <QObject>
 #include <QColor>
+#include <QSet>
 //#include <QMap>
 
 #include "spdlog/spdlog.h"
 #include "ThostFtdcUserApiStruct.h"
 
 #include "struct.h"
+#include "queueestimator.h"
+#include "offsetoptimizer.h"
 
 //class QObject;
 
@@ -17,6 +25,10 @@ class QMap;
 
 class Portfolio;
 class Trader;
+class ExecAlgo;
+class PairExec;
+class InstrumentCache;
+class ExchangeBudget;
 
 
 class Trade {
@@ -25,10 +37,28 @@ public:
     Trade(CThostFtdcTradeField *tf);
 
     QString tradeID;
-    CThostFtdcTradeField *tradeInfo;
+    std::shared_ptr<CThostFtdcTradeField> tradeInfo;  // own copy, outlives the event
 };
 typedef QMap<QString, Trade> TradeList;
 
+// OMS side of an order, ahead of the exchange status it is waiting for.
+enum EnumOrderStateType
+{
+    OrderPendingNew,        // insert sent, exchange not answered yet
+    OrderAcked,             // queueing at exchange
+    OrderPendingCancel      // cancel sent, still queueing
+};
+
+struct RetryDelay {
+    long long atMs{ 0 };        // 0 once due, until the target fails again
+    long long delayMs{ 0 };
+};
+
+struct InFlightRequest {
+    std::string sym;
+    long long sentMs{ 0 };
+};
+
 class Order {
 public:
     Order();
@@ -38,14 +68,28 @@ public:
     std::string sym;
     bool isWorking{ false };
     EnumOrderStatusType status;
+    EnumOrderStateType state{ OrderAcked };
     char direction{ 0 };
     char longShortSide{ 0 };
     int workingVolume{ 0 };
     int lastVolumeTraded{ 0 };
-    CThostFtdcOrderField *orderInfo;
+    std::shared_ptr<CThostFtdcOrderField> orderInfo;
 };
 typedef QMap<QString, Order> OrderList;
 
+// One order decision of OMS, sent as exchange-legal child orders.
+struct ParentOrder {
+    int parentID{ 0 };
+    std::string sym;
+    char direction{ 0 };
+    double price{ 0 };
+    int volume{ 0 };
+    int volumeSent{ 0 };
+    int volumeTraded{ 0 };
+    std::map<int, int> childTraded;     // OrderRef to VolumeTraded of working children
+};
+typedef QMap<int, ParentOrder> ParentOrderList;
+
 struct PosTarget {
     std::string sym{ "" };
     double targetPrice{ 0 };
@@ -84,11 +128,22 @@ public:
     void onEvent(QEvent *ev);
     void setTrader(Trader *trader);
     void setPortfolio(Portfolio *pf);
+    void setExecAlgo(ExecAlgo *algo);
+    void setPairExec(PairExec *pairExec);
+    void setInstrumentCache(InstrumentCache *cache);
+    void setExchangeBudget(ExchangeBudget *budget);
+    void setCommissionEngine(CommissionEngine *engine);
+    void onTick(CThostFtdcDepthMarketDataField *mkt);
+    int getNetPos(const std::string &sym);
+    int getQueueAhead(const QString &orderID);
+    double getBudgetHeadroom(const std::string &sym);
+    double estimateFee(const std::string &sym, EnumOffsetFlagType offsetFlag, double price, int volume);
     void addPosTarget(QString targetID);
     void setPosTarget(QString targetID, int tgtpos, double price);
     void updatePosTarget(PosTarget &pt);
     void updatePairPosTarget(std::string yname, std::string xname, int ypos, double yprice, int xpos, double xprice);
     void handleTargets();
+    void markDirty(const QString &targetID);
     void switchOn();
     void switchOff();
     //void sendOrderForTarget(std::string sym, int tgtPos, double price);
@@ -97,6 +152,7 @@ public:
     OrderList orderList;
     OrderList workingOrderList;
     TargetList targetList;
+    ParentOrderList parentOrderList;
 
 public slots:
     void execCmdLine(QString cmdLine);
@@ -109,10 +165,41 @@ private:
     void sendOrderForTarget(PosTarget &pt);
     void orderInsertWithOffsetFlag(std::string &sym, EnumOpenClose o_c, EnumDirectionType direction, double price, int volume);
     void cancelWorkingOrder(std::string &sym, EnumDirectionType direction, int volume);
+    bool cancelOrder(Order &od);
+    void repriceWorkingOrders(PosTarget &pt);
     void handleWorkingOrder(Order &od);
+    void onOrder(CThostFtdcOrderField *of);
+    int insertSliced(const std::string &sym, EnumOffsetFlagType offsetFlag, EnumDirectionType direction, double price, int volume);
+    int maxOrderVolume(const std::string &sym, bool isMarket);
+    void updateParentOrder(CThostFtdcOrderField *of);
+    void resolveInFlight(Order &od);
+    void expireInFlight();
+    bool isInFlight(const std::string &sym);
+    void deferRetry(const QString &targetID);
+    void dirtyRetries();
 
     Trader *trader{ nullptr };
     Portfolio *pf{ nullptr };
+    ExecAlgo *algo{ nullptr };
+    PairExec *pairExec{ nullptr };
+    InstrumentCache *instrumentCache{ nullptr };
+    ExchangeBudget *budget{ nullptr };
+    CommissionEngine *commission{ nullptr };
+    std::unordered_map<std::string, std::pair<int, int>> volumeLimits;  // max limit, max market order volume
+    std::unordered_map<int, int> childParent;   // OrderRef to parentID
+    int nParentID{ 0 };
+    // requests waiting for the exchange, a symbol with any of them is not acted on again
+    std::unordered_map<int, InFlightRequest> pendingNew;        // OrderRef of own orders
+    QMap<QString, InFlightRequest> pendingCancel;               // orderID
+    std::unordered_map<std::string, int> symInFlight;
+    std::unordered_map<std::string, QSet<QString>> symWorkingIDs;
+    QueueEstimator queueEst;
+    OffsetOptimizer offsetOpt;
+    // targets to re-evaluate on the next handleTargets, in the order they changed
+    std::vector<QString> dirtyQueue;
+    QSet<QString> dirtySet;
+    QMap<QString, RetryDelay> retryList;   // targets backing off after nothing went out
+    int repriceAhead{ -1 };     // off if < 0, else orders off target price with more lots ahead are re-priced
     PairPosTarget ppt;
     bool isWorking{ false };
 
@@ -0,0 +1,75 @@
+#ifndef PAIREXEC_H
+#define PAIREXEC_H
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+#include <QString>
+#include <QStringList>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+class OMS;
+
+// Two legs moved together. The passive leg joins its own side of the book, the hedge leg
+// follows the passive fills at the leg ratio crossing the spread. While unhedged lots or
+// their age exceed the bounds, the passive leg is held at its current position.
+struct PairOrder {
+    std::string yname, xname;
+    int yFinal{ 0 };
+    int xFinal{ 0 };
+    // relative orders are units * ratio added to the positions seen on the first tick
+    bool isRelative{ false };
+    int units{ 0 };
+    int yRatio{ 1 };
+    int xRatio{ -1 };
+    int maxUnhedged{ 1 };       // lots of the hedge leg
+    int maxUnhedgedMs{ 5000 };
+
+    bool isStarted{ false };
+    bool isDone{ false };
+    bool isFrozen{ false };
+    bool isPassiveY{ true };    // the leg with less volume traded today
+    int yStart{ 0 };
+    int xStart{ 0 };
+    long long unhedgedSinceMs{ 0 };
+};
+
+struct LegQuote {
+    double bid{ 0 };
+    double ask{ 0 };
+    int volume{ 0 };
+};
+
+// Runs pair orders from the market data stream, each symbol belongs to one pair at most
+// so the legs of different pairs never fight over an OMS target.
+class PairExec {
+public:
+    PairExec();
+
+    void setOMS(OMS *oms);
+    void onTick(CThostFtdcDepthMarketDataField *mkt);
+
+    bool start(const PairOrder &po);
+    void stop(const std::string &sym);
+    bool setPairTarget(const std::string &yname, const std::string &xname, int ypos, int xpos);
+    QString execCmd(const QStringList &argv);
+    QString summary();
+
+private:
+    bool startLocked(const PairOrder &po);
+    void step(PairOrder &po);
+
+    std::map<std::string, PairOrder> pairs;                 // by y leg
+    std::unordered_map<std::string, std::string> symPair;   // leg symbol to y leg
+    std::unordered_map<std::string, LegQuote> quotes;
+    std::mutex mu;  // commands come from the GUI thread, ticks from the worker thread
+    OMS *oms{ nullptr };
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // PAIREXEC_H
@@ -0,0 +1,206 @@
+#ifndef PAPERTRADERAPI_H
+#define PAPERTRADERAPI_H
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QObject>
+#include <QString>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcTraderApi.h"
+
+#include "fillmodel.h"
+
+class QEvent;
+class InstrumentCache;
+
+struct PaperOrder {
+    CThostFtdcOrderField field;
+    size_t index{ 0 };
+    bool isResting{ false };
+    bool isOverClose{ false };  // more than the free position, rejected on arrival
+    int frozenClose{ 0 };       // lots of the position this close still holds
+};
+
+// An order or a cancel on its way to the paper exchange.
+struct PaperInbound {
+    long long arriveMs{ 0 };
+    long long seq{ 0 };
+    bool isCancel{ false };
+    size_t order{ 0 };
+    CThostFtdcInputOrderActionField action;
+};
+
+struct LaterInbound {
+    bool operator()(const PaperInbound &a, const PaperInbound &b) const
+    {
+        return a.arriveMs != b.arriveMs ? a.arriveMs > b.arriveMs : a.seq > b.seq;
+    }
+};
+
+// Ack latency of an exchange, the minimum plus an exponential delay of mean jitterMs.
+struct LatencyProfile {
+    int minMs{ 0 };
+    int jitterMs{ 0 };
+};
+
+// Paper exchange behind the CTP trader api, selected by a "paper://<latency ms>" front address.
+// Trader, RM, journal and OMS run unchanged on top of it. Orders and cancels reach the
+// exchange after the ack latency of its profile in market time, market time being the
+// UpdateTime of the ticks fed in, so a replay runs at full speed. Requests to one exchange
+// keep their order. Matching against the book is up to the FillModel.
+class PaperTraderApi : public QObject, public CThostFtdcTraderApi {
+    Q_OBJECT
+
+public:
+    PaperTraderApi(int latencyMs = 0);
+
+    void setInstrumentCache(InstrumentCache *cache);
+    void setLatency(int minMs, int jitterMs = 0, const std::string &exchangeID = "");
+    QString summary();
+
+    // api the Trader uses
+    void Release() {}
+    void Init();
+    int Join() { return 0; }
+    const char *GetTradingDay();
+    void RegisterFront(char *pszFrontAddress) {}
+    void RegisterNameServer(char *pszNsAddress) {}
+    void RegisterFensUserInfo(CThostFtdcFensUserInfoField *pFensUserInfo) {}
+    void RegisterSpi(CThostFtdcTraderSpi *pSpi);
+    void SubscribePrivateTopic(THOST_TE_RESUME_TYPE nResumeType) {}
+    void SubscribePublicTopic(THOST_TE_RESUME_TYPE nResumeType) {}
+
+    int ReqUserLogin(CThostFtdcReqUserLoginField *pReqUserLoginField, int nRequestID);
+    int ReqUserLogout(CThostFtdcUserLogoutField *pUserLogout, int nRequestID);
+    int ReqOrderInsert(CThostFtdcInputOrderField *pInputOrder, int nRequestID);
+    int ReqOrderAction(CThostFtdcInputOrderActionField *pInputOrderAction, int nRequestID);
+    int ReqSettlementInfoConfirm(CThostFtdcSettlementInfoConfirmField *pSettlementInfoConfirm, int nRequestID);
+    int ReqQryOrder(CThostFtdcQryOrderField *pQryOrder, int nRequestID);
+    int ReqQryTrade(CThostFtdcQryTradeField *pQryTrade, int nRequestID);
+    int ReqQryInvestorPosition(CThostFtdcQryInvestorPositionField *pQryInvestorPosition, int nRequestID);
+    int ReqQryTradingAccount(CThostFtdcQryTradingAccountField *pQryTradingAccount, int nRequestID);
+    int ReqQryInstrumentMarginRate(CThostFtdcQryInstrumentMarginRateField *pQryInstrumentMarginRate, int nRequestID);
+    int ReqQryInstrumentCommissionRate(CThostFtdcQryInstrumentCommissionRateField *pQryInstrumentCommissionRate, int nRequestID);
+    int ReqQryInstrument(CThostFtdcQryInstrumentField *pQryInstrument, int nRequestID);
+    int ReqQryDepthMarketData(CThostFtdcQryDepthMarketDataField *pQryDepthMarketData, int nRequestID);
+    int ReqQrySettlementInfo(CThostFtdcQrySettlementInfoField *pQrySettlementInfo, int nRequestID);
+    int ReqQryInvestorPositionDetail(CThostFtdcQryInvestorPositionDetailField *pQryInvestorPositionDetail, int nRequestID);
+    int ReqQrySettlementInfoConfirm(CThostFtdcQrySettlementInfoConfirmField *pQrySettlementInfoConfirm, int nRequestID);
+
+    // not served by the paper exchange, answered as a network failure
+    int ReqAuthenticate(CThostFtdcReqAuthenticateField *pReqAuthenticateField, int nRequestID) { return -1; }
+    int ReqUserPasswordUpdate(CThostFtdcUserPasswordUpdateField *pUserPasswordUpdate, int nRequestID) { return -1; }
+    int ReqTradingAccountPasswordUpdate(CThostFtdcTradingAccountPasswordUpdateField *pTradingAccountPasswordUpdate, int nRequestID) { return -1; }
+    int ReqParkedOrderInsert(CThostFtdcParkedOrderField *pParkedOrder, int nRequestID) { return -1; }
+    int ReqParkedOrderAction(CThostFtdcParkedOrderActionField *pParkedOrderAction, int nRequestID) { return -1; }
+    int ReqQueryMaxOrderVolume(CThostFtdcQueryMaxOrderVolumeField *pQueryMaxOrderVolume, int nRequestID) { return -1; }
+    int ReqRemoveParkedOrder(CThostFtdcRemoveParkedOrderField *pRemoveParkedOrder, int nRequestID) { return -1; }
+    int ReqRemoveParkedOrderAction(CThostFtdcRemoveParkedOrderActionField *pRemoveParkedOrderAction, int nRequestID) { return -1; }
+    int ReqExecOrderInsert(CThostFtdcInputExecOrderField *pInputExecOrder, int nRequestID) { return -1; }
+    int ReqExecOrderAction(CThostFtdcInputExecOrderActionField *pInputExecOrderAction, int nRequestID) { return -1; }
+    int ReqForQuoteInsert(CThostFtdcInputForQuoteField *pInputForQuote, int nRequestID) { return -1; }
+    int ReqQuoteInsert(CThostFtdcInputQuoteField *pInputQuote, int nRequestID) { return -1; }
+    int ReqQuoteAction(CThostFtdcInputQuoteActionField *pInputQuoteAction, int nRequestID) { return -1; }
+    int ReqBatchOrderAction(CThostFtdcInputBatchOrderActionField *pInputBatchOrderAction, int nRequestID) { return -1; }
+    int ReqCombActionInsert(CThostFtdcInputCombActionField *pInputCombAction, int nRequestID) { return -1; }
+    int ReqQryInvestor(CThostFtdcQryInvestorField *pQryInvestor, int nRequestID) { return -1; }
+    int ReqQryTradingCode(CThostFtdcQryTradingCodeField *pQryTradingCode, int nRequestID) { return -1; }
+    int ReqQryExchange(CThostFtdcQryExchangeField *pQryExchange, int nRequestID) { return -1; }
+    int ReqQryProduct(CThostFtdcQryProductField *pQryProduct, int nRequestID) { return -1; }
+    int ReqQryTransferBank(CThostFtdcQryTransferBankField *pQryTransferBank, int nRequestID) { return -1; }
+    int ReqQryNotice(CThostFtdcQryNoticeField *pQryNotice, int nRequestID) { return -1; }
+    int ReqQryInvestorPositionCombineDetail(CThostFtdcQryInvestorPositionCombineDetailField *pQryInvestorPositionCombineDetail, int nRequestID) { return -1; }
+    int ReqQryCFMMCTradingAccountKey(CThostFtdcQryCFMMCTradingAccountKeyField *pQryCFMMCTradingAccountKey, int nRequestID) { return -1; }
+    int ReqQryEWarrantOffset(CThostFtdcQryEWarrantOffsetField *pQryEWarrantOffset, int nRequestID) { return -1; }
+    int ReqQryInvestorProductGroupMargin(CThostFtdcQryInvestorProductGroupMarginField *pQryInvestorProductGroupMargin, int nRequestID) { return -1; }
+    int ReqQryExchangeMarginRate(CThostFtdcQryExchangeMarginRateField *pQryExchangeMarginRate, int nRequestID) { return -1; }
+    int ReqQryExchangeMarginRateAdjust(CThostFtdcQryExchangeMarginRateAdjustField *pQryExchangeMarginRateAdjust, int nRequestID) { return -1; }
+    int ReqQryExchangeRate(CThostFtdcQryExchangeRateField *pQryExchangeRate, int nRequestID) { return -1; }
+    int ReqQrySecAgentACIDMap(CThostFtdcQrySecAgentACIDMapField *pQrySecAgentACIDMap, int nRequestID) { return -1; }
+    int ReqQryProductExchRate(CThostFtdcQryProductExchRateField *pQryProductExchRate, int nRequestID) { return -1; }
+    int ReqQryProductGroup(CThostFtdcQryProductGroupField *pQryProductGroup, int nRequestID) { return -1; }
+    int ReqQryMMInstrumentCommissionRate(CThostFtdcQryMMInstrumentCommissionRateField *pQryMMInstrumentCommissionRate, int nRequestID) { return -1; }
+    int ReqQryMMOptionInstrCommRate(CThostFtdcQryMMOptionInstrCommRateField *pQryMMOptionInstrCommRate, int nRequestID) { return -1; }
+    int ReqQryInstrumentOrderCommRate(CThostFtdcQryInstrumentOrderCommRateField *pQryInstrumentOrderCommRate, int nRequestID) { return -1; }
+    int ReqQryOptionInstrTradeCost(CThostFtdcQryOptionInstrTradeCostField *pQryOptionInstrTradeCost, int nRequestID) { return -1; }
+    int ReqQryOptionInstrCommRate(CThostFtdcQryOptionInstrCommRateField *pQryOptionInstrCommRate, int nRequestID) { return -1; }
+    int ReqQryExecOrder(CThostFtdcQryExecOrderField *pQryExecOrder, int nRequestID) { return -1; }
+    int ReqQryForQuote(CThostFtdcQryForQuoteField *pQryForQuote, int nRequestID) { return -1; }
+    int ReqQryQuote(CThostFtdcQryQuoteField *pQryQuote, int nRequestID) { return -1; }
+    int ReqQryCombInstrumentGuard(CThostFtdcQryCombInstrumentGuardField *pQryCombInstrumentGuard, int nRequestID) { return -1; }
+    int ReqQryCombAction(CThostFtdcQryCombActionField *pQryCombAction, int nRequestID) { return -1; }
+    int ReqQryTransferSerial(CThostFtdcQryTransferSerialField *pQryTransferSerial, int nRequestID) { return -1; }
+    int ReqQryAccountregister(CThostFtdcQryAccountregisterField *pQryAccountregister, int nRequestID) { return -1; }
+    int ReqQryContractBank(CThostFtdcQryContractBankField *pQryContractBank, int nRequestID) { return -1; }
+    int ReqQryParkedOrder(CThostFtdcQryParkedOrderField *pQryParkedOrder, int nRequestID) { return -1; }
+    int ReqQryParkedOrderAction(CThostFtdcQryParkedOrderActionField *pQryParkedOrderAction, int nRequestID) { return -1; }
+    int ReqQryTradingNotice(CThostFtdcQryTradingNoticeField *pQryTradingNotice, int nRequestID) { return -1; }
+    int ReqQryBrokerTradingParams(CThostFtdcQryBrokerTradingParamsField *pQryBrokerTradingParams, int nRequestID) { return -1; }
+    int ReqQryBrokerTradingAlgos(CThostFtdcQryBrokerTradingAlgosField *pQryBrokerTradingAlgos, int nRequestID) { return -1; }
+    int ReqQueryCFMMCTradingAccountToken(CThostFtdcQueryCFMMCTradingAccountTokenField *pQueryCFMMCTradingAccountToken, int nRequestID) { return -1; }
+    int ReqFromBankToFutureByFuture(CThostFtdcReqTransferField *pReqTransfer, int nRequestID) { return -1; }
+    int ReqFromFutureToBankByFuture(CThostFtdcReqTransferField *pReqTransfer, int nRequestID) { return -1; }
+    int ReqQueryBankAccountMoneyByFuture(CThostFtdcReqQueryAccountField *pReqQueryAccount, int nRequestID) { return -1; }
+
+public slots:
+    void onEvent(QEvent *ev);
+
+private slots:
+    void connectFront();
+
+private:
+    void onTick(CThostFtdcDepthMarketDataField *mkt);
+    void arrive(const PaperInbound &in);
+    void apply(const std::vector<FillEvent> &fillEvents);
+    void fill(PaperOrder &po, double price, int volume);
+    void cancel(PaperOrder &po, const char *statusMsg);
+    long long arrivalMs(const std::string &exchangeID);
+    void book(const CThostFtdcTradeField &td);
+    void releaseClose(PaperOrder &po, int volume);
+    int multiple(const std::string &sym);
+    PaperOrder *findOrder(const CThostFtdcInputOrderActionField &action);
+    long long marketMs(const CThostFtdcDepthMarketDataField &mkt) const;
+
+    CThostFtdcTraderSpi *spi{ nullptr };
+    InstrumentCache *instrumentCache{ nullptr };
+    std::map<std::string, LatencyProfile> latencies;   // by ExchangeID, "" for the others
+    std::unordered_map<std::string, long long> lastArriveMs;
+    std::mt19937 rng{ 42 };     // fixed seed, a replay gives the same fills every run
+    std::string tradingDay;
+    std::string brokerID;
+    std::string userID;
+
+    long long clockMs{ 0 };     // market time of the latest tick, see marketMs
+    std::string clockTime;      // UpdateTime of the latest tick, stamped on acks and trades
+    std::unordered_map<std::string, CThostFtdcDepthMarketDataField> books;
+    FillModel fillModel;
+    std::vector<FillEvent> fills;
+
+    std::deque<PaperOrder> orders;      // never shrinks, indices stay valid
+    std::unordered_map<std::string, size_t> refIndex;      // FrontID-SessionID-OrderRef
+    std::unordered_map<std::string, size_t> sysIndex;      // OrderSysID
+    std::priority_queue<PaperInbound, std::vector<PaperInbound>, LaterInbound> inbound;
+    long long nInbound{ 0 };
+    std::vector<CThostFtdcTradeField> trades;
+    std::vector<CThostFtdcInvestorPositionDetailField> posDetails;
+    std::unordered_map<std::string, int> heldVolume;   // InstrumentID+Direction, lots open
+    std::unordered_map<std::string, int> frozenClose;  // InstrumentID+Direction, lots held by working closes
+    double capital{ 1e6 };
+    double closeProfit{ 0 };
+    int nOrderSysID{ 0 };
+    int nTradeID{ 0 };
+    std::recursive_mutex mu;    // orders come from the strategy thread, queries and commands from others
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // PAPERTRADERAPI_H
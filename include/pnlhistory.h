@@ -0,0 +1,102 @@
+#ifndef PNLHISTORY_H
+#define PNLHISTORY_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+struct AccountPoint {
+    double balance{ 0 };
+    double netPnl{ 0 };
+    double margin{ 0 };
+    double available{ 0 };
+};
+
+struct SymbolPoint {
+    double netPnl{ 0 };
+    double margin{ 0 };
+    int netPos{ 0 };
+    int exposure{ 0 };      // net position across accounts, own position on sub-accounts
+};
+
+// Last capacity buckets of a series. A bucket holds the last value written in it, buckets
+// without a write are skipped by queries, which read the value before them as still standing.
+template <class T>
+class TimeRing {
+public:
+    explicit TimeRing(int capacity) : values(capacity), buckets(capacity, -1) {}
+
+    void set(int64_t bucket, const T &v)
+    {
+        if (bucket < last)
+            return;     // clock went back, keep the newer history
+        size_t i = bucket % values.size();
+        values[i] = v;
+        buckets[i] = bucket;
+        last = bucket;
+    }
+
+    bool get(int64_t bucket, T &v) const
+    {
+        if (bucket < 0 || bucket > last || last - bucket >= (int64_t)values.size())
+            return false;
+        size_t i = bucket % values.size();
+        if (buckets[i] != bucket)
+            return false;
+        v = values[i];
+        return true;
+    }
+
+    // Buckets written in [from, to], oldest first.
+    template <class F>
+    void forEach(int64_t from, int64_t to, F f) const
+    {
+        from = std::max(from, last - (int64_t)values.size() + 1);
+        to = std::min(to, last);
+        for (int64_t b = from; b <= to; ++b) {
+            size_t i = b % values.size();
+            if (buckets[i] == b)
+                f(b, values[i]);
+        }
+    }
+
+    int64_t lastBucket() const { return last; }
+
+private:
+    std::vector<T> values;
+    std::vector<int64_t> buckets;
+    int64_t last{ -1 };
+};
+
+// Intraday history of an account and of the symbols it held, in buckets of resolution
+// seconds of market time. Memory is fixed per series, a write is O(1).
+class PnlHistory {
+public:
+    PnlHistory(int resolution = 1, int capacity = 86400);
+
+    int64_t bucketOf(const char *updateTime);   // -1 for a stale tick
+    void record(int64_t bucket, const AccountPoint &ap);
+    void record(int64_t bucket, const std::string &sym, const SymbolPoint &sp);
+
+    std::vector<std::pair<int64_t, AccountPoint>> accountRange(int64_t from, int64_t to) const;
+    std::vector<std::pair<int64_t, SymbolPoint>> symbolRange(const std::string &sym, int64_t from, int64_t to) const;
+    double maxDrawdown(int64_t from, int64_t to) const;
+    double maxDrawdown(const std::string &sym, int64_t from, int64_t to) const;
+    int64_t lastBucket() const { return account.lastBucket(); }
+    int getResolution() const { return resolution; }
+    QString timeOf(int64_t bucket) const;
+
+private:
+    int resolution;
+    int capacity;
+    int lastSecond{ -1 };       // UpdateTime of the last tick that moved the clock
+    int64_t clock{ 0 };         // market seconds from the midnight before the first tick
+    int64_t hostSecond{ 0 };    // steady host time of the last tick that moved the clock
+    TimeRing<AccountPoint> account;
+    std::unordered_map<std::string, TimeRing<SymbolPoint>> symbols;
+};
+
+#endif // PNLHISTORY_H
@@ -1,11 +1,19 @@
 #ifndef PORTFOLIO_H
 #define PORTFOLIO_H
 
+#include <unordered_map>
+#include <vector>
+
 #include <QObject>
+#include <QColor>
+#include <QSet>
 #include <QAbstractTableModel>
 #include <QTableView>
+#include <QTimer>
 
 #include "position.h"
+#include "pnlhistory.h"
+#include "uisnapshot.h"
 
 class position;
 class RM;
@@ -13,6 +21,9 @@ class OMS;
 class Trader;
 class Dispatcher;
 class Kalman;
+class CommissionEngine;
+class MarginEngine;
+class StressEngine;
 
 struct Account {
 public:
@@ -30,6 +41,7 @@ public:
 	double deposit{ 0 };
 	double withdraw{ 0 };
 	double margin{ 0 };
+	double frozenMargin{ 0 };
 	double commission{ 0 };
 	double cashBalance{ 0 };
 	double closeProfit{ 0 };
@@ -50,12 +62,19 @@ public:
 	int columnCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
 	QVariant headerData(int section, Qt::Orientation orientation, int role) const Q_DECL_OVERRIDE;
 	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const Q_DECL_OVERRIDE;
-	void updatePosTable();
 
 	void setDispatcher(Dispatcher *ee);
 	void setOMS(OMS *oms);
+	void setRM(RM *rm);
+	void setCommissionEngine(CommissionEngine *engine);
+	void setMarginEngine(MarginEngine *engine);
+	void setSnapshotPublisher(SnapshotPublisher *sp, int fps);
+	void setStressEngine(StressEngine *engine);
 	void setPosTableView(QTableView *ptv);
+	void addSubAccount(Portfolio *sub);
+	void shareSymbols(const SymbolList &sl);
 	Trader* getTrader();
+	const PnlHistory &getHistory() const { return history; }
 
 	SymbolList symList;
 	PosList posList;
@@ -63,21 +82,30 @@ public:
 	NetPosList netPosList;
 
 signals:
-	void sendToPosMonitor(QString msg);
-	void sendToAccMonitor(QString msg);
+	void sendToTraderMonitor(QString msg, QColor clr = Qt::white);
 
 public slots:
 	void onEvent(QEvent *ev);
+	void execCmdLine(QString cmdLine);
+	void updatePosTable(const UiSnapshot &snap);
 
 private:
 	//QMap<string, double> commRateList;
 	//QMap<string, NetPos> netPosList;
-	AggPosList constructAggPosList(PosList pList);
-	NetPosList constructNetPosList(AggPosList apList);
-	void updatePosOnTrade(AggPosList &al, PosList &pl, CThostFtdcTradeField *td, SymbolList &sl);
+	AggPosList constructAggPosList(const PosList &pList);
+	NetPosList constructNetPosList(const AggPosList &apList);
+	double updatePosOnTrade(AggPosList &al, PosList &pl, CThostFtdcTradeField *td, SymbolList &sl);
+	bool isDuplicateTrade(CThostFtdcTradeField *td);
 	void evalAccount(Account &acc, AggPosList &aplist, SymbolList &sl);
-	void printNetPos();
-	void printAcc();
+	void evalSymbol(Account &acc, const std::string &sym, SymbolList &sl);
+	void updateMargin(const std::string &sym);
+	void evalAvailable(Account &acc);
+	void markToMarket(const std::string &sym);
+	void reportExposure(const std::string &sym);
+	void record(int64_t bucket, const std::string &sym);
+	void onExposure(Portfolio *pf, const std::string &sym, int delta, bool isHeld);
+	QString accountLine(const Account &a);
+	void publishSnapshot();
 
     QTime initTime();
     QTime updateTime();
@@ -86,19 +114,37 @@ private:
 	std::string time;
 	int millisec{ 0 };
     Account acc;
+	bool isAccDirty{ true };	// positions or account changed, next tick re-evaluates everything
+	PnlHistory history;
 
-	int lastRowCount{ 0 };  // for tableview
+	std::vector<PosRow> rows;  // for tableview, GUI thread only
+	std::unordered_map<std::string, int> rowOf;
 	QTableView *postableview;
 
 	//CThostFtdcTradingAccountField accInfo;
-	bool beginUpdate{ true };
-	bool isInPosStream{ false };
+	QSet<QString> tradeIDs;  // trades replayed from journal may be resent by CTP
 
-	//RM rm;
+	RM *rm{ nullptr };
 	OMS *oms{ nullptr };
 	Trader *trader{ nullptr };
     Dispatcher *dispatcher{ nullptr };
 	Kalman *kf{ nullptr };
+	CommissionEngine *commission{ nullptr };
+	MarginEngine *marginEngine{ nullptr };
+	SnapshotPublisher *publisher{ nullptr };
+	QTimer *snapshotTimer{ nullptr };	// created on the portfolio thread at the first tick
+	int snapshotFps{ 10 };
+	bool isSnapshotDirty{ false };
+	StressEngine *stress{ nullptr };	// fed with the exposure across accounts, host only
+	bool isMarginLive{ false };	// engine has the positions, its margin replaces the queried one
+
+	// Sub-accounts get no ticks of their own, the host marks those holding the symbol.
+	// The host also sums net positions of all its accounts as they change.
+	Portfolio *host{ nullptr };
+	std::vector<Portfolio*> subAccounts;
+	std::unordered_map<std::string, std::vector<Portfolio*>> holders;
+	std::unordered_map<std::string, int> exposure;
+	std::unordered_map<std::string, int> reportedNet;	// own net position last added to the exposure
 
 	/*void updateOnFeed(string sym, double price);
 	void updatePosList(const Position& apos);
@@ -4,6 +4,13 @@
 #include "ThostFtdcUserApiStruct.h"
 
 #include "struct.h"
+#include "positionbook.h"
+
+// Slot of the aggregated position of a symbol, direction and position date.
+inline int aggPositionKey(int symIndex, char direction, char positionDate)
+{
+	return symIndex * 4 + (direction == 'S' ? 2 : 0) + (positionDate == 'T' ? 1 : 0);
+}
 
 class Position {
 public:
@@ -16,7 +23,7 @@ public:
 	void mtm(double price);
 
 	QString positionID;
-	QString aggPositionID;
+	int aggKey{ -1 };
 
 	std::string sym;
 	std::string brokerID;
@@ -50,18 +57,12 @@ public:
 
 typedef QMap<QString, Position> PosList;
 
+// Descriptive fields of an aggregated position, its numbers are row `row` of the book of
+// the AggPosList holding it.
 class AggPosition {
 public:
-	AggPosition();
-	AggPosition(CThostFtdcInvestorPositionField *pf, const SymbolList &sl);
-	AggPosition(const Position &p);
-	~AggPosition();
-
-	void addPosition(const Position &p, int addsub = 1);
-	void delPosition(const Position &p);
-	void mtm(double price);
-
-	QString aggPositionID;
+	int aggKey{ -1 };
+	int row{ -1 };
 
 	std::string sym;
 	std::string brokerID;
@@ -69,42 +70,41 @@ public:
 	char direction{ 0 };
 	char hedgeFlag{ 0 };
 	char positionDate{ 0 };
-	int ydPos{ 0 };
-	int tdPos{ 0 };
-	int pos{ 0 };
-	int openVolume{ 0 };
-	int closVolume{ 0 };
-	double openAmount{ 0 };
-	double closeAmount{ 0 };
-	double positionCost{ 0 };
-	double margin{ 0 };
-	double marginRate{ 0 };
-	double commission{ 0 };
-	double closeProfit{ 0 };
-	double positionProfit{ 0 };
-	double preSttlPrice{ 0 };
-	double sttlPrice{ 0 };
 	std::string tradingDay;
-	double dailyCloseProfit{ 0 };
-	double tradeCloseProfit{ 0 };
-
-	int multiple{ 0 };
-	int side{ 0 };
-	double avgCostPrice{ 0 };
-	double grossPnl{ 0 };
-	double netPnl{ 0 };
-
 };
 
-typedef QMap<QString, AggPosition> AggPosList;
+// Aggregated positions by aggPositionKey, keyIndex holds the index into items or -1.
+// Walking the keys gives the positions of a symbol next to each other, long before short
+// and history before today. The numbers live in the book, changed only through the list.
+class AggPosList {
+public:
+	AggPosition *find(int key);
+	const AggPosition *find(int key) const;
+	void add(const Position &p);
+	void addPosition(const AggPosition &ap, const Position &p, int addsub = 1);
+	void delPosition(const AggPosition &ap, const Position &p);
+	void mtm(const SymbolList &sl);
+	void mtm(const AggPosition &ap, double price);
+	void clear();
+	int size() const { return (int)items.size(); }
+	int keyCount() const { return (int)keyIndex.size(); }
+	const PositionBook &getBook() const { return book; }
+	std::vector<AggPosition>::iterator begin() { return items.begin(); }
+	std::vector<AggPosition>::iterator end() { return items.end(); }
+
+private:
+	std::vector<AggPosition> items;
+	std::vector<int> keyIndex;
+	PositionBook book;
+};
 
 class NetPosition {
 public:
 	NetPosition();
-	NetPosition(const AggPosition &ap);
+	NetPosition(const AggPosition &ap, const PositionBook &book);
 	~NetPosition();
 
-	void addAggPosition(const AggPosition &ap);
+	void addAggPosition(const AggPosition &ap, const PositionBook &book);
 
 	QString netPositionID;
 
@@ -114,6 +114,10 @@ public:
 	int netPos{ 0 };
 	int longPos{ 0 };
 	int shortPos{ 0 };
+	int longYd{ 0 };
+	int longTd{ 0 };
+	int shortYd{ 0 };
+	int shortTd{ 0 };
 	double closeProfit{ 0 };
 	double positionProfit{ 0 };
 	double commission{ 0 };
@@ -0,0 +1,28 @@
+#ifndef POSITIONBOOK_H
+#define POSITIONBOOK_H
+
+#include <vector>
+
+#include "struct.h"
+
+double markPrice(const Symbol &s);
+
+// Numbers of the aggregated positions, one column per field and one row per position. The
+// columns are the storage: AggPosition keeps only the descriptive fields and its row, so
+// revaluing the whole book is a few array expressions over contiguous memory.
+class PositionBook {
+public:
+    int addRow(int side, int multiple, double marginRate);
+    void clear();
+    int size() const { return (int)pos.size(); }
+    void mtm();             // every row with a price
+    void mtm(int row);      // one row, same arithmetic
+    static double total(const std::vector<double> &column);
+
+    std::vector<double> side, pos, multiple, positionCost, avgCostPrice, marginRate;
+    std::vector<double> closeProfit, dailyCloseProfit, commission;
+    std::vector<double> price;      // mark price, 0 until the symbol has a market
+    std::vector<double> positionProfit, margin, grossPnl, netPnl;
+};
+
+#endif // POSITIONBOOK_H
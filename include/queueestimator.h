@@ -0,0 +1,62 @@
+#ifndef QUEUEESTIMATOR_H
+#define QUEUEESTIMATOR_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+#include <QMap>
+#include <QSet>
+#include <QString>
+
+#include "ThostFtdcUserApiStruct.h"
+
+const int BOOK_LEVELS = 5;
+
+struct BookLevels {
+    double bid[BOOK_LEVELS]{ 0 };
+    double ask[BOOK_LEVELS]{ 0 };
+    int bidVolume[BOOK_LEVELS]{ 0 };
+    int askVolume[BOOK_LEVELS]{ 0 };
+    double lastPrice{ 0 };
+    int volume{ 0 };
+};
+
+// Book parsing and queue arithmetic shared by the estimator and the paper exchange's fill model.
+BookLevels toLevels(const CThostFtdcDepthMarketDataField &mkt);
+bool isValidPrice(double px);
+bool isSamePrice(double px1, double px2);
+int displayedVolume(const BookLevels &book, bool isBuy, double price, bool &isVisible);
+bool isTradedThrough(const BookLevels &book, bool isBuy, double price);
+int advanceQueue(int ahead, int levelVolume, int size, bool isThrough, int tradedHere);
+
+struct QueueSlot {
+    std::string sym;
+    bool isBuy{ true };
+    double price{ 0 };
+    int volume{ 0 };        // our remaining volume
+    int ahead{ -1 };        // estimated lots queued ahead of us, -1 until the level was seen
+    int levelVolume{ 0 };   // displayed size at our price on the last tick
+};
+
+// Estimates where our passive orders sit in the exchange queue. The displayed size at our
+// price is taken as ahead of us when the order is acknowledged. Trades at our price then
+// take from the front, the rest of a size decrease is taken as cancels spread evenly over
+// the level, and size added later queues behind us.
+class QueueEstimator {
+public:
+    void onTick(CThostFtdcDepthMarketDataField *mkt);
+    void onOrder(const QString &orderID, CThostFtdcOrderField *of, bool isWorking);
+    int getAhead(const QString &orderID);
+    QString summary();
+
+private:
+    static void advance(QueueSlot &qs, const BookLevels &prev, const BookLevels &book);
+
+    std::unordered_map<std::string, BookLevels> books;
+    QMap<QString, QueueSlot> orders;
+    std::unordered_map<std::string, QSet<QString>> symOrders;
+    std::mutex mu;  // strategies and commands may read estimates from other threads
+};
+
+#endif // QUEUEESTIMATOR_H
@@ -1,7 +1,108 @@
 #ifndef RM_H
 #define RM_H
 
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
 #include <QObject>
+#include <QColor>
+
+#include "spdlog/spdlog.h"
+#include "ThostFtdcUserApiStruct.h"
+
+#include "struct.h"
+#include "position.h"
+
+class ExchangeBudget;
+class MarginEngine;
+class StressEngine;
+
+enum EnumRiskCheckType
+{
+	RiskPassed,
+	RiskUnknownSymbol,
+	RiskOrderSize,
+	RiskInstrumentPos,
+	RiskAccountPos,
+	RiskOrderRate,
+	RiskCancelRate,
+	RiskPriceBand,
+	RiskSelfTrade,
+	RiskMargin,
+	RiskOrderBudget,
+	RiskCancelBudget
+};
+
+namespace mymap
+{
+	const std::map<EnumRiskCheckType, std::string> riskCheck_string{
+		{RiskPassed, "Passed"},
+		{RiskUnknownSymbol, "UnknownSymbol"},
+		{RiskOrderSize, "OrderSize"},
+		{RiskInstrumentPos, "InstrumentPos"},
+		{RiskAccountPos, "AccountPos"},
+		{RiskOrderRate, "OrderRate"},
+		{RiskCancelRate, "CancelRate"},
+		{RiskPriceBand, "PriceBand"},
+		{RiskSelfTrade, "SelfTrade"},
+		{RiskMargin, "Margin"},
+		{RiskOrderBudget, "OrderBudget"},
+		{RiskCancelBudget, "CancelBudget"}
+	};
+}
+
+struct RiskLimits {
+	int maxInstrumentPos{ 50 };     // per instrument per side, filled + working open lots
+	int maxAccountPos{ 200 };       // whole account, filled + working open lots
+	int maxOrdersPerSec{ 5 };
+	int maxCancelsPerSec{ 5 };
+	double priceBand{ 0.02 };       // max deviation ratio from last price
+	double marginBuffer{ 0 };       // money kept aside from available
+};
+
+// Sliding one-second bucket, the same granularity CTP uses for its flow control.
+struct RateCounter {
+	bool tryAcquire(long long nowMs, int limit);
+	int available(long long nowMs, int limit) const;
+
+	long long windowStart{ 0 };
+	int count{ 0 };
+};
+
+// Everything needed to check an order on one instrument, preloaded off the order path.
+struct RiskSymbol {
+	int maxLmtOrderVolume{ 0 };
+	int maxMktOrderVolume{ 0 };
+	int multiple{ 1 };
+	double longMarginRatio{ 0 };
+	double shortMarginRatio{ 0 };
+	double lastPrice{ 0 };
+	double upperLimitPrice{ 0 };
+	double lowerLimitPrice{ 0 };
+
+	int longPos{ 0 };
+	int shortPos{ 0 };
+	int workingOpenLong{ 0 };
+	int workingOpenShort{ 0 };
+
+	// cached best prices of our own working orders, refreshed on order updates
+	double bestWorkingBuy{ 0 };
+	double bestWorkingSell{ 0 };
+	std::multiset<double> workingBuyPrices;
+	std::multiset<double> workingSellPrices;
+};
+
+struct RiskWorkingOrder {
+	std::string sym;
+	char direction{ 0 };
+	bool isOpen{ false };
+	bool isMarket{ false };     // rests at no price, its margin is taken at the last price
+	double price{ 0 };
+	int volume{ 0 };
+};
 
 class RM : public QObject {
 	Q_OBJECT
@@ -10,7 +111,59 @@ public:
 	RM(QObject *parent = nullptr);
 	~RM();
 
+	void onEvent(QEvent *ev);
+	void loadPositions(const NetPosList &npl);
+	void updateAvailable(double available);
+	void setExchangeBudget(ExchangeBudget *budget);
+	void setMarginEngine(MarginEngine *engine);
+	void setStressEngine(StressEngine *engine);
+
+	EnumRiskCheckType checkOrder(const std::string &sym, EnumOffsetFlagType offsetFlag, EnumDirectionType direction, double price, int volume);
+	EnumRiskCheckType checkCancel(const std::string &sym);
+	int orderBudget();
+	void onOrderInsert(const std::string &orderID, const std::string &sym, EnumOffsetFlagType offsetFlag, EnumDirectionType direction, double price, int volume);
+	void onOrderAction(const std::string &sym);
+
+	void switchOn();
+	void switchOff();
+
+	static std::string orderKey(int frontID, int sessionID, const char *orderRef);
+
+	RiskLimits limits;
+
+public slots:
+	void execCmdLine(QString cmdLine);
+
+signals:
+	void sendToTraderMonitor(QString msg, QColor clr = Qt::white);
+
 private:
+	void onContractInfo(CThostFtdcInstrumentField *info);
+	void onOrder(CThostFtdcOrderField *of);
+	void onTrade(CThostFtdcTradeField *td);
+	void addWorkingOrder(const std::string &orderID, const RiskWorkingOrder &wo);
+	void delWorkingOrder(const std::string &orderID);
+	void refreshBestWorking(RiskSymbol &rs);
+	double marginOf(const RiskSymbol &rs, char direction, double price, int volume) const;
+	long long nowMs() const;
+
+	std::unordered_map<std::string, RiskSymbol> symRisk;
+	std::unordered_map<std::string, RiskWorkingOrder> workingOrders;
+	RateCounter orderRate;
+	RateCounter cancelRate;
+	ExchangeBudget *budget{ nullptr };
+	MarginEngine *marginEngine{ nullptr };
+	StressEngine *stress{ nullptr };
+
+	int accountPos{ 0 };          // filled lots of both sides
+	int accountWorkingOpen{ 0 };
+	double available{ 0 };        // balance less position margin, working orders not deducted
+	double frozenMargin{ 0 };     // margin of working open orders
+	bool hasAccount{ false };
+	std::atomic<bool> isWorking{ true };
+	std::mutex mu;
+
+	std::shared_ptr<spdlog::logger> g_logger;
 };
 
 #endif // RM_H
@@ -0,0 +1,74 @@
+#ifndef STRESS_H
+#define STRESS_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+#include <Eigen/Dense>
+
+#include "spdlog/spdlog.h"
+
+class InstrumentCache;
+
+// Price move in percent for the instruments a key selects: an instrument, a product, a
+// group of products or an exchange, the most specific key of a scenario wins.
+struct StressShock {
+    std::string key;
+    double move{ 0 };
+};
+
+struct StressScenario {
+    std::string name;
+    std::vector<StressShock> shocks;
+};
+
+struct StressInstrument {
+    std::string sym;
+    std::string product;
+    std::string exchange;
+    int multiple{ 1 };
+    int netPos{ 0 };
+    double price{ 0 };
+};
+
+// PnL of every scenario over the book as shocks * value, with shocks a scenarios x
+// instruments matrix of relative moves and value the money in each instrument. A position
+// or price change adds its column times the change of value, O(scenarios), so the vector
+// is current after every trade and tick; adding a scenario or instrument grows the matrix.
+class StressEngine {
+public:
+    StressEngine();
+
+    void setInstrumentCache(InstrumentCache *cache);
+    bool load(const QString &path);
+    void setGroup(const std::string &name, const std::vector<std::string> &products);
+    void addScenario(const StressScenario &sc);
+    static bool parseShocks(const QString &spec, std::vector<StressShock> &shocks);
+
+    void setPosition(const std::string &sym, int netPos, double price);
+    void setPrice(const std::string &sym, double price);
+    void revalue();
+    const Eigen::VectorXd &getPnl() const { return pnl; }
+    QString summary();
+
+private:
+    int column(const std::string &sym);
+    double shockOf(const StressScenario &sc, const StressInstrument &si) const;
+    void setValue(int col, double v);
+
+    InstrumentCache *instrumentCache{ nullptr };
+    std::unordered_map<std::string, int> columns;
+    std::vector<StressInstrument> instruments;
+    std::vector<StressScenario> scenarios;
+    std::unordered_map<std::string, std::vector<std::string>> groups;
+
+    Eigen::MatrixXd shocks;
+    Eigen::VectorXd value;
+    Eigen::VectorXd pnl;
+
+    std::shared_ptr<spdlog::logger> g_logger;
+};
+
+#endif // STRESS_H
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 
 #include <QMap>
 #include "ThostFtdcUserApiStruct.h"
@@ -10,12 +12,18 @@
 typedef QMap<std::string, CThostFtdcInstrumentField> SymInfoMap;
 typedef QMap<std::string, CThostFtdcDepthMarketDataField*> SymTickMap;
 
+// Whole query response, delivered in one event when bIsLast arrives
+typedef std::shared_ptr<std::vector<CThostFtdcInstrumentField>> ContractInfoSnapshot;
+typedef std::shared_ptr<std::vector<CThostFtdcInvestorPositionDetailField>> PosDetailSnapshot;
+typedef std::shared_ptr<std::vector<CThostFtdcOrderField>> OrderSnapshot;
+
 struct Symbol {
     Symbol() {}
-    Symbol(CThostFtdcDepthMarketDataField *mktf, CThostFtdcInstrumentField *info)
-        :mkt(mktf), info(info) {}
+    Symbol(CThostFtdcDepthMarketDataField *mktf, CThostFtdcInstrumentField *info, int index)
+        :mkt(mktf), info(info), index(index) {}
     CThostFtdcDepthMarketDataField *mkt{ nullptr };
     CThostFtdcInstrumentField *info{ nullptr };
+    int index{ -1 };    // order of arrival in the list, keys the position store
 };
 typedef QMap<std::string, Symbol> SymbolList;
 
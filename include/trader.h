@@ -1,7 +1,9 @@
 ﻿#ifndef TRADER_H
 #define TRADER_H
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 //#include <QCoreApplication>
 //#include <QObject>
@@ -16,6 +18,12 @@
 
 class QObject;
 class QString;
+class RM;
+class Journal;
+class InstrumentCache;
+class LatencyTracker;
+class PaperTraderApi;
+class MyEvent;
 
 
 class Trader : public QObject, public CThostFtdcTraderSpi {
@@ -54,10 +62,17 @@ public:
 
     void showApiReturn(int ret, QString outputIfSuccess = "", QString outputIfError = "TraderApi sent Error.");
     std::string getTradingDay();
+    int getLastOrderRef();
+    int getOrderBudget();
     void setDispatcher(Dispatcher *ee);
+    void setRM(RM *rm);
+    void setJournal(Journal *journal);
+    void setInstrumentCache(InstrumentCache *cache);
+    void setLatencyTracker(LatencyTracker *latency);
     void handleDispatch(int tt);
 
     Dispatcher* getDispatcher();
+    PaperTraderApi* getPaperApi();
 
 public slots:
     int ReqQrySettlementInfo(std::string TradingDay = "");
@@ -84,6 +99,7 @@ private:
     void OnRspQrySettlementInfoConfirm(CThostFtdcSettlementInfoConfirmField *pSettlementInfoConfirm, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
 
     void OnRspQryInstrument(CThostFtdcInstrumentField *pInstrument, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    void OnRspQryInstrumentMarginRate(CThostFtdcInstrumentMarginRateField *pInstrumentMarginRate, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
     void OnRspQryInstrumentCommissionRate(CThostFtdcInstrumentCommissionRateField *pInstrumentCommissionRate, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
     void OnRspQryDepthMarketData(CThostFtdcDepthMarketDataField *pDepthMarketData, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
 
@@ -103,8 +119,14 @@ private:
 
 
     bool isErrorRspInfo(CThostFtdcRspInfoField *pRspInfo, const char *msg = "");
+    bool isRiskRejected(int riskCheck, const std::string &InstrumentID, const char *msg = "");
+    void postOrderFlowEvent(MyEvent *ev);
+    void postInsertRejected(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo);
+    void onInstrumentsReady();
+    void startRateRefresh();
 
     static void timerReq(Trader *trader, const char *req);
+    static void refreshRates(Trader *trader);
 
     //template <typename... Args>
     //void logger(const char* fmt, const Args&... args);
@@ -119,8 +141,9 @@ private:
     }
 
     CThostFtdcTraderApi *tdapi;
+    PaperTraderApi *paperApi{ nullptr };    // set when the front address is paper://<latency ms>
 
-    int nRequestID{ 0 };
+    std::atomic<int> nRequestID{ 0 };   // also taken by the rate refresh thread
     int nMaxOrderRef{ 0 };
     int FrontID{ 0 };
     int SessionID{ 0 };
@@ -143,8 +166,20 @@ private:
     const std::string BROKER_ID;
     const std::string USER_ID;
     const std::string PASSWORD;
+    std::string accountTag;     // empty for the first trader, else _<user id>, keeps logs and flow files apart
 
     Dispatcher *dispatcher;
+    RM *rm{ nullptr };
+    Journal *journal{ nullptr };
+    std::vector<MyEvent*> pendingOrderFlow;  // live order/trade events held until journal recovered
+    InstrumentCache *instrumentCache{ nullptr };
+    LatencyTracker *latency{ nullptr };
+    // query responses accumulated until bIsLast, then posted as one snapshot
+    std::vector<CThostFtdcInstrumentField> instrumentBuffer;
+    std::vector<CThostFtdcInvestorPositionDetailField> posDetailBuffer;
+    std::vector<CThostFtdcOrderField> orderBuffer;
+    std::atomic<bool> isRefreshingRates{ false };
+    bool isRateRefreshDue{ false };     // started once the login workflow sent its last query
 
     std::shared_ptr<spdlog::logger> console;
     std::shared_ptr<spdlog::logger> g_logger;
@@ -0,0 +1,56 @@
+#ifndef UISNAPSHOT_H
+#define UISNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QString>
+
+struct PosRow {
+    std::string sym;
+    double lastPrice{ 0 };
+    int netPos{ 0 };
+    double avgCostPrice{ 0 };
+    double positionProfit{ 0 };
+    double netPnl{ 0 };
+};
+
+// What the GUI shows of the portfolio, copied out on the portfolio thread and never
+// changed once published.
+struct UiSnapshot {
+    uint64_t seq{ 0 };
+    double balance{ 0 };
+    double netPnl{ 0 };
+    double closeProfit{ 0 };
+    double positionProfit{ 0 };
+    double margin{ 0 };
+    double commission{ 0 };
+    std::string time;
+    int millisec{ 0 };
+    std::vector<PosRow> positions;
+
+    QString timeText() const;
+    QString accountText() const;
+    QString positionText() const;
+};
+
+// Double buffer between the portfolio thread, which fills back() and publishes it, and the
+// GUI, which reads latest() at its own frame rate. A published buffer is reused for writing
+// only once no reader holds it any more.
+class SnapshotPublisher {
+public:
+    SnapshotPublisher();
+
+    UiSnapshot &back() { return *spare; }
+    void publish();
+    std::shared_ptr<const UiSnapshot> latest() const;
+
+private:
+    std::shared_ptr<const UiSnapshot> front;
+    std::shared_ptr<UiSnapshot> spare;
+    uint64_t seq{ 0 };
+};
+
+#endif // UISNAPSHOT_H
@@ -16,35 +16,67 @@ TARGET = momi
 TEMPLATE = app
 
 SOURCES += src/main.cpp\
+    src/commission.cpp \
     src/ctpmonitor.cpp \
     src/datahub.cpp \
     src/dispatcher.cpp \
+    src/exchangebudget.cpp \
+    src/execalgo.cpp \
+    src/fillmodel.cpp \
+    src/instrumentcache.cpp \
+    src/journal.cpp \
     src/kalman.cpp \
+    src/latency.cpp \
+    src/margin.cpp \
     src/kdbconnector.cpp \
     src/mdspi.cpp \
     src/myevent.cpp \
+    src/offsetoptimizer.cpp \
     src/oms.cpp \
+    src/pairexec.cpp \
+    src/papertraderapi.cpp \
+    src/pnlhistory.cpp \
     src/portfolio.cpp \
     src/position.cpp \
+    src/positionbook.cpp \
+    src/queueestimator.cpp \
     src/rm.cpp \
     src/strategy.cpp \
+    src/stress.cpp \
     src/trader.cpp \
+    src/uisnapshot.cpp \
 
-HEADERS += include/ctpmonitor.h \
+HEADERS += include/commission.h \
+    include/ctpmonitor.h \
     include/datahub.h \
     include/dispatcher.h \
+    include/exchangebudget.h \
+    include/execalgo.h \
+    include/fillmodel.h \
+    include/instrumentcache.h \
+    include/journal.h \
     include/k.h \
     include/kalman.h \
+    include/latency.h \
+    include/margin.h \
     include/kdbconnector.h \
     include/mdspi.h \
     include/myevent.h \
+    include/offsetoptimizer.h \
     include/oms.h \
+    include/pairexec.h \
+    include/papertraderapi.h \
+    include/pnlhistory.h \
     include/portfolio.h \
     include/position.h \
+    include/positionbook.h \
+    include/queueestimator.h \
     include/rm.h \
     include/strategy.h \
+    include/stress.h \
     include/struct.h \
     include/trader.h \
+    include/uisnapshot.h \
     include/ThostFtdcMdApi.h \
     include/ThostFtdcTraderApi.h \
     include/ThostFtdcUserApiDataType.h \
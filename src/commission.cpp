@@ -0,0 +1,61 @@
+#include "include/commission.h"
+#include "include/instrumentcache.h"
+
+using namespace std;
+
+void CommissionEngine::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+}
+
+// Costs are kept once the commission rate is known, until then the lookup is retried.
+OffsetCost CommissionEngine::costs(const string &sym)
+{
+    lock_guard<mutex> lock(mu);
+    auto &c = costCache[sym];
+    if (c.isKnown || instrumentCache == nullptr)
+        return c;
+    CThostFtdcInstrumentField info;
+    if (instrumentCache->getInstrument(sym, info)) {
+        string exchangeID = info.ExchangeID;
+        if (exchangeID == "SHFE" || exchangeID == "INE")
+            c.rule = CloseBySpecifiedFlag;
+        else if (exchangeID == "CFFEX")
+            c.rule = CloseTodayFirst;
+        else
+            c.rule = CloseYesterdayFirst;
+        c.multiple = info.VolumeMultiple;
+    }
+    CThostFtdcInstrumentCommissionRateField rate;
+    if (instrumentCache->getCommissionRate(sym, rate)) {
+        c.openByMoney = rate.OpenRatioByMoney;
+        c.openByVolume = rate.OpenRatioByVolume;
+        c.closeByMoney = rate.CloseRatioByMoney;
+        c.closeByVolume = rate.CloseRatioByVolume;
+        c.closeTodayByMoney = rate.CloseTodayRatioByMoney;
+        c.closeTodayByVolume = rate.CloseTodayRatioByVolume;
+        c.isKnown = true;
+    }
+    return c;
+}
+
+// Estimate for an order, a plain Close is priced as closing yesterday's lots.
+// 0 while the rate is unknown.
+double CommissionEngine::fee(const string &sym, char offsetFlag, double price, int volume)
+{
+    if (offsetFlag == THOST_FTDC_OF_Open)
+        return openFee(sym, price, volume);
+    return closeFee(sym, offsetFlag == THOST_FTDC_OF_CloseToday, price, volume);
+}
+
+double CommissionEngine::openFee(const string &sym, double price, int volume)
+{
+    return costs(sym).open(price) * volume;
+}
+
+// The exchange charges by the lots closed, whatever the flag of the order was.
+double CommissionEngine::closeFee(const string &sym, bool isToday, double price, int volume)
+{
+    OffsetCost c = costs(sym);
+    return (isToday ? c.closeToday(price) : c.close(price)) * volume;
+}
@@ -84,6 +84,25 @@ Ui::CtpMonitorClass CtpMonitor::getui()
     return ui;
 }
 
+// Portfolio panes redraw at fps from the latest snapshot, skipped when nothing was published.
+void CtpMonitor::setSnapshotPublisher(SnapshotPublisher *sp, int fps)
+{
+    publisher = sp;
+    connect(&frameTimer, &QTimer::timeout, this, &CtpMonitor::onFrame);
+    frameTimer.start(1000 / qMax(fps, 1));
+}
+
+void CtpMonitor::onFrame()
+{
+    auto snap = publisher->latest();
+    if (snap->seq == shownSeq)
+        return;
+    shownSeq = snap->seq;
+    printPosMsg(snap->positionText());
+    printAccMsg(snap->accountText());
+    emit frameUpdated(*snap);
+}
+
 void CtpMonitor::printMdSpiMsg(QString msg)
 {
     ui.mdOutput->clear();
@@ -135,6 +154,8 @@ void CtpMonitor::recCmdLine()
             "q[?]                queries\n"
             "i[?]                insert orders\n"
             "c[?]                cancel orders\n"
+            "lat [sym|exch|dump] order latency stats\n"
+            "paper [lat ..]      paper exchange; lat ms [jitter ms] [exch]\n"
             "login               trader login\n"
             "logout              trader logout\n"
             "\n"
@@ -142,7 +163,13 @@ void CtpMonitor::recCmdLine()
             "md [?]\n"
             "\n"
             "OMS(Order Management System) commands:\n"
-            "oms [?]"
+            "oms [?]\n"
+            "\n"
+            "RM(Risk Management) commands:\n"
+            "rm [?]\n"
+            "\n"
+            "Portfolio commands:\n"
+            "pf [?]"
         };
         printToTraderCmdMonitor(usage, Qt::cyan);
     }
@@ -185,6 +212,47 @@ void CtpMonitor::recCmdLine()
             "oms on                              Turn on OMS\n"
             "oms off                             Turn off OMS\n"
             "oms tgt [symbol] [tgtpos] [price]   Use algo trying to get tgtpos\n"
+            "oms algo twap|vwap [symbol] [tgtpos] [seconds]\n"
+            "                                    Work tgtpos over time\n"
+            "oms algo pov [symbol] [tgtpos] [pct]  Work tgtpos at pct of market volume\n"
+            "oms algo stop [symbol]              Stop algo, keep current target\n"
+            "oms algo show                       Show working algos\n"
+            "oms pair [y] [x] [units] [yratio] [xratio] [maxlots] [seconds]\n"
+            "                                    Work units of y:x, passive on the less liquid leg,\n"
+            "                                    hold it while unhedged lots/seconds exceed bounds\n"
+            "oms pair stop [symbol]              Stop pair, keep current targets\n"
+            "oms pair show                       Show pairs\n"
+            "oms po                              Show sliced parent orders\n"
+            "oms queue                           Show queue position estimates\n"
+            "oms lock on|off                     Lock today's lots when cheaper than closing\n"
+            "oms fee [symbol] [price] [volume]   Show open/close/close today commission\n"
+            "oms reprice [lots|off]              Re-price orders off target with more lots ahead\n"
+        };
+        printToTraderCmdMonitor(usage, Qt::cyan);
+    }
+    else if (argv.at(0) == "rm?") {
+        QString usage{
+            "rm commands:\n"
+            "rm on                               Turn on pre-trade risk checks\n"
+            "rm off                              Turn off pre-trade risk checks\n"
+            "rm lim [inst/acc/ord/cxl] [value]   Set position or rate limit\n"
+            "rm show                             Show limits and risk state\n"
+            "rm budget [symbol]                  Show daily order/cancel/self-trade counts\n"
+            "rm margin                           Show margin and frozen margin by product\n"
+            "rm stress                           Show PnL of each stress scenario\n"
+            "rm stress [name] [key:move%,...]    Add or replace a scenario, key is an\n"
+            "                                    instrument, product, group or exchange\n"
+            "rm blim [exchange] [ord/cxl/self] [value]\n"
+            "                                    Set daily cap of an exchange, 0 for none\n"
+        };
+        printToTraderCmdMonitor(usage, Qt::cyan);
+    }
+    else if (argv.at(0) == "pf?") {
+        QString usage{
+            "pf commands:\n"
+            "pf acc                              Show each account and the total\n"
+            "pf exp [symbol]                     Show net position across accounts\n"
+            "pf pnl [minutes] [symbol]           Show net PnL range and drawdown over the last minutes\n"
         };
         printToTraderCmdMonitor(usage, Qt::cyan);
     }
@@ -192,6 +260,10 @@ void CtpMonitor::recCmdLine()
         emit sendCmdLineToMdspi(cmdLine);
     else if (argv.at(0) == "oms")
         emit sendCmdLineToOms(cmdLine);
+    else if (argv.at(0) == "rm")
+        emit sendCmdLineToRm(cmdLine);
+    else if (argv.at(0) == "pf")
+        emit sendCmdLineToPortfolio(cmdLine);
     else
         emit sendCmdLineToTrader(cmdLine);
     ui.traderCommandLine->clear();
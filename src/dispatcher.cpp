@@ -42,9 +42,11 @@ void Dispatcher::customEvent(QEvent *ev)
 		emit dispatchAccInfo(ev);
 		break;
 	case ContractInfoEvent:
+	case ContractInfoSnapshotEvent:
 		emit dispatchContractInfo(ev);
 		break;
 	case OrderEvent:
+	case OrderSnapshotEvent:
 		emit dispatchOrder(ev);
 		break;
 	case TradeEvent:
@@ -54,6 +56,7 @@ void Dispatcher::customEvent(QEvent *ev)
 		emit dispatchPos(ev);
 		break;
 	case PositionDetailEvent:
+	case PositionDetailSnapshotEvent:
 		emit dispatchPosDetail(ev);
 		break;
 	case AccountUpdateEvent:
@@ -0,0 +1,237 @@
+#include <algorithm>
+
+#include "include/exchangebudget.h"
+
+using namespace std;
+
+ExchangeBudget::ExchangeBudget()
+{
+    g_logger = spdlog::get("file_logger");
+    table = make_shared<BudgetTable>();
+
+    // thresholds of the exchanges' abnormal trading rules, counted per trading day
+    setExchange("SHFE", 500, 5, false);
+    setExchange("INE", 500, 5, false);
+    setExchange("DCE", 500, 5, false);
+    setExchange("CZCE", 500, 5, false);
+    setExchange("CFFEX", 400, 5, true);
+}
+
+void ExchangeBudget::setExchange(const string &exchangeID, int maxCancels, int maxSelfTrades, bool isPerProduct)
+{
+    auto &lim = exchangeLimits[exchangeID];
+    lim.maxCancels = maxCancels;
+    lim.maxSelfTrades = maxSelfTrades;
+    lim.isPerProduct = isPerProduct;
+}
+
+// Builds a new table for the contracts, keeping the counts of contracts already known.
+void ExchangeBudget::setInstruments(const vector<CThostFtdcInstrumentField> &infos)
+{
+    auto old = atomic_load(&table);
+    auto next = make_shared<BudgetTable>();
+    unordered_map<string, BudgetCounter*> products;
+    auto copyCounts = [](BudgetCounter &to, const BudgetCounter *from) {
+        if (from == nullptr)
+            return;
+        to.orders = from->orders.load();
+        to.cancels = from->cancels.load();
+        to.selfTrades = from->selfTrades.load();
+    };
+    for (auto &info : infos) {
+        InstrumentBudget ib;
+        ib.exchangeID = info.ExchangeID;
+        auto oit = old->instruments.find(info.InstrumentID);
+        next->counters.emplace_back();
+        ib.instrument = &next->counters.back();
+        if (oit != old->instruments.end())
+            copyCounts(*ib.instrument, oit->second.instrument);
+
+        string productKey = ib.exchangeID + "." + info.ProductID;
+        auto pit = products.find(productKey);
+        if (pit == products.end()) {
+            next->counters.emplace_back();
+            pit = products.insert({ productKey, &next->counters.back() }).first;
+            if (oit != old->instruments.end())
+                copyCounts(*pit->second, oit->second.product);
+        }
+        ib.product = pit->second;
+        next->instruments[info.InstrumentID] = ib;
+    }
+    atomic_store(&table, next);
+    g_logger->info("ExchangeBudget: {} instruments, {} products", next->instruments.size(), products.size());
+}
+
+// Recounts the day from the order snapshot of the account, orders rejected before
+// reaching the exchange are not counted.
+void ExchangeBudget::loadOrders(const vector<CThostFtdcOrderField> &orders)
+{
+    auto t = atomic_load(&table);
+    for (auto &c : t->counters) {
+        c.orders = 0;
+        c.cancels = 0;
+    }
+    for (auto &of : orders) {
+        auto it = t->instruments.find(of.InstrumentID);
+        if (it == t->instruments.end() || of.OrderSubmitStatus == THOST_FTDC_OSS_InsertRejected)
+            continue;
+        ++it->second.instrument->orders;
+        ++it->second.product->orders;
+        if (of.OrderStatus == THOST_FTDC_OST_Canceled) {
+            ++it->second.instrument->cancels;
+            ++it->second.product->cancels;
+        }
+    }
+}
+
+void ExchangeBudget::onOrderInsert(const string &sym)
+{
+    auto t = atomic_load(&table);
+    auto it = t->instruments.find(sym);
+    if (it == t->instruments.end())
+        return;
+    ++it->second.instrument->orders;
+    ++it->second.product->orders;
+}
+
+void ExchangeBudget::onCancel(const string &sym)
+{
+    auto t = atomic_load(&table);
+    auto it = t->instruments.find(sym);
+    if (it == t->instruments.end())
+        return;
+    ++it->second.instrument->cancels;
+    ++it->second.product->cancels;
+}
+
+// Both of our orders in a self-trade come back with the same TradeID and opposite directions.
+// TradeIDs and self-trade counts start over with each trading day.
+void ExchangeBudget::onTrade(CThostFtdcTradeField *td)
+{
+    if (tradingDay != td->TradingDay) {
+        if (!tradingDay.empty()) {
+            tradeDirections.clear();
+            for (auto &c : atomic_load(&table)->counters)
+                c.selfTrades = 0;
+        }
+        tradingDay = td->TradingDay;
+    }
+    string key = string(td->ExchangeID) + td->TradeID;
+    auto dit = tradeDirections.find(key);
+    if (dit == tradeDirections.end()) {
+        tradeDirections[key] = td->Direction;
+        return;
+    }
+    if (dit->second == td->Direction)
+        return;     // same trade returned again
+    dit->second = 0;
+    auto t = atomic_load(&table);
+    auto it = t->instruments.find(td->InstrumentID);
+    if (it == t->instruments.end())
+        return;
+    ++it->second.instrument->selfTrades;
+    ++it->second.product->selfTrades;
+    g_logger->warn("Self-trade on {}, TradeID={}, count={}", td->InstrumentID, td->TradeID, it->second.instrument->selfTrades.load());
+}
+
+const BudgetLimits *ExchangeBudget::find(const string &sym, InstrumentBudget &ib)
+{
+    auto t = atomic_load(&table);
+    auto it = t->instruments.find(sym);
+    if (it == t->instruments.end())
+        return nullptr;
+    auto lit = exchangeLimits.find(it->second.exchangeID);
+    if (lit == exchangeLimits.end())
+        return nullptr;
+    ib = it->second;
+    return &lit->second;
+}
+
+BudgetCounter *ExchangeBudget::counted(const InstrumentBudget &ib, const BudgetLimits &lim) const
+{
+    return lim.isPerProduct ? ib.product : ib.instrument;
+}
+
+bool ExchangeBudget::canOrder(const string &sym)
+{
+    InstrumentBudget ib;
+    auto lim = find(sym, ib);
+    if (lim == nullptr)
+        return true;
+    auto c = counted(ib, *lim);
+    int maxSelfTrades = lim->maxSelfTrades;
+    if (maxSelfTrades > 0 && c->selfTrades >= maxSelfTrades)
+        return false;
+    int maxOrders = lim->maxOrders;
+    return maxOrders <= 0 || c->orders < maxOrders;
+}
+
+bool ExchangeBudget::canCancel(const string &sym)
+{
+    InstrumentBudget ib;
+    auto lim = find(sym, ib);
+    if (lim == nullptr)
+        return true;
+    int maxCancels = lim->maxCancels;
+    return maxCancels <= 0 || counted(ib, *lim)->cancels < maxCancels;
+}
+
+// Share of the daily cap still unused, 1 when uncapped.
+double ExchangeBudget::orderHeadroom(const string &sym)
+{
+    InstrumentBudget ib;
+    auto lim = find(sym, ib);
+    int cap = lim == nullptr ? 0 : lim->maxOrders.load();
+    if (cap <= 0)
+        return 1;
+    return max(0.0, 1 - double(counted(ib, *lim)->orders) / cap);
+}
+
+double ExchangeBudget::cancelHeadroom(const string &sym)
+{
+    InstrumentBudget ib;
+    auto lim = find(sym, ib);
+    int cap = lim == nullptr ? 0 : lim->maxCancels.load();
+    if (cap <= 0)
+        return 1;
+    return max(0.0, 1 - double(counted(ib, *lim)->cancels) / cap);
+}
+
+// Only exchanges set up in the constructor, the map is read without a lock and the caps are atomic.
+bool ExchangeBudget::setLimit(const string &exchangeID, const string &kind, int value)
+{
+    auto it = exchangeLimits.find(exchangeID);
+    if (it == exchangeLimits.end() || value < 0)
+        return false;
+    if (kind == "ord")
+        it->second.maxOrders = value;
+    else if (kind == "cxl")
+        it->second.maxCancels = value;
+    else if (kind == "self")
+        it->second.maxSelfTrades = value;
+    else
+        return false;
+    return true;
+}
+
+// Caps per exchange, plus counts of sym or of every instrument with orders today.
+QString ExchangeBudget::summary(const string &sym)
+{
+    QString msg;
+    for (auto &kv : exchangeLimits)
+        msg += QString("%1 ord<%2 cxl<%3 self<%4 %5\n").arg(kv.first.c_str()).arg(kv.second.maxOrders.load())
+            .arg(kv.second.maxCancels.load()).arg(kv.second.maxSelfTrades.load()).arg(kv.second.isPerProduct ? "per product" : "per instrument");
+    auto t = atomic_load(&table);
+    map<string, const InstrumentBudget*> selected;
+    for (auto &kv : t->instruments) {
+        if (sym == "" ? kv.second.instrument->orders > 0 : kv.first == sym)
+            selected[kv.first] = &kv.second;
+    }
+    for (auto &kv : selected) {
+        auto ib = kv.second;
+        msg += QString("%1 ord=%2 cxl=%3 self=%4 | product ord=%5 cxl=%6 self=%7\n").arg(kv.first.c_str())
+            .arg(ib->instrument->orders.load()).arg(ib->instrument->cancels.load()).arg(ib->instrument->selfTrades.load())
+            .arg(ib->product->orders.load()).arg(ib->product->cancels.load()).arg(ib->product->selfTrades.load());
+    }
+    return msg;
+}
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <QSettings>
+
+#include "include/execalgo.h"
+#include "include/oms.h"
+#include "include/instrumentcache.h"
+
+using namespace std;
+
+const int MS_PER_DAY = 24 * 3600 * 1000;
+const int SESSION_START_MS = 18 * 3600 * 1000;
+
+ExecAlgo::ExecAlgo()
+{
+    g_logger = spdlog::get("file_logger");
+}
+
+void ExecAlgo::setOMS(OMS *oms)
+{
+    this->oms = oms;
+}
+
+void ExecAlgo::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+}
+
+// Intraday volume profiles, one group per product or symbol, exported from the kdb
+// trade history. Keys are bucket times, values the volume traded in the bucket:
+//   [rb]
+//   2100-2130=41230
+//   2130-2200=25110
+//   0900-0915=30214
+// Weights are normalized, so raw volumes or shares both work.
+bool ExecAlgo::loadProfiles(const QString &path)
+{
+    QSettings settings(path, QSettings::IniFormat);
+    lock_guard<mutex> lock(mu);
+    for (auto &group : settings.childGroups()) {
+        settings.beginGroup(group);
+        vector<VolumeBucket> profile;
+        double total = 0;
+        for (auto &key : settings.childKeys()) {
+            QStringList span = key.split("-");
+            bool okb{ false }, oke{ false };
+            int begin = span.count() == 2 ? span.at(0).toInt(&okb) : 0;
+            int end = span.count() == 2 ? span.at(1).toInt(&oke) : 0;
+            double weight = settings.value(key).toDouble();
+            if (!okb || !oke || weight < 0) {
+                g_logger->warn("ExecAlgo: invalid volume bucket {} of {}", key.toStdString(), group.toStdString());
+                continue;
+            }
+            VolumeBucket b;
+            b.beginMs = sessionMs((begin / 100 * 60 + begin % 100) * 60000);
+            b.endMs = sessionMs((end / 100 * 60 + end % 100) * 60000);
+            if (b.endMs <= b.beginMs)
+                continue;
+            b.share = weight;
+            total += weight;
+            profile.push_back(b);
+        }
+        settings.endGroup();
+        if (total <= 0)
+            continue;
+        sort(profile.begin(), profile.end(), [](const VolumeBucket &a, const VolumeBucket &b) { return a.beginMs < b.beginMs; });
+        double cum = 0;
+        for (auto &b : profile) {
+            b.share /= total;
+            b.cumBefore = cum;
+            cum += b.share;
+        }
+        profiles[group.toStdString()] = profile;
+    }
+    g_logger->info("ExecAlgo: {} volume profiles", profiles.size());
+    return !profiles.empty();
+}
+
+// Replaces any algo already working sym, one parent target per symbol like OMS targets.
+void ExecAlgo::start(const AlgoOrder &ao)
+{
+    AlgoOrder order = ao;
+    if (order.type == AlgoVWAP)
+        order.profileKey = profileKeyOf(order.sym);
+    lock_guard<mutex> lock(mu);
+    if (order.type == AlgoVWAP && order.profileKey.empty())
+        g_logger->warn("ExecAlgo: no volume profile for {}, VWAP runs time linear", order.sym);
+    auto &algos = symAlgos[order.sym];
+    algos.clear();
+    algos.push_back(order);
+}
+
+// A profile of the symbol itself wins over the one of its product.
+string ExecAlgo::profileKeyOf(const string &sym)
+{
+    string product;
+    CThostFtdcInstrumentField info;
+    if (instrumentCache != nullptr && instrumentCache->getInstrument(sym, info))
+        product = info.ProductID;
+    lock_guard<mutex> lock(mu);
+    if (profiles.count(sym))
+        return sym;
+    if (!product.empty() && profiles.count(product))
+        return product;
+    return "";
+}
+
+void ExecAlgo::stop(const string &sym)
+{
+    lock_guard<mutex> lock(mu);
+    symAlgos.erase(sym);
+}
+
+void ExecAlgo::onTick(CThostFtdcDepthMarketDataField *mkt)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = symAlgos.find(mkt->InstrumentID);
+    if (it == symAlgos.end())
+        return;
+    auto &algos = it->second;
+    for (auto &ao : algos)
+        step(ao, mkt);
+    algos.erase(remove_if(algos.begin(), algos.end(), [](const AlgoOrder &ao) { return ao.isDone; }), algos.end());
+    if (algos.empty())
+        symAlgos.erase(it);
+}
+
+void ExecAlgo::step(AlgoOrder &ao, CThostFtdcDepthMarketDataField *mkt)
+{
+    int nowMs = timeOfDayMs(mkt);
+    if (!ao.isStarted) {
+        ao.isStarted = true;
+        ao.startMs = nowMs;
+        ao.startVolume = mkt->Volume;
+        ao.startPos = oms->getNetPos(ao.sym);
+        ao.childTarget = ao.startPos;
+    }
+    int elapsedMs = nowMs - ao.startMs;
+    if (elapsedMs < 0)  // night session across midnight
+        elapsedMs += MS_PER_DAY;
+
+    double fraction = scheduleFraction(ao, elapsedMs, mkt->Volume - ao.startVolume);
+    int total = ao.finalTarget - ao.startPos;
+    int child = ao.startPos + (int)lround(fraction * total);
+    if (child == ao.childTarget) {
+        ao.isDone = (child == ao.finalTarget);
+        return;
+    }
+    ao.childTarget = child;
+
+    // join our side of the book while on schedule, cross once the schedule is complete
+    bool isBuy = total > 0;
+    bool isFinal = (child == ao.finalTarget);
+    double price = (isBuy == isFinal ? mkt->AskPrice1 : mkt->BidPrice1);
+    oms->setPosTarget(ao.sym.c_str(), child, price);
+    ao.isDone = isFinal;
+}
+
+// Share of the parent quantity that should be done by now.
+double ExecAlgo::scheduleFraction(const AlgoOrder &ao, int elapsedMs, int mktVolume) const
+{
+    switch (ao.type)
+    {
+    case AlgoTWAP:
+        return ao.durationMs <= 0 ? 1 : min(1.0, double(elapsedMs) / ao.durationMs);
+    case AlgoVWAP:
+    {
+        if (elapsedMs >= ao.durationMs)
+            return 1;
+        auto it = profiles.find(ao.profileKey);
+        if (it == profiles.end())
+            return double(elapsedMs) / ao.durationMs;
+        // share of the horizon's expected volume that has traded by now
+        int begin = sessionMs(ao.startMs);
+        double cumBegin = cumVolumeShare(it->second, begin);
+        double expected = cumVolumeShare(it->second, begin + ao.durationMs) - cumBegin;
+        if (expected <= 0)
+            return double(elapsedMs) / ao.durationMs;
+        return min(1.0, (cumVolumeShare(it->second, begin + elapsedMs) - cumBegin) / expected);
+    }
+    case AlgoPOV:
+    {
+        int total = abs(ao.finalTarget - ao.startPos);
+        if (total == 0)
+            return 1;
+        return min(1.0, ao.participation * max(mktVolume, 0) / total);
+    }
+    default:
+        return 1;
+    }
+}
+
+// Share of the day's volume traded before t, volume is spread evenly within a bucket
+// and nothing trades in the breaks between buckets.
+double ExecAlgo::cumVolumeShare(const vector<VolumeBucket> &profile, int t) const
+{
+    auto it = upper_bound(profile.begin(), profile.end(), t, [](int t, const VolumeBucket &b) { return t < b.endMs; });
+    if (it == profile.end())
+        return 1;
+    if (t <= it->beginMs)
+        return it->cumBefore;
+    return it->cumBefore + it->share * (t - it->beginMs) / (it->endMs - it->beginMs);
+}
+
+int ExecAlgo::timeOfDayMs(CThostFtdcDepthMarketDataField *mkt)
+{
+    int h{ 0 }, m{ 0 }, s{ 0 };
+    sscanf(mkt->UpdateTime, "%d:%d:%d", &h, &m, &s);
+    return ((h * 60 + m) * 60 + s) * 1000 + mkt->UpdateMillisec;
+}
+
+int ExecAlgo::sessionMs(int timeOfDayMs)
+{
+    return (timeOfDayMs - SESSION_START_MS + MS_PER_DAY) % MS_PER_DAY;
+}
+
+// oms algo twap|vwap [symbol] [tgtpos] [seconds]
+// oms algo pov [symbol] [tgtpos] [percent]
+// oms algo stop [symbol]
+// oms algo show
+QString ExecAlgo::execCmd(const QStringList &argv)
+{
+    int n = argv.count();
+    if (n == 3 && argv.at(2) == "show")
+        return summary();
+    if (n == 4 && argv.at(2) == "stop") {
+        stop(argv.at(3).toStdString());
+        return QString("Algo on %1 stopped").arg(argv.at(3));
+    }
+    if (n == 6) {
+        AlgoOrder ao;
+        ao.sym = argv.at(3).toStdString();
+        bool okp, okv;
+        ao.finalTarget = argv.at(4).toInt(&okp);
+        double val = argv.at(5).toDouble(&okv);
+        if (!okp || !okv || val <= 0)
+            return "Invalid cmd";
+        if (argv.at(2) == "twap" || argv.at(2) == "vwap") {
+            ao.type = (argv.at(2) == "twap" ? AlgoTWAP : AlgoVWAP);
+            ao.durationMs = (int)(val * 1000);
+        }
+        else if (argv.at(2) == "pov") {
+            ao.type = AlgoPOV;
+            ao.participation = val / 100;
+        }
+        else
+            return "Invalid cmd";
+        start(ao);
+        return QString("%1 started on %2, target %3").arg(mymap::execAlgo_string.at(ao.type).c_str())
+            .arg(ao.sym.c_str()).arg(ao.finalTarget);
+    }
+    return "Invalid cmd";
+}
+
+QString ExecAlgo::summary()
+{
+    lock_guard<mutex> lock(mu);
+    QString msg;
+    for (auto &kv : symAlgos) {
+        for (auto &ao : kv.second) {
+            msg += QString("%1 %2 start=%3 child=%4 final=%5\n").arg(ao.sym.c_str())
+                .arg(mymap::execAlgo_string.at(ao.type).c_str())
+                .arg(ao.startPos).arg(ao.childTarget).arg(ao.finalTarget);
+        }
+    }
+    if (msg == "")
+        msg = "No algo working";
+    return msg;
+}
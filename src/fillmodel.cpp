@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <climits>
+
+#include "include/fillmodel.h"
+
+using namespace std;
+
+static bool isWithin(bool isBuy, double px, double limit)
+{
+    return isBuy ? px <= limit + 1e-6 : px >= limit - 1e-6;
+}
+
+// Volume the opposite levels within limit can give, used up from the book when isTaking.
+static int walk(BookLevels &book, size_t order, bool isBuy, double limit, bool isMarket, int volume, bool isTaking, vector<FillEvent> *fills)
+{
+    const double *px = isBuy ? book.ask : book.bid;
+    int *vol = isBuy ? book.askVolume : book.bidVolume;
+    int left = volume;
+    for (int i = 0; i < BOOK_LEVELS && left > 0 && isValidPrice(px[i]); ++i) {
+        if (!isMarket && !isWithin(isBuy, px[i], limit))
+            break;
+        int n = min(left, vol[i]);
+        if (n <= 0)
+            continue;
+        left -= n;
+        if (isTaking)
+            vol[i] -= n;
+        if (fills != nullptr)
+            fills->push_back({ order, px[i], n });
+    }
+    return volume - left;
+}
+
+bool FillModel::hasBook(const string &sym) const
+{
+    auto it = books.find(sym);
+    return it != books.end() && it->second.hasTick;
+}
+
+void FillModel::onTick(const CThostFtdcDepthMarketDataField &mkt, vector<FillEvent> &fills)
+{
+    auto &sb = books[mkt.InstrumentID];
+    BookLevels book = toLevels(mkt);
+    auto &rs = sb.resting;
+    if (sb.hasTick && !rs.ids.empty()) {
+        int traded = max(book.volume - sb.book.volume, 0);
+        bool isLastValid = isValidPrice(book.lastPrice);
+        // our lots already passed at each side and price, they trade before our later orders there
+        struct QueuedLots { bool isBuy; double price; int lots; };
+        vector<QueuedLots> ours;
+        bool hasDone = false;
+
+        for (size_t i = 0; i < rs.ids.size(); ++i) {
+            bool isBuy = rs.isBuy[i];
+            double px = rs.price[i];
+            int rem = rs.remaining[i];
+            auto qit = find_if(ours.begin(), ours.end(), [&](const QueuedLots &q) { return q.isBuy == isBuy && isSamePrice(q.price, px); });
+            if (qit == ours.end())
+                qit = ours.insert(ours.end(), { isBuy, px, 0 });
+            int ourAhead = qit->lots;
+            qit->lots += rem;
+
+            bool isVisible;
+            int size = displayedVolume(book, isBuy, px, isVisible);
+            bool isThrough = isTradedThrough(book, isBuy, px);
+            int tradedHere = isLastValid && isSamePrice(book.lastPrice, px) ? traded : 0;
+
+            int fill = 0;
+            if (isThrough)
+                fill = rem;
+            else {
+                // the opposite side reached our price and trades with us first
+                fill = walk(book, rs.ids[i], isBuy, px, false, rem, true, nullptr);
+                if (fill < rem && tradedHere > 0 && rs.ahead[i] >= 0)
+                    fill += min(max(tradedHere - rs.ahead[i] - ourAhead, 0), rem - fill);
+            }
+
+            if (isVisible) {
+                rs.ahead[i] = rs.ahead[i] < 0 ? size : advanceQueue(rs.ahead[i], rs.levelVolume[i], size, isThrough, tradedHere);
+                rs.levelVolume[i] = size;
+            }
+
+            if (fill > 0) {
+                fills.push_back({ rs.ids[i], px, fill });
+                rs.remaining[i] -= fill;
+                hasDone |= (rs.remaining[i] == 0);
+            }
+        }
+
+        if (hasDone) {
+            size_t j = 0;
+            for (size_t i = 0; i < rs.ids.size(); ++i) {
+                if (rs.remaining[i] <= 0)
+                    continue;
+                rs.ids[j] = rs.ids[i];
+                rs.isBuy[j] = rs.isBuy[i];
+                rs.price[j] = rs.price[i];
+                rs.remaining[j] = rs.remaining[i];
+                rs.ahead[j] = rs.ahead[i];
+                rs.levelVolume[j] = rs.levelVolume[i];
+                ++j;
+            }
+            rs.ids.resize(j);
+            rs.isBuy.resize(j);
+            rs.price.resize(j);
+            rs.remaining.resize(j);
+            rs.ahead.resize(j);
+            rs.levelVolume.resize(j);
+        }
+    }
+    // size used up by our fills stays used up for orders arriving on this tick
+    sb.book = book;
+    sb.hasTick = true;
+}
+
+int FillModel::available(const string &sym, bool isBuy, double limit, bool isMarket)
+{
+    auto it = books.find(sym);
+    if (it == books.end() || !it->second.hasTick)
+        return 0;
+    return walk(it->second.book, 0, isBuy, limit, isMarket, INT_MAX, false, nullptr);
+}
+
+int FillModel::take(const string &sym, size_t order, bool isBuy, double limit, bool isMarket, int volume, vector<FillEvent> &fills)
+{
+    auto it = books.find(sym);
+    if (it == books.end() || !it->second.hasTick)
+        return 0;
+    return walk(it->second.book, order, isBuy, limit, isMarket, volume, true, &fills);
+}
+
+void FillModel::rest(const string &sym, size_t order, bool isBuy, double price, int volume)
+{
+    auto &sb = books[sym];
+    auto &rs = sb.resting;
+    int ahead = -1;
+    int size = 0;
+    if (sb.hasTick) {
+        bool isVisible;
+        size = displayedVolume(sb.book, isBuy, price, isVisible);
+        if (isVisible)
+            ahead = size;
+    }
+    rs.ids.push_back(order);
+    rs.isBuy.push_back(isBuy);
+    rs.price.push_back(price);
+    rs.remaining.push_back(volume);
+    rs.ahead.push_back(ahead);
+    rs.levelVolume.push_back(size);
+}
+
+void FillModel::remove(const string &sym, size_t order)
+{
+    auto it = books.find(sym);
+    if (it == books.end())
+        return;
+    auto &rs = it->second.resting;
+    auto pos = find(rs.ids.begin(), rs.ids.end(), order);
+    if (pos == rs.ids.end())
+        return;
+    size_t i = pos - rs.ids.begin();
+    rs.ids.erase(rs.ids.begin() + i);
+    rs.isBuy.erase(rs.isBuy.begin() + i);
+    rs.price.erase(rs.price.begin() + i);
+    rs.remaining.erase(rs.remaining.begin() + i);
+    rs.ahead.erase(rs.ahead.begin() + i);
+    rs.levelVolume.erase(rs.levelVolume.begin() + i);
+}
+
+int FillModel::getAhead(const string &sym, size_t order)
+{
+    auto it = books.find(sym);
+    if (it == books.end())
+        return -1;
+    auto &rs = it->second.resting;
+    auto pos = find(rs.ids.begin(), rs.ids.end(), order);
+    return pos == rs.ids.end() ? -1 : rs.ahead[pos - rs.ids.begin()];
+}
+
+size_t FillModel::restingCount() const
+{
+    size_t n = 0;
+    for (auto &kv : books)
+        n += kv.second.resting.ids.size();
+    return n;
+}
@@ -0,0 +1,281 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QStringList>
+
+#include "include/instrumentcache.h"
+#include "include/myevent.h"
+#include "include/dispatcher.h"
+
+using namespace std;
+
+const uint32_t INSTRUMENT_CACHE_MAGIC = 0x4349494d;  // "MIIC"
+const uint16_t INSTRUMENT_CACHE_VERSION = 1;
+
+InstrumentCache::InstrumentCache(const string &dir)
+    : dir(dir)
+{
+    g_logger = spdlog::get("file_logger");
+}
+
+InstrumentCache::~InstrumentCache()
+{
+}
+
+string InstrumentCache::filePath(const string &day) const
+{
+    return dir + "/instruments." + day + ".bin";
+}
+
+// Loads the newest cache file on disk. Trading day is unknown before login,
+// setTradingDay() decides later whether the loaded rates still count as fresh.
+bool InstrumentCache::load()
+{
+    auto t0 = chrono::steady_clock::now();
+    QStringList files = QDir(dir.c_str()).entryList(QStringList() << "instruments.*.bin", QDir::Files, QDir::Name);
+    if (files.isEmpty())
+        return false;
+    auto path = dir + "/" + files.last().toStdString();
+
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+
+    InstrumentCacheHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != INSTRUMENT_CACHE_MAGIC
+        || hdr.version != INSTRUMENT_CACHE_VERSION
+        || hdr.instrumentSize != sizeof(CThostFtdcInstrumentField)
+        || hdr.marginRateSize != sizeof(CThostFtdcInstrumentMarginRateField)
+        || hdr.commissionRateSize != sizeof(CThostFtdcInstrumentCommissionRateField)) {
+        fclose(f);
+        g_logger->warn("Instrument cache {} is invalid or of another version, ignored", path);
+        return false;
+    }
+
+    vector<CThostFtdcInstrumentField> infos(hdr.instrumentCount);
+    vector<CThostFtdcInstrumentMarginRateField> margins(hdr.marginRateCount);
+    vector<CThostFtdcInstrumentCommissionRateField> commissions(hdr.commissionRateCount);
+    bool ok = fread(infos.data(), sizeof(CThostFtdcInstrumentField), infos.size(), f) == infos.size()
+        && fread(margins.data(), sizeof(CThostFtdcInstrumentMarginRateField), margins.size(), f) == margins.size()
+        && fread(commissions.data(), sizeof(CThostFtdcInstrumentCommissionRateField), commissions.size(), f) == commissions.size();
+    fclose(f);
+    if (!ok) {
+        g_logger->warn("Instrument cache {} is truncated, ignored", path);
+        return false;
+    }
+
+    lock_guard<mutex> lock(mu);
+    hdr.tradingDay[sizeof(hdr.tradingDay) - 1] = '\0';
+    cacheDay = hdr.tradingDay;
+    for (auto &info : infos)
+        instruments[info.InstrumentID] = info;
+    for (auto &rate : margins)
+        marginRates[rate.InstrumentID] = rate;
+    for (auto &rate : commissions)
+        commissionRates[rate.InstrumentID] = rate;
+
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+    g_logger->info("Instrument cache of {} loaded: {} instruments, {} margin rates, {} commission rates in {} us",
+        cacheDay, instruments.size(), marginRates.size(), commissionRates.size(), us);
+    return true;
+}
+
+// Writes to a temp file and renames over, so a crash never leaves a torn cache behind.
+bool InstrumentCache::save()
+{
+    InstrumentCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    vector<CThostFtdcInstrumentField> infos;
+    vector<CThostFtdcInstrumentMarginRateField> margins;
+    vector<CThostFtdcInstrumentCommissionRateField> commissions;
+    {
+        lock_guard<mutex> lock(mu);
+        if (tradingDay == "" || instruments.empty())
+            return false;
+        cacheDay = tradingDay;
+        for (auto &kv : instruments)
+            infos.push_back(kv.second);
+        for (auto &kv : marginRates)
+            margins.push_back(kv.second);
+        for (auto &kv : commissionRates)
+            commissions.push_back(kv.second);
+    }
+
+    hdr.magic = INSTRUMENT_CACHE_MAGIC;
+    hdr.version = INSTRUMENT_CACHE_VERSION;
+    strncpy(hdr.tradingDay, cacheDay.c_str(), sizeof(hdr.tradingDay) - 1);
+    hdr.instrumentSize = sizeof(CThostFtdcInstrumentField);
+    hdr.marginRateSize = sizeof(CThostFtdcInstrumentMarginRateField);
+    hdr.commissionRateSize = sizeof(CThostFtdcInstrumentCommissionRateField);
+    hdr.instrumentCount = infos.size();
+    hdr.marginRateCount = margins.size();
+    hdr.commissionRateCount = commissions.size();
+
+    auto path = filePath(cacheDay);
+    auto tmpPath = path + ".tmp";
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (f == nullptr) {
+        g_logger->error("Instrument cache write failed: {}", tmpPath);
+        return false;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(infos.data(), sizeof(CThostFtdcInstrumentField), infos.size(), f);
+    fwrite(margins.data(), sizeof(CThostFtdcInstrumentMarginRateField), margins.size(), f);
+    fwrite(commissions.data(), sizeof(CThostFtdcInstrumentCommissionRateField), commissions.size(), f);
+    fclose(f);
+
+    QDir qdir(dir.c_str());
+    qdir.remove(QString::fromStdString(path));
+    qdir.rename(QString::fromStdString(tmpPath), QString::fromStdString(path));
+    // only the newest file is ever loaded
+    for (auto &old : qdir.entryList(QStringList() << "instruments.*.bin", QDir::Files)) {
+        if (dir + "/" + old.toStdString() != path)
+            qdir.remove(old);
+    }
+    return true;
+}
+
+// Posts the cached contract info the same way OnRspQryInstrument does,
+// so Portfolio, OMS and RM know their symbols before login.
+int InstrumentCache::postContractInfo(Dispatcher *dispatcher)
+{
+    auto snapshot = make_shared<vector<CThostFtdcInstrumentField>>();
+    {
+        lock_guard<mutex> lock(mu);
+        snapshot->reserve(instruments.size());
+        for (auto &kv : instruments)
+            snapshot->push_back(kv.second);
+    }
+    if (!snapshot->empty())
+        QCoreApplication::postEvent(dispatcher, new MyEvent(ContractInfoSnapshotEvent, snapshot));
+    return snapshot->size();
+}
+
+void InstrumentCache::setTradingDay(const string &tradingDay)
+{
+    lock_guard<mutex> lock(mu);
+    this->tradingDay = tradingDay;
+    freshMarginRates.clear();
+    freshCommissionRates.clear();
+    if (cacheDay == tradingDay) {
+        for (auto &kv : marginRates)
+            freshMarginRates.insert(kv.first);
+        for (auto &kv : commissionRates)
+            freshCommissionRates.insert(kv.first);
+    }
+}
+
+string InstrumentCache::getTradingDay()
+{
+    lock_guard<mutex> lock(mu);
+    return tradingDay;
+}
+
+bool InstrumentCache::isFresh(const string &tradingDay)
+{
+    lock_guard<mutex> lock(mu);
+    return cacheDay == tradingDay && !instruments.empty();
+}
+
+// A full ReqQryInstrument replaces the cached universe, expired contracts drop out.
+void InstrumentCache::setInstruments(const vector<CThostFtdcInstrumentField> &infos)
+{
+    lock_guard<mutex> lock(mu);
+    instruments.clear();
+    for (auto &info : infos)
+        instruments[info.InstrumentID] = info;
+    cacheDay = "";
+}
+
+void InstrumentCache::updateMarginRate(CThostFtdcInstrumentMarginRateField *rate)
+{
+    lock_guard<mutex> lock(mu);
+    marginRates[rate->InstrumentID] = *rate;
+    freshMarginRates.insert(rate->InstrumentID);
+}
+
+void InstrumentCache::updateCommissionRate(CThostFtdcInstrumentCommissionRateField *rate)
+{
+    lock_guard<mutex> lock(mu);
+    commissionRates[rate->InstrumentID] = *rate;
+    freshCommissionRates.insert(rate->InstrumentID);
+}
+
+bool InstrumentCache::getInstrument(const string &sym, CThostFtdcInstrumentField &info)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = instruments.find(sym);
+    if (it == instruments.end())
+        return false;
+    info = it->second;
+    return true;
+}
+
+vector<CThostFtdcInstrumentField> InstrumentCache::getInstruments()
+{
+    lock_guard<mutex> lock(mu);
+    vector<CThostFtdcInstrumentField> infos;
+    infos.reserve(instruments.size());
+    for (auto &kv : instruments)
+        infos.push_back(kv.second);
+    return infos;
+}
+
+bool InstrumentCache::getMarginRate(const string &sym, CThostFtdcInstrumentMarginRateField &rate)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = marginRates.find(sym);
+    if (it == marginRates.end())
+        return false;
+    rate = it->second;
+    return true;
+}
+
+bool InstrumentCache::getCommissionRate(const string &sym, CThostFtdcInstrumentCommissionRateField &rate)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = commissionRates.find(sym);
+    if (it == commissionRates.end()) {
+        auto iit = instruments.find(sym);
+        if (iit == instruments.end())
+            return false;
+        it = commissionRates.find(iit->second.ProductID);
+        if (it == commissionRates.end())
+            return false;
+    }
+    rate = it->second;
+    return true;
+}
+
+// Futures instruments whose margin rate was not yet refreshed for the trading day.
+vector<string> InstrumentCache::staleMarginRates()
+{
+    lock_guard<mutex> lock(mu);
+    vector<string> syms;
+    for (auto &kv : instruments) {
+        if (kv.second.ProductClass == THOST_FTDC_PC_Futures && freshMarginRates.count(kv.first) == 0)
+            syms.push_back(kv.first);
+    }
+    return syms;
+}
+
+// Commission is mostly set per product and CTP answers with the product as InstrumentID,
+// so one instrument per product is queried.
+vector<string> InstrumentCache::staleCommissionRates()
+{
+    lock_guard<mutex> lock(mu);
+    map<string, string> products;
+    for (auto &kv : instruments) {
+        if (kv.second.ProductClass == THOST_FTDC_PC_Futures && freshCommissionRates.count(kv.first) == 0
+            && freshCommissionRates.count(kv.second.ProductID) == 0)
+            products[kv.second.ProductID] = kv.first;
+    }
+    vector<string> syms;
+    for (auto &kv : products)
+        syms.push_back(kv.second);
+    return syms;
+}
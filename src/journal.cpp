@@ -0,0 +1,214 @@
+#include <chrono>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <QCoreApplication>
+
+#include "include/journal.h"
+#include "include/myevent.h"
+#include "include/dispatcher.h"
+
+using namespace std;
+
+const uint32_t JOURNAL_MAGIC = 0x4a494d4d;  // "MMIJ"
+
+Journal::Journal(const string &path)
+    : path(path)
+{
+    g_logger = spdlog::get("file_logger");
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+// Opens the journal of tradingDay for append. A journal left from another trading day
+// is rotated away, so recover() only ever replays the current day.
+bool Journal::open(const string &tradingDay)
+{
+    if (file != nullptr)
+        return true;
+    this->tradingDay = tradingDay;
+
+    auto journalDay = readTradingDay();
+    if (journalDay != "" && journalDay != tradingDay) {
+        auto oldPath = path + "." + journalDay;
+        std::rename(path.c_str(), oldPath.c_str());
+        g_logger->info("Journal of {} rotated to {}", journalDay, oldPath);
+        journalDay = "";
+    }
+
+    file = fopen(path.c_str(), "ab");
+    if (file == nullptr) {
+        g_logger->error("Journal open failed: {}", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    recoverEnd = ftell(file);
+    if (journalDay == "")
+        append(JournalTradingDay, tradingDay.c_str(), tradingDay.length());
+
+    isRunning = true;
+    writer = thread(&Journal::run, this);
+    g_logger->info("Journal opened: {}, TradingDay={}, {} bytes to recover", path, tradingDay, recoverEnd);
+    return true;
+}
+
+void Journal::close()
+{
+    if (isRunning) {
+        isRunning = false;
+        cv.notify_one();
+        writer.join();
+    }
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+void Journal::append(EnumJournalRecordType type, const void *data, uint32_t length)
+{
+    JournalRecordHeader hdr;
+    hdr.magic = JOURNAL_MAGIC;
+    hdr.type = type;
+    hdr.reserved = 0;
+    hdr.length = length;
+    hdr.timestamp = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+    unique_lock<mutex> locker(mu);
+    auto pos = buffer.size();
+    buffer.resize(pos + sizeof(hdr) + length);
+    memcpy(&buffer[pos], &hdr, sizeof(hdr));
+    if (length > 0)
+        memcpy(&buffer[pos + sizeof(hdr)], data, length);
+    bool isFull = buffer.size() >= flushBytes;
+    locker.unlock();
+    if (isFull)
+        cv.notify_one();
+}
+
+void Journal::run()
+{
+    vector<char> buf;
+    while (isRunning) {
+        {
+            unique_lock<mutex> locker(mu);
+            cv.wait_for(locker, chrono::milliseconds(flushIntervalMs),
+                [this] { return buffer.size() >= flushBytes || !isRunning; });
+            buf.swap(buffer);
+        }
+        flush(buf);
+    }
+    // drain what was appended while stopping
+    {
+        lock_guard<mutex> locker(mu);
+        buf.swap(buffer);
+    }
+    flush(buf);
+}
+
+void Journal::flush(vector<char> &buf)
+{
+    if (buf.empty() || file == nullptr)
+        return;
+    fwrite(buf.data(), 1, buf.size(), file);
+    fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+    buf.clear();
+}
+
+string Journal::readTradingDay()
+{
+    string day;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return day;
+    JournalRecordHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.magic == JOURNAL_MAGIC
+        && hdr.type == JournalTradingDay && hdr.length < 16) {
+        char buf[16] = { 0 };
+        if (fread(buf, 1, hdr.length, f) == hdr.length)
+            day = buf;
+    }
+    fclose(f);
+    return day;
+}
+
+// Replays the records journaled before open() through the dispatcher, the same path
+// live Trader callbacks take, so OMS and Portfolio rebuild without querying CTP.
+int Journal::recover(Dispatcher *dispatcher)
+{
+    if (recovered)
+        return 0;
+    recovered = true;
+    if (recoverEnd == 0)
+        return 0;
+
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return 0;
+
+    auto t0 = chrono::steady_clock::now();
+    int count{ 0 };
+    long offset{ 0 };
+    JournalRecordHeader hdr;
+    vector<char> payload;
+    while (offset + (long)sizeof(hdr) <= recoverEnd && fread(&hdr, sizeof(hdr), 1, f) == 1) {
+        // torn tail from a crash mid-write, stop there
+        if (hdr.magic != JOURNAL_MAGIC || offset + (long)(sizeof(hdr) + hdr.length) > recoverEnd)
+            break;
+        payload.resize(hdr.length);
+        if (hdr.length > 0 && fread(payload.data(), 1, hdr.length, f) != hdr.length)
+            break;
+        offset += sizeof(hdr) + hdr.length;
+
+        switch (hdr.type)
+        {
+        case JournalOrder:
+        {
+            if (hdr.length != sizeof(CThostFtdcOrderField)) break;
+            auto fcpy = new CThostFtdcOrderField;
+            memcpy(fcpy, payload.data(), hdr.length);
+            QCoreApplication::postEvent(dispatcher, new MyEvent(OrderEvent, fcpy));
+            ++count;
+            break;
+        }
+        case JournalTrade:
+        {
+            if (hdr.length != sizeof(CThostFtdcTradeField)) break;
+            auto fcpy = new CThostFtdcTradeField;
+            memcpy(fcpy, payload.data(), hdr.length);
+            QCoreApplication::postEvent(dispatcher, new MyEvent(TradeEvent, fcpy));
+            ++count;
+            break;
+        }
+        case JournalPositionDetail:
+        {
+            if (hdr.length % sizeof(CThostFtdcInvestorPositionDetailField) != 0) break;
+            auto snapshot = make_shared<vector<CThostFtdcInvestorPositionDetailField>>(hdr.length / sizeof(CThostFtdcInvestorPositionDetailField));
+            if (hdr.length > 0)
+                memcpy(snapshot->data(), payload.data(), hdr.length);
+            QCoreApplication::postEvent(dispatcher, new MyEvent(PositionDetailSnapshotEvent, snapshot));
+            ++count;
+            break;
+        }
+        default:  // trading day and order requests are kept for audit only
+            break;
+        }
+    }
+    fclose(f);
+
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+    g_logger->info("Journal recovered {} records in {} us", count, us);
+    return count;
+}
@@ -73,8 +73,8 @@ void Kalman::onFeed(MyEvent *myev)
                 //oms->setPosTarget(pair.yname.c_str(), pair.targetYpos, pair.targetYprice);
                 //oms->setPosTarget(pair.xname.c_str(), pair.targetXpos, pair.targetXprice);
 
-                oms->setPosTarget(pair.yname.c_str(), 0, y_t);
-                oms->setPosTarget(pair.xname.c_str(), 0, x_t);
+                // legs are worked together by the pair executor of OMS
+                oms->updatePairPosTarget(pair.yname, pair.xname, 0, y_t, 0, x_t);
             }
         }
     }
@@ -0,0 +1,234 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "include/latency.h"
+
+using namespace std;
+
+// decision of the thread about to call ReqOrderInsert, OMS and Trader run on the same thread
+static thread_local uint64_t lastDecision{ 0 };
+
+void LatencyHistogram::add(double us)
+{
+    int last = BUCKETS - 1;
+    int i = (us < 1 ? 0 : min(last, (int)log2(us) + 1));
+    ++buckets[i];
+    ++count;
+    sum += us;
+    if (us > max)
+        max = us;
+}
+
+// Upper bound of the bucket holding the p-th percentile.
+double LatencyHistogram::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+    int64_t n{ 0 };
+    for (int i = 0; i < BUCKETS; ++i) {
+        n += buckets[i];
+        if (n >= p * count)
+            return std::min(double(1LL << i), max);
+    }
+    return max;
+}
+
+LatencyTracker::LatencyTracker()
+{
+    g_logger = spdlog::get("file_logger");
+
+    // calibrate TSC ticks against the steady clock
+    auto t0 = chrono::steady_clock::now();
+    auto c0 = now();
+    while (chrono::steady_clock::now() - t0 < chrono::milliseconds(10));
+    auto c1 = now();
+    auto us = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count() / 1000.0;
+    ticksPerUs = (c1 - c0) / us;
+    g_logger->info("LatencyTracker: {:.1f} ticks per us", ticksPerUs);
+}
+
+uint64_t LatencyTracker::now()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void LatencyTracker::markDecision()
+{
+    lastDecision = now();
+}
+
+// Nothing went out, the next order must not be measured from this decision.
+void LatencyTracker::clearDecision()
+{
+    lastDecision = 0;
+}
+
+void LatencyTracker::onInsert(const char *orderRef, const string &sym)
+{
+    auto tsc = now();
+    lock_guard<mutex> lock(mu);
+    auto &ol = orders[atoi(orderRef)];
+    ol = OrderLatency();
+    ol.sym = sym;
+    ol.tsc[StageInsert] = tsc;
+    if (lastDecision != 0) {
+        ol.tsc[StageDecision] = lastDecision;
+        symStats[sym].stages[StageDecision].add(toMicroseconds(tsc - lastDecision));
+        lastDecision = 0;
+    }
+}
+
+void LatencyTracker::onRspInsert(const char *orderRef)
+{
+    auto tsc = now();
+    lock_guard<mutex> lock(mu);
+    auto it = orders.find(atoi(orderRef));
+    if (it == orders.end())
+        return;
+    stamp(it->second, StageRspInsert, tsc);
+    orders.erase(it);   // rejected by CTP, no more returns
+}
+
+void LatencyTracker::onOrder(CThostFtdcOrderField *order)
+{
+    auto tsc = now();
+    lock_guard<mutex> lock(mu);
+    int ref = atoi(order->OrderRef);
+    auto it = orders.find(ref);
+    if (it == orders.end())
+        return;
+    auto &ol = it->second;
+    if (ol.exchangeID == "")
+        ol.exchangeID = order->ExchangeID;
+    stamp(ol, StageFirstRtn, tsc);
+    if (order->OrderSysID[0] != '\0' && ol.tsc[StageAccepted] == 0) {
+        stamp(ol, StageAccepted, tsc);
+        sysIDs[ol.exchangeID + order->OrderSysID] = ref;
+    }
+
+    switch (order->OrderStatus)
+    {
+    case THOST_FTDC_OST_AllTraded:
+        if (ol.tsc[StageFirstTrade] == 0) {
+            ol.isDone = true;
+            break;
+        }
+        // fall through
+    case THOST_FTDC_OST_Canceled:
+    case THOST_FTDC_OST_PartTradedNotQueueing:
+    case THOST_FTDC_OST_NoTradeNotQueueing:
+        sysIDs.erase(ol.exchangeID + order->OrderSysID);
+        orders.erase(it);
+        break;
+    default:
+        break;
+    }
+}
+
+void LatencyTracker::onTrade(CThostFtdcTradeField *trade)
+{
+    auto tsc = now();
+    lock_guard<mutex> lock(mu);
+    auto sit = sysIDs.find(string(trade->ExchangeID) + trade->OrderSysID);
+    if (sit == sysIDs.end())
+        return;
+    auto it = orders.find(sit->second);
+    if (it == orders.end())
+        return;
+    stamp(it->second, StageFirstTrade, tsc);
+    if (it->second.isDone) {
+        orders.erase(it);
+        sysIDs.erase(sit);
+    }
+}
+
+// First stamp of a stage only, measured from the insert.
+void LatencyTracker::stamp(OrderLatency &ol, EnumLatencyStageType stage, uint64_t tsc)
+{
+    if (ol.tsc[stage] != 0)
+        return;
+    ol.tsc[stage] = tsc;
+    double us = toMicroseconds(tsc - ol.tsc[StageInsert]);
+    symStats[ol.sym].stages[stage].add(us);
+    if (ol.exchangeID != "")
+        exchangeStats[ol.exchangeID].stages[stage].add(us);
+}
+
+// Stats of a symbol or an exchange, all exchanges when key is empty.
+QString LatencyTracker::summary(const string &key)
+{
+    lock_guard<mutex> lock(mu);
+    map<string, const LatencyStats*> selected;
+    if (key == "") {
+        for (auto &kv : exchangeStats)
+            selected[kv.first] = &kv.second;
+    }
+    else if (symStats.count(key) > 0)
+        selected[key] = &symStats[key];
+    else if (exchangeStats.count(key) > 0)
+        selected[key] = &exchangeStats[key];
+
+    QString msg;
+    for (auto &kv : selected) {
+        for (int s = 0; s < StageCount; ++s) {
+            auto &h = kv.second->stages[s];
+            if (h.count == 0)
+                continue;
+            msg += QString("%1 %2 n=%3 mean=%4us p50=%5us p99=%6us max=%7us\n")
+                .arg(kv.first.c_str(), -8)
+                .arg(mymap::latencyStage_string.at(EnumLatencyStageType(s)).c_str(), -10)
+                .arg(h.count).arg(h.mean(), 0, 'f', 1)
+                .arg(h.percentile(0.5), 0, 'f', 0).arg(h.percentile(0.99), 0, 'f', 0)
+                .arg(h.max, 0, 'f', 1);
+        }
+    }
+    if (msg == "")
+        msg = "No latency data";
+    return msg;
+}
+
+bool LatencyTracker::dump(const string &path)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == nullptr) {
+        g_logger->error("Latency dump failed: {}", path);
+        return false;
+    }
+    lock_guard<mutex> lock(mu);
+    fprintf(f, "group,key,stage,count,mean_us,p50_us,p90_us,p99_us,max_us");
+    for (int i = 0; i < LatencyHistogram::BUCKETS; ++i)
+        fprintf(f, ",b%d", i);
+    fprintf(f, "\n");
+    auto write = [&](const char *group, const map<string, LatencyStats> &stats) {
+        for (auto &kv : stats) {
+            for (int s = 0; s < StageCount; ++s) {
+                auto &h = kv.second.stages[s];
+                if (h.count == 0)
+                    continue;
+                fprintf(f, "%s,%s,%s,%lld,%.2f,%.0f,%.0f,%.0f,%.2f", group, kv.first.c_str(),
+                    mymap::latencyStage_string.at(EnumLatencyStageType(s)).c_str(), (long long)h.count,
+                    h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.max);
+                for (int i = 0; i < LatencyHistogram::BUCKETS; ++i)
+                    fprintf(f, ",%lld", (long long)h.buckets[i]);
+                fprintf(f, "\n");
+            }
+        }
+    };
+    write("exchange", exchangeStats);
+    write("symbol", symStats);
+    fclose(f);
+    g_logger->info("Latency dumped to {}", path);
+    return true;
+}
@@ -2,6 +2,7 @@
 #include <QDebug>
 #include <QThread>
 #include <QDir>
+#include <QSettings>
 
 #include "spdlog/spdlog.h"
 
@@ -12,6 +13,17 @@
 #include "include/trader.h"
 #include "include/mdspi.h"
 #include "include/portfolio.h"
+#include "include/rm.h"
+#include "include/exchangebudget.h"
+#include "include/journal.h"
+#include "include/instrumentcache.h"
+#include "include/commission.h"
+#include "include/margin.h"
+#include "include/stress.h"
+#include "include/latency.h"
+#include "include/execalgo.h"
+#include "include/pairexec.h"
+#include "include/papertraderapi.h"
 #include "include/kalman.h"
 #include "include/dispatcher.h"
 // include kdbconnector.h in last order for k.h polute reason
@@ -63,6 +75,56 @@ void Reader::onEvent(CtpDataEvent ev) {
     }
 }
 
+struct AccountConfig {
+    string front;
+    string broker;
+    string user;
+    string password;
+};
+
+// Accounts in accounts.ini, the first one also logs in to market data and runs the strategy:
+//   [accounts]
+//   size=2
+//   1\front=tcp://...
+//   1\broker=...
+//   1\user=...
+//   1\password=...
+//   2\front=...
+//   [md]
+//   front=tcp://...
+//   [ui]
+//   fps=10
+static vector<AccountConfig> loadAccounts(const QString &path, const AccountConfig &defaultAccount, string &mdFront)
+{
+    vector<AccountConfig> accounts;
+    QSettings settings(path, QSettings::IniFormat);
+    int n = settings.beginReadArray("accounts");
+    for (int i = 0; i < n; ++i) {
+        settings.setArrayIndex(i);
+        AccountConfig cfg;
+        cfg.front = settings.value("front").toString().toStdString();
+        cfg.broker = settings.value("broker").toString().toStdString();
+        cfg.user = settings.value("user").toString().toStdString();
+        cfg.password = settings.value("password").toString().toStdString();
+        accounts.push_back(cfg);
+    }
+    settings.endArray();
+    if (accounts.empty())
+        accounts.push_back(defaultAccount);
+    mdFront = settings.value("md/front", mdFront.c_str()).toString().toStdString();
+    return accounts;
+}
+
+// Account traded by hand or by another process, monitored here with its own session.
+struct SubAccount {
+    SubAccount(const AccountConfig &cfg)
+        : trader(cfg.front, cfg.broker, cfg.user, cfg.password), pf(&trader, nullptr, nullptr) {}
+
+    Dispatcher dispatcher;
+    Trader trader;
+    MarginEngine marginEngine;
+    Portfolio pf;
+};
 
 int main(int argc, char *argv[])
 {
@@ -77,6 +139,8 @@ int main(int argc, char *argv[])
     }
 
     if (!qdir->exists("./logs")) qdir->mkdir("./logs");
+    if (!qdir->exists("./journal")) qdir->mkdir("./journal");
+    if (!qdir->exists("./cache")) qdir->mkdir("./cache");
 
     auto console = spdlog::stdout_color_mt(" momi ");
     if (console == nullptr )
@@ -95,9 +159,19 @@ int main(int argc, char *argv[])
     console->info("Enter Program");
     file_logger->info("Enter Program");
 
+    string mdFront = "tcp://180.168.146.187:10011";
+    auto accounts = loadAccounts("accounts.ini", { "tcp://180.168.146.187:10000", "9999", "063669", "1qaz2wsx" }, mdFront);
+    // --paper[=latency ms] trades against the paper exchange instead of the broker
+    bool isPaper = argc > 1 && string(argv[1]).compare(0, 7, "--paper") == 0;
+    if (isPaper) {
+        for (auto &cfg : accounts)
+            cfg.front = "paper://" + (string(argv[1]).size() > 8 ? string(argv[1]).substr(8) : string("0"));
+    }
+    bool isGui = argc == 1 || (isPaper && argc == 2);
+
     QApplication a(argc, argv);
     CtpMonitor *w = nullptr;
-    if (argc == 1) {
+    if (isGui) {
         w = new CtpMonitor;
         w->show();
     }
@@ -105,10 +179,22 @@ int main(int argc, char *argv[])
     KdbConnector kdbConnector("kdbconn");
     Dispatcher dispatcher;
     dispatcher.setKdbConnector(&kdbConnector);
-
-    Trader trader("tcp://180.168.146.187:10000", "9999", "063669", "1qaz2wsx");
+    Journal journal("journal/momi.wal");
+    InstrumentCache instrumentCache("cache");
+    instrumentCache.load();
+    LatencyTracker latency;
+    CommissionEngine commission;
+    commission.setInstrumentCache(&instrumentCache);
+    MarginEngine marginEngine;
+    marginEngine.setInstrumentCache(&instrumentCache);
+    StressEngine stress;
+    stress.setInstrumentCache(&instrumentCache);
+    stress.load("stress.ini");
+
+    auto &primary = accounts.front();
+    Trader trader(primary.front, primary.broker, primary.user, primary.password);
     //Trader trader("tcp://222.66.235.70:21205", "66666", "00008218", "183488");
-    MdSpi mdspi("tcp://180.168.146.187:10011", "9999", "063669", "1qaz2wsx");
+    MdSpi mdspi(mdFront, primary.broker, primary.user, primary.password);
     //MdSpi mdspi("tcp://222.66.235.70:21214", "66666", "00008218", "183488");
 
     //call timer from main thread can work for trader schedule
@@ -132,14 +218,42 @@ int main(int argc, char *argv[])
 
     Kalman kf;
     OMS oms;
+    ExecAlgo execAlgo;
+    PairExec pairExec;
+    RM rm;
+    ExchangeBudget budget;
     Portfolio pf(&trader, &oms, &kf);
+    SnapshotPublisher snapshots;
 
     kf.setOMS(&oms);
     kf.setPortfolio(&pf);
     oms.setTrader(&trader);
     oms.setPortfolio(&pf);
+    oms.setExecAlgo(&execAlgo);
+    oms.setInstrumentCache(&instrumentCache);
+    oms.setCommissionEngine(&commission);
+    execAlgo.setOMS(&oms);
+    execAlgo.setInstrumentCache(&instrumentCache);
+    execAlgo.loadProfiles("volprofile.ini");
+    oms.setPairExec(&pairExec);
+    pairExec.setOMS(&oms);
     pf.setDispatcher(&dispatcher);
+    pf.setRM(&rm);
+    pf.setCommissionEngine(&commission);
+    pf.setMarginEngine(&marginEngine);
+    int uiFps = QSettings("accounts.ini", QSettings::IniFormat).value("ui/fps", 10).toInt();
+    if (isGui)
+        pf.setSnapshotPublisher(&snapshots, uiFps);
+    rm.setMarginEngine(&marginEngine);
+    rm.setStressEngine(&stress);
+    pf.setStressEngine(&stress);
+    rm.setExchangeBudget(&budget);
+    oms.setExchangeBudget(&budget);
     trader.setDispatcher(&dispatcher);
+    trader.setRM(&rm);
+    trader.setJournal(&journal);
+    trader.setInstrumentCache(&instrumentCache);
+    trader.setLatencyTracker(&latency);
     mdspi.setDispatcher(&dispatcher);
 
     dispatcher.registerHandler(&pf, SIGNAL(dispatchPos(QEvent*)), SLOT(onEvent(QEvent*)));
@@ -151,6 +265,34 @@ int main(int argc, char *argv[])
     dispatcher.registerHandler(&pf, SIGNAL(dispatchOrder(QEvent*)), SLOT(onEvent(QEvent*)));
     dispatcher.registerHandler(&kdbConnector, SIGNAL(dispatchFeed(QEvent*)), SLOT(onEvent(QEvent*)));
     dispatcher.registerHandler(&kdbConnector, SIGNAL(dispatchAccUpdate(QEvent*)), SLOT(onEvent(QEvent*)));
+    // after the portfolio, orders sent on a tick meet the book of that tick
+    if (trader.getPaperApi() != nullptr)
+        dispatcher.registerHandler(trader.getPaperApi(), SIGNAL(dispatchFeed(QEvent*)), SLOT(onEvent(QEvent*)));
+    // contract info from the cache, positions and targets need not wait for login
+    instrumentCache.postContractInfo(&dispatcher);
+
+    // each sub-account has its own session and dispatcher for its trading events, ticks and
+    // contract info go through the main portfolio
+    vector<unique_ptr<SubAccount>> subAccounts;
+    for (size_t i = 1; i < accounts.size(); ++i) {
+        subAccounts.emplace_back(new SubAccount(accounts[i]));
+        auto sa = subAccounts.back().get();
+        sa->dispatcher.setKdbConnector(&kdbConnector);
+        sa->trader.setDispatcher(&sa->dispatcher);
+        sa->marginEngine.setInstrumentCache(&instrumentCache);
+        sa->pf.setDispatcher(&sa->dispatcher);
+        sa->pf.setCommissionEngine(&commission);
+        sa->pf.setMarginEngine(&sa->marginEngine);
+        pf.addSubAccount(&sa->pf);
+        sa->dispatcher.registerHandler(&sa->pf, SIGNAL(dispatchPosDetail(QEvent*)), SLOT(onEvent(QEvent*)));
+        sa->dispatcher.registerHandler(&sa->pf, SIGNAL(dispatchAccInfo(QEvent*)), SLOT(onEvent(QEvent*)));
+        sa->dispatcher.registerHandler(&sa->pf, SIGNAL(dispatchTrade(QEvent*)), SLOT(onEvent(QEvent*)));
+        sa->dispatcher.registerHandler(&sa->pf, SIGNAL(dispatchOrder(QEvent*)), SLOT(onEvent(QEvent*)));
+        sa->dispatcher.registerHandler(&pf, SIGNAL(dispatchContractInfo(QEvent*)), SLOT(onEvent(QEvent*)));
+        sa->dispatcher.registerHandler(&kdbConnector, SIGNAL(dispatchAccUpdate(QEvent*)), SLOT(onEvent(QEvent*)));
+        if (sa->trader.getPaperApi() != nullptr)
+            dispatcher.registerHandler(sa->trader.getPaperApi(), SIGNAL(dispatchFeed(QEvent*)), SLOT(onEvent(QEvent*)));
+    }
 
     QThread thread;
     //QThread thread1;
@@ -159,6 +301,15 @@ int main(int argc, char *argv[])
     kdbConnector.moveToThread(&thread);
     dispatcher.moveToThread(&thread);
     pf.moveToThread(&thread);
+    rm.moveToThread(&thread);
+    if (trader.getPaperApi() != nullptr)
+        trader.getPaperApi()->moveToThread(&thread);
+    for (auto &sa : subAccounts) {
+        sa->dispatcher.moveToThread(&thread);
+        sa->pf.moveToThread(&thread);
+        if (sa->trader.getPaperApi() != nullptr)
+            sa->trader.getPaperApi()->moveToThread(&thread);
+    }
 
     TickSubscriber tickSub("kdbsub");
     //tickSub.moveToThread(&thread1);
@@ -166,7 +317,7 @@ int main(int argc, char *argv[])
     thread.start();
 
     //if (std::string(argv[1]) == "--nogui")
-    if (argc == 1) {
+    if (isGui) {
 //        CtpMonitor w;
         QObject::connect(&trader, &Trader::sendToTraderMonitor, w, &CtpMonitor::printTraderMsg);
         QObject::connect(&trader, &Trader::sendToTraderCmdMonitor, w, &CtpMonitor::printToTraderCmdMonitor);
@@ -174,10 +325,17 @@ int main(int argc, char *argv[])
         QObject::connect(&mdspi, &MdSpi::sendToTraderMonitor, w, &CtpMonitor::printTraderMsg);
         QObject::connect(&mdspi, &MdSpi::sendToMdMonitor, w, &CtpMonitor::printMdSpiMsg);
         QObject::connect(w, &CtpMonitor::sendCmdLineToMdspi, &mdspi, &MdSpi::execCmdLine);
-        QObject::connect(&pf, &Portfolio::sendToPosMonitor, w, &CtpMonitor::printPosMsg);
-        QObject::connect(&pf, &Portfolio::sendToAccMonitor, w, &CtpMonitor::printAccMsg);
+        w->setSnapshotPublisher(&snapshots, uiFps);
+        // the table model is fed from the snapshot on the GUI thread, not the portfolio's
+        QObject::connect(w, &CtpMonitor::frameUpdated, &pf, &Portfolio::updatePosTable, Qt::DirectConnection);
         QObject::connect(&oms, &OMS::sendToTraderMonitor, w, &CtpMonitor::printTraderMsg);
         QObject::connect(w, &CtpMonitor::sendCmdLineToOms, &oms, &OMS::execCmdLine);
+        QObject::connect(&rm, &RM::sendToTraderMonitor, w, &CtpMonitor::printTraderMsg);
+        QObject::connect(w, &CtpMonitor::sendCmdLineToRm, &rm, &RM::execCmdLine);
+        QObject::connect(&pf, &Portfolio::sendToTraderMonitor, w, &CtpMonitor::printTraderMsg);
+        QObject::connect(w, &CtpMonitor::sendCmdLineToPortfolio, &pf, &Portfolio::execCmdLine);
+        for (auto &sa : subAccounts)
+            QObject::connect(&sa->trader, &Trader::sendToTraderMonitor, w, &CtpMonitor::printTraderMsg);
         //mythread.kdbConnector.setTradingDay(trader.getTradingDay().c_str());
 
         w->getui().posTableView->setModel(&pf);
@@ -187,9 +345,12 @@ int main(int argc, char *argv[])
         auto ret = a.exec();
         thread.exit();
         delete w;
+        latency.dump("logs/latency_" + trader.getTradingDay() + ".csv");
         return ret;
     } else {
-        return a.exec();
+        auto ret = a.exec();
+        latency.dump("logs/latency_" + trader.getTradingDay() + ".csv");
+        return ret;
     }
 
 }
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <map>
+
+#include "include/margin.h"
+#include "include/instrumentcache.h"
+#include "include/rm.h"
+
+using namespace std;
+
+MarginEngine::MarginEngine()
+{
+    g_logger = spdlog::get("file_logger");
+}
+
+void MarginEngine::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+}
+
+// Contract ratios until the account's margin rate is in the cache, nullptr if the contract is unknown.
+InstrumentMargin *MarginEngine::find(const string &sym)
+{
+    auto &im = instruments[sym];
+    if (instrumentCache == nullptr)
+        return nullptr;
+    if (!im.isKnown) {
+        CThostFtdcInstrumentField info;
+        if (!instrumentCache->getInstrument(sym, info))
+            return nullptr;
+        im.isKnown = true;
+        im.multiple = info.VolumeMultiple;
+        im.longByMoney = info.LongMarginRatio;
+        im.shortByMoney = info.ShortMarginRatio;
+        auto &pm = products[string(info.ExchangeID) + "." + info.ProductID];
+        pm.isBigSide = (info.MaxMarginSideAlgorithm == THOST_FTDC_MMSA_YES);
+        im.product = &pm;
+    }
+    if (!im.hasRate) {
+        CThostFtdcInstrumentMarginRateField rate;
+        if (instrumentCache->getMarginRate(sym, rate)) {
+            im.longByMoney = rate.LongMarginRatioByMoney;
+            im.longByVolume = rate.LongMarginRatioByVolume;
+            im.shortByMoney = rate.ShortMarginRatioByMoney;
+            im.shortByVolume = rate.ShortMarginRatioByVolume;
+            im.hasRate = true;
+        }
+    }
+    return &im;
+}
+
+void MarginEngine::update(InstrumentMargin &im)
+{
+    bool isUnpriced = (im.longPos > 0 || im.shortPos > 0) && im.price <= 0;
+    unpriced += int(isUnpriced) - int(im.isUnpriced);
+    im.isUnpriced = isUnpriced;
+
+    double longMargin = im.longPos * im.longPerLot(im.price);
+    double shortMargin = im.shortPos * im.shortPerLot(im.price);
+    auto &pm = *im.product;
+    pm.longMargin += longMargin - im.longMargin;
+    pm.shortMargin += shortMargin - im.shortMargin;
+    im.longMargin = longMargin;
+    im.shortMargin = shortMargin;
+    updateProduct(pm);
+}
+
+// Margin of the instrument's positions before big side netting.
+double MarginEngine::getMargin(const string &sym) const
+{
+    auto it = instruments.find(sym);
+    return it == instruments.end() ? 0 : it->second.longMargin + it->second.shortMargin;
+}
+
+// Frozen is what the working orders would add to the product's margin if all filled.
+void MarginEngine::updateProduct(ProductMargin &pm)
+{
+    double m, withFrozen;
+    if (pm.isBigSide) {
+        m = max(pm.longMargin, pm.shortMargin);
+        withFrozen = max(pm.longMargin + pm.longFrozen, pm.shortMargin + pm.shortFrozen);
+    }
+    else {
+        m = pm.longMargin + pm.shortMargin;
+        withFrozen = m + pm.longFrozen + pm.shortFrozen;
+    }
+    margin += m - pm.margin;
+    frozen += (withFrozen - m) - pm.frozen;
+    pm.margin = m;
+    pm.frozen = withFrozen - m;
+}
+
+// price <= 0 keeps the last one
+void MarginEngine::setPosition(const string &sym, int longPos, int shortPos, double price)
+{
+    auto im = find(sym);
+    if (im == nullptr) {
+        if (longPos != 0 || shortPos != 0)
+            g_logger->warn("MarginEngine: no contract info for {}, margin not counted", sym);
+        return;
+    }
+    im->longPos = longPos;
+    im->shortPos = shortPos;
+    if (price > 0)
+        im->price = price;
+    update(*im);
+}
+
+void MarginEngine::clearPositions()
+{
+    for (auto &kv : instruments) {
+        auto &im = kv.second;
+        if (!im.isKnown || (im.longPos == 0 && im.shortPos == 0))
+            continue;
+        im.longPos = 0;
+        im.shortPos = 0;
+        update(im);
+    }
+}
+
+// Called on every tick, instruments never held or ordered are not looked up.
+void MarginEngine::setPrice(const string &sym, double price)
+{
+    auto it = instruments.find(sym);
+    if (it == instruments.end() || !it->second.isKnown || price <= 0)
+        return;
+    auto &im = it->second;
+    im.price = price;
+    if (im.longPos > 0 || im.shortPos > 0)
+        update(im);
+}
+
+// Freezes at the rate of the time the order is seen, release takes back exactly that
+// even if the rate was queried or changed in between.
+void MarginEngine::freeze(WorkingOpen &wo)
+{
+    wo.frozen = 0;
+    auto it = instruments.find(wo.sym);
+    if (it == instruments.end() || !it->second.isKnown)
+        return;
+    auto &im = it->second;
+    wo.frozen = wo.volume * (wo.isBuy ? im.longPerLot(wo.price) : im.shortPerLot(wo.price));
+    (wo.isBuy ? im.longFrozen : im.shortFrozen) += wo.frozen;
+    (wo.isBuy ? im.product->longFrozen : im.product->shortFrozen) += wo.frozen;
+    updateProduct(*im.product);
+}
+
+void MarginEngine::release(const WorkingOpen &wo)
+{
+    auto it = instruments.find(wo.sym);
+    if (wo.frozen == 0 || it == instruments.end() || !it->second.isKnown)
+        return;
+    auto &im = it->second;
+    (wo.isBuy ? im.longFrozen : im.shortFrozen) -= wo.frozen;
+    (wo.isBuy ? im.product->longFrozen : im.product->shortFrozen) -= wo.frozen;
+    updateProduct(*im.product);
+}
+
+// Open orders freeze margin for the volume still working, closes free none.
+void MarginEngine::onOrder(const CThostFtdcOrderField *of)
+{
+    if (of->CombOffsetFlag[0] != THOST_FTDC_OF_Open)
+        return;
+    string key = RM::orderKey(of->FrontID, of->SessionID, of->OrderRef);
+    auto it = workingOpens.find(key);
+    if (it != workingOpens.end()) {
+        release(it->second);
+        workingOpens.erase(it);
+    }
+    bool isWorking = of->OrderSubmitStatus != THOST_FTDC_OSS_InsertRejected
+        && of->OrderStatus != THOST_FTDC_OST_AllTraded && of->OrderStatus != THOST_FTDC_OST_Canceled
+        && of->VolumeTotal > 0;
+    auto im = find(of->InstrumentID);
+    if (!isWorking || im == nullptr)
+        return;
+    WorkingOpen wo;
+    wo.sym = of->InstrumentID;
+    wo.isBuy = (of->Direction == THOST_FTDC_D_Buy);
+    // market orders freeze at the last price
+    wo.price = (of->OrderPriceType == THOST_FTDC_OPT_LimitPrice ? of->LimitPrice : im->price);
+    wo.volume = of->VolumeTotal;
+    freeze(wo);
+    workingOpens[key] = wo;
+}
+
+void MarginEngine::loadOrders(const vector<CThostFtdcOrderField> &orders)
+{
+    for (auto &kv : workingOpens)
+        release(kv.second);
+    workingOpens.clear();
+    for (auto &of : orders)
+        onOrder(&of);
+}
+
+QString MarginEngine::summary()
+{
+    QString msg;
+    map<string, const ProductMargin*> held;
+    for (auto &kv : products) {
+        if (kv.second.margin != 0 || kv.second.frozen != 0)
+            held[kv.first] = &kv.second;
+    }
+    for (auto &kv : held) {
+        auto pm = kv.second;
+        msg += QString("%1 long=%2 short=%3 frozen=%4/%5 margin=%6 frozen=%7%8\n").arg(kv.first.c_str())
+            .arg(pm->longMargin, 0, 'f', 0).arg(pm->shortMargin, 0, 'f', 0)
+            .arg(pm->longFrozen, 0, 'f', 0).arg(pm->shortFrozen, 0, 'f', 0)
+            .arg(pm->margin, 0, 'f', 0).arg(pm->frozen, 0, 'f', 0).arg(pm->isBigSide ? " big side" : "");
+    }
+    msg += QString("Margin=%1 Frozen=%2%3").arg(margin, 0, 'f', 0).arg(frozen, 0, 'f', 0)
+        .arg(isComplete() ? "" : QString(" (%1 instruments without price)").arg(unpriced));
+    return msg;
+}
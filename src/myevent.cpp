@@ -57,6 +57,27 @@ MyEvent::MyEvent(EnumMyEventType type, Account *acc)
 {
 }
 
+MyEvent::MyEvent(EnumMyEventType type, ContractInfoSnapshot contractInfos)
+	: QEvent(MY_CUSTOM_EVENT),
+	myType(type),
+	contractInfos(contractInfos)
+{
+}
+
+MyEvent::MyEvent(EnumMyEventType type, PosDetailSnapshot posDetails)
+	: QEvent(MY_CUSTOM_EVENT),
+	myType(type),
+	posDetails(posDetails)
+{
+}
+
+MyEvent::MyEvent(EnumMyEventType type, OrderSnapshot orders)
+	: QEvent(MY_CUSTOM_EVENT),
+	myType(type),
+	orders(orders)
+{
+}
+
 MyEvent::~MyEvent()
 {
     switch (myType) {
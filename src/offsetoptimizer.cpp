@@ -0,0 +1,76 @@
+#include <algorithm>
+
+#include "include/offsetoptimizer.h"
+
+using namespace std;
+
+void OffsetOptimizer::setCommissionEngine(CommissionEngine *engine)
+{
+    commission = engine;
+}
+
+void OffsetOptimizer::setLockEnabled(bool isEnabled)
+{
+    isLocking = isEnabled;
+}
+
+// Unknown costs until the engine is set, i.e. close as much as held.
+OffsetCost OffsetOptimizer::costs(const string &sym)
+{
+    return commission == nullptr ? OffsetCost() : commission->costs(sym);
+}
+
+EnumCloseRuleType OffsetOptimizer::closeRule(const string &sym)
+{
+    return costs(sym).rule;
+}
+
+// Lots of volume to take by closing the opposite side, the rest is opened. Without rates
+// or with locking off, as much as held is closed.
+int OffsetOptimizer::closeVolume(const string &sym, double price, int volume, const SidePosition &opposite)
+{
+    int held = opposite.yd + opposite.td;
+    int maxClose = min(volume, held);
+    OffsetCost c = costs(sym);
+    if (!isLocking || !c.isKnown || maxClose <= 0)
+        return max(maxClose, 0);
+
+    // lots in the order a close takes them
+    bool isTodayFirst = (c.rule == CloseTodayFirst)
+        || (c.rule == CloseBySpecifiedFlag && c.closeToday(price) < c.close(price));
+    int firstLots = isTodayFirst ? opposite.td : opposite.yd;
+    double firstCost = isTodayFirst ? c.closeToday(price) : c.close(price);
+    double secondCost = isTodayFirst ? c.close(price) : c.closeToday(price);
+    // a lot not closed is locked, and both sides are closed as yesterday's lots later
+    double lockCost = c.open(price) + 2 * c.close(price);
+
+    auto totalCost = [&](int k) {
+        int locked = min(volume - k, held - k);
+        return min(k, firstLots) * firstCost + max(k - firstLots, 0) * secondCost + locked * lockCost;
+    };
+    // cost is linear between the group bounds, ties keep the fewer open lots
+    int best = maxClose;
+    double bestCost = totalCost(maxClose);
+    for (int k : { min(firstLots, maxClose), 0 }) {
+        double cost = totalCost(k);
+        if (cost < bestCost - 1e-9) {
+            best = k;
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
+// Split of a close between yesterday's and today's lots, for exchanges taking the flag.
+void OffsetOptimizer::splitClose(const string &sym, double price, int volume, const SidePosition &pos, int &closeYd, int &closeTd)
+{
+    OffsetCost c = costs(sym);
+    if (c.isKnown && c.closeToday(price) < c.close(price)) {
+        closeTd = min(volume, pos.td);
+        closeYd = volume - closeTd;
+    }
+    else {
+        closeYd = min(volume, pos.yd);
+        closeTd = volume - closeYd;
+    }
+}
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <chrono>
+
 #include <QDebug>
 #include <QList>
 
@@ -5,8 +8,27 @@
 #include "include/oms.h"
 #include "include/myevent.h"
 #include "include/trader.h"
+#include "include/latency.h"
+#include "include/execalgo.h"
+#include "include/pairexec.h"
+#include "include/instrumentcache.h"
+#include "include/exchangebudget.h"
 //#include "struct.h"
 
+// below this share of the daily cancel cap left, orders are no longer cancelled just to re-price
+const double REPRICE_CANCEL_HEADROOM = 0.5;
+
+// exchange normally answers within milliseconds, a request older than this was lost or rejected
+const long long IN_FLIGHT_TIMEOUT_MS = 3000;
+// a target whose order did not go out waits this long before the next try, doubled up to the max
+const long long RETRY_MIN_MS = 500;
+const long long RETRY_MAX_MS = 8000;
+
+static long long steadyMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 OMS::OMS(QObject * parent) : QObject(parent)
 {
     console = spdlog::get("console");
@@ -32,54 +54,123 @@ void OMS::onEvent(QEvent *ev)
         Trade td(myev->trade);
         tradeList.insert(td.tradeID, td);
         // updating targetPos, now after portfolio::onEvent position updated
-        if (targetList.contains(td.tradeInfo->InstrumentID))
+        if (targetList.contains(td.tradeInfo->InstrumentID)) {
             updatePosTarget(targetList[td.tradeInfo->InstrumentID]);
+            markDirty(td.tradeInfo->InstrumentID);
+        }
         break;
     }
     case OrderEvent:
-    {
-        Order od(myev->order);
-        bool isOrderWithTrade{ false };
-        if (workingOrderList.contains(od.orderID)) {
-            isOrderWithTrade = od.orderInfo->VolumeTraded > workingOrderList[od.orderID].lastVolumeTraded;
-        }
-        // then might overwrite old order
-        orderList.insert(od.orderID, od);
-
-        // logic: delete old working volume, then update new if isWorking.
-        //TODO: add global working volume.
-        if (workingOrderList.contains(od.orderID)) {
-            if (targetList.contains(od.sym.c_str())) {
-                if (od.longShortSide == 'L')
-                    targetList[od.sym.c_str()].workingLong -= workingOrderList[od.orderID].workingVolume;
-                if (od.longShortSide == 'S')
-                    targetList[od.sym.c_str()].workingShort -= workingOrderList[od.orderID].workingVolume;
-            }
+        onOrder(myev->order);
+        break;
+    case OrderSnapshotEvent:
+        for (auto &of : *myev->orders)
+            onOrder(&of);
+        break;
+    default:
+        break;
+    }
+}
+
+void OMS::onOrder(CThostFtdcOrderField *of)
+{
+    updateParentOrder(of);
+    Order od(of);
+    resolveInFlight(od);
+    queueEst.onOrder(od.orderID, of, od.isWorking);
+    bool isOrderWithTrade{ false };
+    if (workingOrderList.contains(od.orderID)) {
+        isOrderWithTrade = od.orderInfo->VolumeTraded > workingOrderList[od.orderID].lastVolumeTraded;
+    }
+    // then might overwrite old order
+    orderList.insert(od.orderID, od);
+
+    // logic: delete old working volume, then update new if isWorking.
+    //TODO: add global working volume.
+    if (workingOrderList.contains(od.orderID)) {
+        if (targetList.contains(od.sym.c_str())) {
+            if (od.longShortSide == 'L')
+                targetList[od.sym.c_str()].workingLong -= workingOrderList[od.orderID].workingVolume;
+            if (od.longShortSide == 'S')
+                targetList[od.sym.c_str()].workingShort -= workingOrderList[od.orderID].workingVolume;
         }
-        workingOrderList.insert(od.orderID, od);
-        if (od.isWorking) {
-            if (targetList.contains(od.sym.c_str())) {
-                if (od.longShortSide == 'L')
-                    targetList[od.sym.c_str()].workingLong += od.workingVolume;
-                if (od.longShortSide == 'S')
-                    targetList[od.sym.c_str()].workingShort += od.workingVolume;
-            }
+    }
+    workingOrderList.insert(od.orderID, od);
+    if (od.isWorking) {
+        symWorkingIDs[od.sym].insert(od.orderID);
+        if (targetList.contains(od.sym.c_str())) {
+            if (od.longShortSide == 'L')
+                targetList[od.sym.c_str()].workingLong += od.workingVolume;
+            if (od.longShortSide == 'S')
+                targetList[od.sym.c_str()].workingShort += od.workingVolume;
         }
+    }
+    else {
+        workingOrderList.erase(workingOrderList.find(od.orderID));
+        symWorkingIDs[od.sym].remove(od.orderID);
+    }
+
+    // Notice: logic, only update target for "non-trading" order feedback
+    if (!isOrderWithTrade)
+        updatePosTarget(targetList[od.sym.c_str()]);
+    markDirty(od.sym.c_str());
+}
+
+// Clears the request an exchange return answers. The first return of an insert only comes
+// from CTP (status unknown), the order stays pending until the exchange status arrives.
+void OMS::resolveInFlight(Order &od)
+{
+    auto it = pendingNew.find(atoi(od.orderInfo->OrderRef));
+    if (it != pendingNew.end() && it->second.sym == od.sym && od.orderInfo->OrderStatus != THOST_FTDC_OST_Unknown) {
+        pendingNew.erase(it);
+        --symInFlight[od.sym];
+    }
+    if (pendingCancel.contains(od.orderID)) {
+        if (od.isWorking)
+            od.state = OrderPendingCancel;
         else {
-            workingOrderList.erase(workingOrderList.find(od.orderID));
+            pendingCancel.remove(od.orderID);
+            --symInFlight[od.sym];
         }
+    }
+}
 
-        // Notice: logic, only update target for "non-trading" order feedback
-        if (!isOrderWithTrade)
-            updatePosTarget(targetList[od.sym.c_str()]);
-
-        break;
+// Rejected requests get no order return, give up waiting after a timeout.
+void OMS::expireInFlight()
+{
+    if (pendingNew.empty() && pendingCancel.isEmpty())
+        return;
+    long long nowMs = steadyMs();
+    for (auto it = pendingNew.begin(); it != pendingNew.end();) {
+        if (nowMs - it->second.sentMs > IN_FLIGHT_TIMEOUT_MS) {
+            emit sendToTraderMonitor(QString("Order %1 on %2 not answered, released").arg(it->first).arg(it->second.sym.c_str()), Qt::yellow);
+            --symInFlight[it->second.sym];
+            markDirty(it->second.sym.c_str());
+            it = pendingNew.erase(it);
+        }
+        else
+            ++it;
     }
-    default:
-        break;
+    for (auto it = pendingCancel.begin(); it != pendingCancel.end();) {
+        if (nowMs - it.value().sentMs > IN_FLIGHT_TIMEOUT_MS) {
+            emit sendToTraderMonitor(QString("Cancel of %1 not answered, released").arg(it.key()), Qt::yellow);
+            --symInFlight[it.value().sym];
+            markDirty(it.value().sym.c_str());
+            if (workingOrderList.contains(it.key()))
+                workingOrderList[it.key()].state = OrderAcked;
+            it = pendingCancel.erase(it);
+        }
+        else
+            ++it;
     }
 }
 
+bool OMS::isInFlight(const std::string &sym)
+{
+    auto it = symInFlight.find(sym);
+    return it != symInFlight.end() && it->second > 0;
+}
+
 void OMS::setTrader(Trader *trader)
 {
     this->trader = trader;
@@ -90,6 +181,76 @@ void OMS::setPortfolio(Portfolio *pf)
     this->pf = pf;
 }
 
+void OMS::setExecAlgo(ExecAlgo *algo)
+{
+    this->algo = algo;
+}
+
+void OMS::setPairExec(PairExec *pairExec)
+{
+    this->pairExec = pairExec;
+}
+
+void OMS::setExchangeBudget(ExchangeBudget *budget)
+{
+    this->budget = budget;
+}
+
+void OMS::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+}
+
+void OMS::setCommissionEngine(CommissionEngine *engine)
+{
+    commission = engine;
+    offsetOpt.setCommissionEngine(engine);
+}
+
+void OMS::onTick(CThostFtdcDepthMarketDataField *mkt)
+{
+    queueEst.onTick(mkt);
+    // queue estimates of working orders move with the book
+    if (repriceAhead >= 0) {
+        auto it = symWorkingIDs.find(mkt->InstrumentID);
+        if (it != symWorkingIDs.end() && !it->second.isEmpty())
+            markDirty(mkt->InstrumentID);
+    }
+    if (algo != nullptr)
+        algo->onTick(mkt);
+    if (pairExec != nullptr)
+        pairExec->onTick(mkt);
+}
+
+int OMS::getNetPos(const std::string &sym)
+{
+    if (pf->netPosList.contains(sym.c_str()))
+        return pf->netPosList[sym.c_str()].netPos;
+    return 0;
+}
+
+// Least share left of the daily order and cancel caps of sym, 1 when uncapped.
+double OMS::getBudgetHeadroom(const std::string &sym)
+{
+    if (budget == nullptr)
+        return 1;
+    return std::min(budget->orderHeadroom(sym), budget->cancelHeadroom(sym));
+}
+
+// Commission an order would pay if filled, 0 while the rate is unknown.
+double OMS::estimateFee(const std::string &sym, EnumOffsetFlagType offsetFlag, double price, int volume)
+{
+    if (commission == nullptr)
+        return 0;
+    return commission->fee(sym, offsetFlag, price, volume);
+}
+
+// Estimated lots queued ahead of a working order, -1 if unknown.
+int OMS::getQueueAhead(const QString &orderID)
+{
+    return queueEst.getAhead(orderID);
+}
+
 void OMS::addPosTarget(QString targetID)
 {
     PosTarget pt;
@@ -117,8 +278,11 @@ void OMS::setPosTarget(QString targetID, int tgtpos, double price)
     if (!targetList.contains(targetID))
         addPosTarget(targetID);
     PosTarget& pt = targetList[targetID];
+    if (pt.targetPos == tgtpos && pt.targetPrice == price)
+        return;
     pt.targetPos = tgtpos;
     pt.targetPrice = price;
+    markDirty(targetID);
 
     calcLongShortTarget(pt);
     updatePosTarget(pt);
@@ -132,23 +296,79 @@ void OMS::updatePairPosTarget(std::string yname, std::string xname, int ypos, do
     ppt.yTarget.targetPrice = yprice;
     ppt.xTarget.targetPos = xpos;
     ppt.xTarget.targetPrice = xprice;
+    if (pairExec != nullptr && !pairExec->setPairTarget(yname, xname, ypos, xpos))
+        emit sendToTraderMonitor(QString("Pair target %1/%2 rejected, leg worked by another pair").arg(yname.c_str()).arg(xname.c_str()), Qt::yellow);
 }
 
+// Only targets marked dirty since the last call are evaluated, so the cost per tick does not
+// grow with the number of targets. Targets with a request in flight are skipped, their order
+// return marks them again, so target changes meanwhile collapse into one net order.
 void OMS::handleTargets()
 {
-    if (isWorking) {
-        for (auto &i : targetList) {
-            if ((i.gapLong != 0) || (i.gapShort != 0)) {
-                //updatePosTarget(i.value());  // pense si besoin d'update
-                sendOrderForTarget(i);
-            }
+    if (!isWorking)
+        return;
+    expireInFlight();
+    if (!retryList.isEmpty())
+        dirtyRetries();
+    if (dirtyQueue.empty())
+        return;
+    std::vector<QString> queue;
+    queue.swap(dirtyQueue);
+    dirtySet.clear();
+    for (auto &targetID : queue) {
+        auto it = targetList.find(targetID);
+        if (it == targetList.end())
+            continue;
+        auto &pt = it.value();
+        if (isInFlight(pt.sym))
+            continue;
+        if (repriceAhead >= 0)
+            repriceWorkingOrders(pt);
+        if (((pt.gapLong != 0) || (pt.gapShort != 0)) && !isInFlight(pt.sym)) {
+            sendOrderForTarget(pt);
+            // nothing went out (rejected or no budget), back off instead of trying every tick
+            if (!isInFlight(pt.sym))
+                deferRetry(targetID);
+            else
+                retryList.remove(targetID);
+        }
+        else if (!retryList.isEmpty())
+            retryList.remove(targetID);
+    }
+}
+
+void OMS::deferRetry(const QString &targetID)
+{
+    auto &r = retryList[targetID];
+    r.delayMs = (r.delayMs == 0 ? RETRY_MIN_MS : std::min(r.delayMs * 2, RETRY_MAX_MS));
+    r.atMs = steadyMs() + r.delayMs;
+}
+
+// Targets whose back-off is over are evaluated again, the delay stays until an order goes out.
+void OMS::dirtyRetries()
+{
+    long long nowMs = steadyMs();
+    for (auto it = retryList.begin(); it != retryList.end(); ++it) {
+        if (it.value().atMs > 0 && nowMs >= it.value().atMs) {
+            it.value().atMs = 0;
+            markDirty(it.key());
         }
     }
 }
 
+void OMS::markDirty(const QString &targetID)
+{
+    if (dirtySet.contains(targetID))
+        return;
+    dirtySet.insert(targetID);
+    dirtyQueue.push_back(targetID);
+}
+
 void OMS::switchOn() 
 { 
     isWorking = true; 
+    for (auto it = targetList.begin(); it != targetList.end(); ++it)
+        markDirty(it.key());
     console->critical("OMS switched ON");
 }
 
@@ -158,11 +378,30 @@ void OMS::switchOff() {
 }
 
 
-// TODO: to implement today target, yestpos target; close today and no close today cases.
+// Long and short targets reaching the net target from the current position at the least
+// commission: the opposite side is closed or, where closing today's lots costs more, locked.
 void OMS::calcLongShortTarget(PosTarget &pt)
 {
-    pt.targetLong = pt.targetPos >= 0 ? pt.targetPos : 0;
-    pt.targetShort = pt.targetPos <= 0 ? -pt.targetPos : 0;
+    auto it = pf->netPosList.find(pt.sym.c_str());
+    if (it == pf->netPosList.end()) {
+        pt.targetLong = pt.targetPos >= 0 ? pt.targetPos : 0;
+        pt.targetShort = pt.targetPos <= 0 ? -pt.targetPos : 0;
+        return;
+    }
+    const NetPosition &np = it.value();
+    int change = pt.targetPos - np.netPos;
+    pt.targetLong = np.longPos;
+    pt.targetShort = np.shortPos;
+    if (change > 0) {
+        int closed = offsetOpt.closeVolume(pt.sym, pt.targetPrice, change, { np.shortYd, np.shortTd });
+        pt.targetShort -= closed;
+        pt.targetLong += change - closed;
+    }
+    else if (change < 0) {
+        int closed = offsetOpt.closeVolume(pt.sym, pt.targetPrice, -change, { np.longYd, np.longTd });
+        pt.targetLong -= closed;
+        pt.targetShort += -change - closed;
+    }
 }
 
 void OMS::sendOrderForTarget(PosTarget & pt)
@@ -229,47 +468,37 @@ void OMS::sendOrderForTarget(PosTarget & pt)
 
 void OMS::orderInsertWithOffsetFlag(std::string &sym, EnumOpenClose o_c, EnumDirectionType direction, double price, int volume)
 {
-    // TODO: logic implementation based on commission rates.
     switch (o_c)
     {
     case OpenTrade:
     {
-        trader->ReqOrderInsert(sym, EnumOffsetFlagType::Open, direction, price, volume);
+        insertSliced(sym, EnumOffsetFlagType::Open, direction, price, volume);
     }
     break;
     case CloseTrade:
     {
         // Notice: Important! for api consistency, close posDirection position <==> insert close direction order
-        auto posDirection = direction == Buy ? Sell : Buy;
-
-        QString aggID_H = QString("%1-%2-%3").arg(sym.c_str()).arg(mymap::direction_char.at(posDirection)).arg('H');
-        int pos_H{ 0 };
-        if (pf->aggPosList.contains(aggID_H))
-            pos_H = pf->aggPosList[aggID_H].pos;
-
-        // Commented the following coz pos_T not used.
-        //QString aggID_T = QString("%1-%2-%3").arg(sym.c_str()).arg(mymap::direction_char.at(posDirection)).arg('T');
-        //int pos_T{ 0 };
-        //if (pf->aggPosList.contains(aggID_T))
-        //    pos_T = pf->aggPosList[aggID_T].pos;
-
-        // simple logic case. yesterday pos close first.
-        // also notice that pos_H + pos_T >= volume, where in this close case gap < 0
-
+        if (offsetOpt.closeRule(sym) != CloseBySpecifiedFlag) {
+            // exchange picks the lots of a plain Close
+            insertSliced(sym, EnumOffsetFlagType::Close, direction, price, volume);
+            break;
+        }
+        SidePosition held;
+        auto it = pf->netPosList.find(sym.c_str());
+        if (it != pf->netPosList.end()) {
+            held.yd = (direction == Sell ? it.value().longYd : it.value().shortYd);
+            held.td = (direction == Sell ? it.value().longTd : it.value().shortTd);
+        }
         /*Reminder: Old documentation
         for SHFE: close yesterday ==> OffsetFlagType = Close
                   close today     ==> OffsetFlagType = CloseToday
-        for others:               ==> OffsetFlagType = Close
         */
-        if (pos_H > 0 && pos_H <= volume) {
-            trader->ReqOrderInsert(sym, EnumOffsetFlagType::Close, direction, price, pos_H);
-            if (volume > pos_H)
-                trader->ReqOrderInsert(sym, EnumOffsetFlagType::CloseToday, direction, price, volume - pos_H);
-        }
-        else if (pos_H > volume)  // pos_H > volume, close H volume
-            trader->ReqOrderInsert(sym, EnumOffsetFlagType::Close, direction, price, volume);
-        else  // pos_H = 0
-            trader->ReqOrderInsert(sym, EnumOffsetFlagType::CloseToday, direction, price, volume);
+        int closeYd{ 0 }, closeTd{ 0 };
+        offsetOpt.splitClose(sym, price, volume, held, closeYd, closeTd);
+        if (closeYd > 0)
+            insertSliced(sym, EnumOffsetFlagType::Close, direction, price, closeYd);
+        if (closeTd > 0)
+            insertSliced(sym, EnumOffsetFlagType::CloseToday, direction, price, closeTd);
     }
     break;
     default:
@@ -277,68 +506,176 @@ void OMS::orderInsertWithOffsetFlag(std::string &sym, EnumOpenClose o_c, EnumDir
     }
 }
 
+// Splits volume into child orders within the instrument's max order volume, sent back to back
+// as far as the order rate budget allows. The unsent rest stays in the target gap for next tick.
+int OMS::insertSliced(const std::string &sym, EnumOffsetFlagType offsetFlag, EnumDirectionType direction, double price, int volume)
+{
+    bool isMarket = (price == 0);
+    int maxVolume = maxOrderVolume(sym, isMarket);
+    if (maxVolume <= 0 || volume <= maxVolume) {
+        LatencyTracker::markDecision();
+        int ret = (isMarket ? trader->ReqOrderInsert(sym, offsetFlag, direction, volume)
+                            : trader->ReqOrderInsert(sym, offsetFlag, direction, price, volume));
+        if (ret == 0) {
+            pendingNew[trader->getLastOrderRef()] = { sym, steadyMs() };
+            ++symInFlight[sym];
+        }
+        return ret;
+    }
+
+    ParentOrder po;
+    po.parentID = ++nParentID;
+    po.sym = sym;
+    po.direction = mymap::direction_char.at(direction);
+    po.price = price;
+    po.volume = volume;
+    int budget = trader->getOrderBudget();
+    int ret{ 0 };
+    while (po.volumeSent < volume && budget-- > 0) {
+        int childVolume = std::min(volume - po.volumeSent, maxVolume);
+        LatencyTracker::markDecision();  // each child gets its own decision sample
+        ret = (isMarket ? trader->ReqOrderInsert(sym, offsetFlag, direction, childVolume)
+                        : trader->ReqOrderInsert(sym, offsetFlag, direction, price, childVolume));
+        if (ret != 0)
+            break;
+        int ref = trader->getLastOrderRef();
+        po.childTraded[ref] = 0;
+        childParent[ref] = po.parentID;
+        pendingNew[ref] = { sym, steadyMs() };
+        ++symInFlight[sym];
+        po.volumeSent += childVolume;
+    }
+    if (po.volumeSent > 0)
+        parentOrderList.insert(po.parentID, po);
+    emit sendToTraderMonitor(QString("Parent order %1: %2 %3 x%4 sliced by %5, sent %6")
+        .arg(po.parentID).arg(sym.c_str()).arg(po.direction).arg(volume).arg(maxVolume).arg(po.volumeSent));
+    return ret;
+}
+
+int OMS::maxOrderVolume(const std::string &sym, bool isMarket)
+{
+    auto it = volumeLimits.find(sym);
+    if (it == volumeLimits.end()) {
+        CThostFtdcInstrumentField info;
+        if (instrumentCache == nullptr || !instrumentCache->getInstrument(sym, info))
+            return 0;
+        it = volumeLimits.insert({ sym, { info.MaxLimitOrderVolume, info.MaxMarketOrderVolume } }).first;
+    }
+    return isMarket ? it->second.second : it->second.first;
+}
+
+void OMS::updateParentOrder(CThostFtdcOrderField *of)
+{
+    int ref = atoi(of->OrderRef);
+    auto cit = childParent.find(ref);
+    if (cit == childParent.end() || !parentOrderList.contains(cit->second))
+        return;
+    auto &po = parentOrderList[cit->second];
+    if (po.sym != of->InstrumentID)
+        return;
+    po.volumeTraded += of->VolumeTraded - po.childTraded[ref];
+    po.childTraded[ref] = of->VolumeTraded;
+
+    switch (of->OrderStatus)
+    {
+    case THOST_FTDC_OST_AllTraded:
+    case THOST_FTDC_OST_Canceled:
+    case THOST_FTDC_OST_PartTradedNotQueueing:
+    case THOST_FTDC_OST_NoTradeNotQueueing:
+        po.childTraded.erase(ref);
+        childParent.erase(cit);
+        if (po.childTraded.empty()) {
+            emit sendToTraderMonitor(QString("Parent order %1 done: %2 traded %3/%4")
+                .arg(po.parentID).arg(po.sym.c_str()).arg(po.volumeTraded).arg(po.volume));
+            parentOrderList.remove(po.parentID);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 bool priorInOrderQueue(const Order &od1, const Order &od2)
 {
-    if (od1.direction == EnumDirectionType::Buy) {
+    if (od1.orderInfo->Direction == THOST_FTDC_D_Buy) {
         if (od1.orderInfo->LimitPrice > od2.orderInfo->LimitPrice) { return true; }
         else if (od1.orderInfo->LimitPrice < od2.orderInfo->LimitPrice) { return false; }
-        else {
-            if (abs(od1.workingVolume) < abs(od2.workingVolume)) { return true; }
-            else if (abs(od1.workingVolume) > abs(od2.workingVolume)) { return false; }
-            else {
-                // TODO: is there pitfall for OrderRef as char[]?
-                if (od1.orderInfo->OrderRef < od2.orderInfo->OrderRef) return true;
-                else return false;
-            }
-        }
     }
     else {
         if (od1.orderInfo->LimitPrice < od2.orderInfo->LimitPrice) { return true; }
         else if (od1.orderInfo->LimitPrice > od2.orderInfo->LimitPrice) { return false; }
-        else {
-            if (abs(od1.workingVolume) < abs(od2.workingVolume)) { return true; }
-            else if (abs(od1.workingVolume) > abs(od2.workingVolume)) { return false; }
-            else {
-                // TODO: is there pitfall for OrderRef as char[]?
-                if (od1.orderInfo->OrderRef < od2.orderInfo->OrderRef) return true;
-                else return false;
-            }
-        }
     }
+    if (abs(od1.workingVolume) < abs(od2.workingVolume)) { return true; }
+    else if (abs(od1.workingVolume) > abs(od2.workingVolume)) { return false; }
+    return atoi(od1.orderInfo->OrderRef) < atoi(od2.orderInfo->OrderRef);
 }
 
+bool OMS::cancelOrder(Order &od)
+{
+    if (trader->ReqOrderAction(od.sym, 0, 0, "", od.orderInfo->ExchangeID, od.orderInfo->OrderSysID) != 0)
+        return false;
+    od.state = OrderPendingCancel;
+    pendingCancel.insert(od.orderID, { od.sym, steadyMs() });
+    ++symInFlight[od.sym];
+    return true;
+}
+
+// Cancels working orders of the long or short side of sym by volume, worst queue position first
+// within a price. An order larger than the rest is replaced by a smaller one at its own price.
+// Orders already pending cancel are skipped.
 void OMS::cancelWorkingOrder(std::string & sym, EnumDirectionType direction, int volume)
 {
-    QList<Order> wkOrderQueue;
-    for (auto ord : workingOrderList) {
-        if (ord.sym == sym)
-            wkOrderQueue.append(ord);
+    char side = (direction == EnumDirectionType::Buy ? 'L' : 'S');
+    std::vector<Order*> wkOrderQueue;
+    for (auto &orderID : symWorkingIDs[sym]) {
+        auto &ord = workingOrderList[orderID];
+        if (ord.longShortSide == side && ord.state == OrderAcked)
+            wkOrderQueue.push_back(&ord);
     }
-    if (!wkOrderQueue.empty()) {
-        qSort(wkOrderQueue.begin(), wkOrderQueue.end(), priorInOrderQueue);
-
-        // Notice: Strong Assert: working order list is always of the same sign(aka pending open or close)
-        int res_vol = abs(volume);
-        for (auto wkod : wkOrderQueue) {
-            if (abs(wkod.workingVolume) <= res_vol) {
-                trader->ReqOrderAction(wkod.sym, 0, 0, "", wkod.orderInfo->ExchangeID, wkod.orderInfo->OrderSysID);
-                res_vol -= abs(wkod.workingVolume);
-
-                if (res_vol == 0)
-                    break;
-            }
-            else {
-                // Cancel larger order and re-insert the compensate.
-                trader->ReqOrderAction(wkod.sym, 0, 0, "", wkod.orderInfo->ExchangeID, wkod.orderInfo->OrderSysID);
-                if (wkod.workingVolume > 0)
-                    trader->ReqOrderInsert(wkod.sym, EnumOffsetFlagType::Open, direction, wkod.workingVolume - res_vol);
-                else
-                    trader->ReqOrderInsert(wkod.sym, mymap::offsetFlag_enum.at(wkod.orderInfo->CombOffsetFlag[0]), direction, abs(wkod.workingVolume) - abs(res_vol));
-                break;
-            }
+    std::sort(wkOrderQueue.begin(), wkOrderQueue.end(), [this](const Order *od1, const Order *od2) {
+        if (od1->orderInfo->LimitPrice == od2->orderInfo->LimitPrice) {
+            int ahead1 = queueEst.getAhead(od1->orderID);
+            int ahead2 = queueEst.getAhead(od2->orderID);
+            if (ahead1 != ahead2)
+                return ahead1 > ahead2;
+        }
+        return priorInOrderQueue(*od1, *od2);
+    });
+
+    // Notice: Strong Assert: working order list is always of the same sign(aka pending open or close)
+    int res_vol = abs(volume);
+    for (auto wkod : wkOrderQueue) {
+        if (!cancelOrder(*wkod))
+            break;
+        if (abs(wkod->workingVolume) < res_vol) {
+            res_vol -= abs(wkod->workingVolume);
+            continue;
         }
+        // Cancel larger order and re-insert the compensate.
+        if (abs(wkod->workingVolume) > res_vol)
+            insertSliced(wkod->sym, mymap::offsetFlag_enum.at(wkod->orderInfo->CombOffsetFlag[0]), EnumDirectionType(wkod->orderInfo->Direction),
+                wkod->orderInfo->LimitPrice, abs(wkod->workingVolume) - res_vol);
+        break;
     }
+}
 
+// Orders away from the target price are left to wait while near the queue front, the rest are
+// cancelled and the target gap re-sends them at the target price.
+void OMS::repriceWorkingOrders(PosTarget &pt)
+{
+    if (pt.targetPrice == 0)
+        return;
+    if (budget != nullptr && budget->cancelHeadroom(pt.sym) < REPRICE_CANCEL_HEADROOM)
+        return;
+    for (auto &orderID : symWorkingIDs[pt.sym]) {
+        auto &od = workingOrderList[orderID];
+        if (od.state != OrderAcked || od.orderInfo->LimitPrice == pt.targetPrice)
+            continue;
+        int ahead = queueEst.getAhead(orderID);
+        if (ahead >= 0 && ahead <= repriceAhead)
+            continue;
+        cancelOrder(od);
+    }
 }
 
 
@@ -406,6 +743,48 @@ void OMS::execCmdLine(QString cmdLine)
                 setPosTarget(sym, pos, px);
             }
         }
+        else if (argv.at(1) == "po")
+        {
+            QString msg;
+            for (auto &po : parentOrderList)
+                msg += QString("Parent %1 %2 %3 @%4 vol=%5 sent=%6 traded=%7 children=%8\n").arg(po.parentID)
+                    .arg(po.sym.c_str()).arg(po.direction).arg(po.price).arg(po.volume)
+                    .arg(po.volumeSent).arg(po.volumeTraded).arg((int)po.childTraded.size());
+            emit sendToTraderMonitor(msg == "" ? "No parent order working" : msg);
+        }
+        else if (argv.at(1) == "lock" && n == 3)
+        {
+            offsetOpt.setLockEnabled(argv.at(2) == "on");
+            emit sendToTraderMonitor(QString("Locking %1").arg(offsetOpt.isLockEnabled() ? "on" : "off"));
+        }
+        else if (argv.at(1) == "fee" && n == 5 && commission != nullptr)
+        {
+            std::string sym = argv.at(2).toStdString();
+            double px = argv.at(3).toDouble();
+            int vol = argv.at(4).toInt();
+            emit sendToTraderMonitor(QString("%1 %2@%3 %4 open=%5 close=%6 closetoday=%7").arg(sym.c_str()).arg(vol).arg(px)
+                .arg(commission->costs(sym).isKnown ? "fee" : "fee(rate unknown)").arg(commission->openFee(sym, px, vol))
+                .arg(commission->closeFee(sym, false, px, vol)).arg(commission->closeFee(sym, true, px, vol)));
+        }
+        else if (argv.at(1) == "queue")
+        {
+            emit sendToTraderMonitor(queueEst.summary());
+        }
+        else if (argv.at(1) == "reprice" && n == 3)
+        {
+            bool ok;
+            int lots = argv.at(2).toInt(&ok);
+            repriceAhead = (ok ? lots : -1);
+            emit sendToTraderMonitor(repriceAhead < 0 ? QString("Reprice off") : QString("Reprice orders with more than %1 lots ahead").arg(repriceAhead));
+        }
+        else if (argv.at(1) == "pair" && pairExec != nullptr)
+        {
+            emit sendToTraderMonitor(pairExec->execCmd(argv));
+        }
+        else if (argv.at(1) == "algo" && algo != nullptr)
+        {
+            emit sendToTraderMonitor(algo->execCmd(argv));
+        }
         else {
             emit sendToTraderMonitor("Invalid cmd");
         }
@@ -422,7 +801,7 @@ Trade::Trade()
 Trade::Trade(CThostFtdcTradeField *tf)
 {
     tradeID = QString("%1+%2").arg(tf->ExchangeID).arg(tf->OrderSysID);
-    tradeInfo = tf;
+    tradeInfo = std::make_shared<CThostFtdcTradeField>(*tf);
 }
 
 Order::Order()
@@ -453,5 +832,5 @@ Order::Order(CThostFtdcOrderField *of)
     //orderID = QString("%1-%2").arg(of->ExchangeID).arg(of->OrderSysID);
     //orderID = QString("%1-%2").arg(of->BrokerID).arg(of->BrokerOrderSeq);
     orderID = QString("%1-%2-%3").arg(of->FrontID).arg(of->SessionID).arg(of->OrderRef);
-    orderInfo = of;
+    orderInfo = std::make_shared<CThostFtdcOrderField>(*of);
 }
@@ -0,0 +1,222 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include "include/pairexec.h"
+#include "include/oms.h"
+
+using namespace std;
+
+static long long steadyMs()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PairExec::PairExec()
+{
+    g_logger = spdlog::get("file_logger");
+}
+
+void PairExec::setOMS(OMS *oms)
+{
+    this->oms = oms;
+}
+
+bool PairExec::start(const PairOrder &po)
+{
+    lock_guard<mutex> lock(mu);
+    return startLocked(po);
+}
+
+// Replaces the pair already on these legs, fails if a leg is worked by another pair.
+bool PairExec::startLocked(const PairOrder &po)
+{
+    for (auto &leg : { po.yname, po.xname }) {
+        auto it = symPair.find(leg);
+        if (it != symPair.end() && it->second != po.yname)
+            return false;
+    }
+    auto it = pairs.find(po.yname);
+    if (it != pairs.end() && it->second.xname != po.xname)
+        symPair.erase(it->second.xname);
+    pairs[po.yname] = po;
+    symPair[po.yname] = po.yname;
+    symPair[po.xname] = po.yname;
+    return true;
+}
+
+// Both legs are held where they are, the OMS cancels what is still working for them
+// instead of carrying on toward the pair's last targets.
+void PairExec::stop(const string &sym)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = symPair.find(sym);
+    if (it == symPair.end())
+        return;
+    auto pit = pairs.find(it->second);
+    auto &po = pit->second;
+    if (po.isStarted) {
+        for (auto leg : { make_pair(po.yname, po.yFinal), make_pair(po.xname, po.xFinal) }) {
+            int pos = oms->getNetPos(leg.first);
+            auto &q = quotes[leg.first];
+            oms->setPosTarget(leg.first.c_str(), pos, leg.second > pos ? q.bid : q.ask);
+        }
+        g_logger->info("Pair {}/{} stopped, legs held at {}/{}", po.yname, po.xname,
+            oms->getNetPos(po.yname), oms->getNetPos(po.xname));
+    }
+    symPair.erase(po.yname);
+    symPair.erase(po.xname);
+    pairs.erase(pit);
+}
+
+// Absolute leg targets, e.g. from a strategy. Risk bounds of a pair already running are kept.
+bool PairExec::setPairTarget(const string &yname, const string &xname, int ypos, int xpos)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = pairs.find(yname);
+    if (it != pairs.end() && it->second.xname == xname) {
+        auto &po = it->second;
+        if (po.isStarted && !po.isRelative && po.yFinal == ypos && po.xFinal == xpos)
+            return true;
+        po.isRelative = false;
+        po.yFinal = ypos;
+        po.xFinal = xpos;
+        po.isStarted = false;
+        po.isDone = false;
+        return true;
+    }
+    PairOrder po;
+    po.yname = yname;
+    po.xname = xname;
+    po.yFinal = ypos;
+    po.xFinal = xpos;
+    return startLocked(po);
+}
+
+void PairExec::onTick(CThostFtdcDepthMarketDataField *mkt)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = symPair.find(mkt->InstrumentID);
+    if (it == symPair.end())
+        return;
+    auto &q = quotes[mkt->InstrumentID];
+    q.bid = mkt->BidPrice1;
+    q.ask = mkt->AskPrice1;
+    q.volume = mkt->Volume;
+
+    auto pit = pairs.find(it->second);
+    step(pit->second);
+    // done pairs stay registered, a later target of the strategy restarts them
+}
+
+void PairExec::step(PairOrder &po)
+{
+    auto yq = quotes.find(po.yname);
+    auto xq = quotes.find(po.xname);
+    if (yq == quotes.end() || xq == quotes.end())
+        return;
+    if (po.isDone)
+        return;
+
+    if (!po.isStarted) {
+        po.isStarted = true;
+        po.isFrozen = false;
+        po.unhedgedSinceMs = 0;
+        po.yStart = oms->getNetPos(po.yname);
+        po.xStart = oms->getNetPos(po.xname);
+        if (po.isRelative) {
+            po.yFinal = po.yStart + po.units * po.yRatio;
+            po.xFinal = po.xStart + po.units * po.xRatio;
+        }
+        po.isPassiveY = yq->second.volume <= xq->second.volume;
+    }
+
+    const string &pSym = po.isPassiveY ? po.yname : po.xname;
+    const string &hSym = po.isPassiveY ? po.xname : po.yname;
+    const LegQuote &pq = po.isPassiveY ? yq->second : xq->second;
+    const LegQuote &hq = po.isPassiveY ? xq->second : yq->second;
+    int pStart = po.isPassiveY ? po.yStart : po.xStart;
+    int hStart = po.isPassiveY ? po.xStart : po.yStart;
+    int pFinal = po.isPassiveY ? po.yFinal : po.xFinal;
+    int hFinal = po.isPassiveY ? po.xFinal : po.yFinal;
+
+    int p = oms->getNetPos(pSym);
+    int h = oms->getNetPos(hSym);
+    int hWant = (pFinal == pStart ? hFinal : hStart + (int)lround(double(p - pStart) * (hFinal - hStart) / (pFinal - pStart)));
+    int unhedged = hWant - h;
+
+    long long nowMs = steadyMs();
+    if (unhedged != 0) {
+        oms->setPosTarget(hSym.c_str(), hWant, unhedged > 0 ? hq.ask : hq.bid);
+        if (po.unhedgedSinceMs == 0)
+            po.unhedgedSinceMs = nowMs;
+    }
+    else
+        po.unhedgedSinceMs = 0;
+
+    bool isBreached = abs(unhedged) > po.maxUnhedged
+        || (po.unhedgedSinceMs != 0 && nowMs - po.unhedgedSinceMs > po.maxUnhedgedMs);
+    if (isBreached) {
+        if (!po.isFrozen)
+            g_logger->warn("Pair {}/{}: {} unhedged lots on {} for {}ms, passive leg held", po.yname, po.xname,
+                unhedged, hSym, po.unhedgedSinceMs == 0 ? 0 : nowMs - po.unhedgedSinceMs);
+        po.isFrozen = true;
+        oms->setPosTarget(pSym.c_str(), p, pFinal > p ? pq.bid : pq.ask);
+    }
+    else {
+        po.isFrozen = false;
+        oms->setPosTarget(pSym.c_str(), pFinal, pFinal > p ? pq.bid : pq.ask);
+    }
+    po.isDone = (p == pFinal && h == hFinal);
+}
+
+// oms pair [y] [x] [units] [yratio] [xratio] ([maxunhedged] [seconds])
+// oms pair stop [symbol]
+// oms pair show
+QString PairExec::execCmd(const QStringList &argv)
+{
+    int n = argv.count();
+    if (n == 3 && argv.at(2) == "show")
+        return summary();
+    if (n == 4 && argv.at(2) == "stop") {
+        stop(argv.at(3).toStdString());
+        return QString("Pair on %1 stopped").arg(argv.at(3));
+    }
+    if (n == 7 || n == 9) {
+        PairOrder po;
+        po.yname = argv.at(2).toStdString();
+        po.xname = argv.at(3).toStdString();
+        po.isRelative = true;
+        bool oku, oky, okx, okm{ true }, oks{ true };
+        po.units = argv.at(4).toInt(&oku);
+        po.yRatio = argv.at(5).toInt(&oky);
+        po.xRatio = argv.at(6).toInt(&okx);
+        if (n == 9) {
+            po.maxUnhedged = argv.at(7).toInt(&okm);
+            po.maxUnhedgedMs = (int)(argv.at(8).toDouble(&oks) * 1000);
+        }
+        if (!oku || !oky || !okx || !okm || !oks || po.yname == po.xname || po.maxUnhedged < 0)
+            return "Invalid cmd";
+        if (!start(po))
+            return QString("%1/%2: leg already worked by another pair").arg(po.yname.c_str()).arg(po.xname.c_str());
+        return QString("Pair %1/%2 started, %3 x %4:%5").arg(po.yname.c_str()).arg(po.xname.c_str())
+            .arg(po.units).arg(po.yRatio).arg(po.xRatio);
+    }
+    return "Invalid cmd";
+}
+
+QString PairExec::summary()
+{
+    lock_guard<mutex> lock(mu);
+    QString msg;
+    for (auto &kv : pairs) {
+        auto &po = kv.second;
+        msg += QString("%1/%2 passive=%3 start=%4/%5 final=%6/%7 %8\n").arg(po.yname.c_str()).arg(po.xname.c_str())
+            .arg(po.isPassiveY ? po.yname.c_str() : po.xname.c_str())
+            .arg(po.yStart).arg(po.xStart).arg(po.yFinal).arg(po.xFinal)
+            .arg(po.isDone ? "done" : (po.isFrozen ? "held" : (po.isStarted ? "working" : "waiting")));
+    }
+    if (msg == "")
+        msg = "No pair working";
+    return msg;
+}
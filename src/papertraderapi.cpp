@@ -0,0 +1,679 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include <QDate>
+#include <QTime>
+
+#include "include/papertraderapi.h"
+#include "include/instrumentcache.h"
+#include "include/myevent.h"
+
+using namespace std;
+
+const int PAPER_FRONT_ID = 1;
+const int PAPER_SESSION_ID = 1;
+const long long DAY_MS = 24 * 3600 * 1000LL;
+const long long SESSION_START_MS = 18 * 3600 * 1000LL;
+const long long STALE_MS = 5 * 60 * 1000LL;
+
+template<size_t N>
+static void copyStr(char (&dst)[N], const char *src)
+{
+    strncpy(dst, src, N - 1);
+    dst[N - 1] = '\0';
+}
+
+static string refKey(int frontID, int sessionID, const char *orderRef)
+{
+    return to_string(frontID) + "-" + to_string(sessionID) + "-" + to_string(atoi(orderRef));
+}
+
+// Position a close order takes lots from, InstrumentID+Direction of the held side.
+static string closeKey(const CThostFtdcOrderField &of)
+{
+    return string(of.InstrumentID) + (of.Direction == THOST_FTDC_D_Buy ? THOST_FTDC_D_Sell : THOST_FTDC_D_Buy);
+}
+
+PaperTraderApi::PaperTraderApi(int latencyMs) : QObject(Q_NULLPTR)
+{
+    g_logger = spdlog::get("file_logger");
+    latencies[""].minMs = max(latencyMs, 0);
+    tradingDay = QDate::currentDate().toString("yyyyMMdd").toStdString();
+}
+
+void PaperTraderApi::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+}
+
+void PaperTraderApi::setLatency(int minMs, int jitterMs, const string &exchangeID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    auto &profile = latencies[exchangeID];
+    profile.minMs = max(minMs, 0);
+    profile.jitterMs = max(jitterMs, 0);
+}
+
+// Arrival in market time, never before an earlier request to the same exchange.
+long long PaperTraderApi::arrivalMs(const string &exchangeID)
+{
+    auto it = latencies.find(exchangeID);
+    const auto &profile = it != latencies.end() ? it->second : latencies[""];
+    long long ms = clockMs + profile.minMs;
+    if (profile.jitterMs > 0)
+        ms += llround(exponential_distribution<double>(1.0 / profile.jitterMs)(rng));
+    auto &last = lastArriveMs[exchangeID];
+    last = max(last, ms);
+    return last;
+}
+
+void PaperTraderApi::RegisterSpi(CThostFtdcTraderSpi *pSpi)
+{
+    spi = pSpi;
+}
+
+// The front connects once the event loop runs, like the CTP api thread, so the
+// login workflow starts after everything is wired up.
+void PaperTraderApi::Init()
+{
+    g_logger->info("PaperTraderApi: paper exchange, latency {}ms, trading day {}", latencies[""].minMs, tradingDay);
+    QMetaObject::invokeMethod(this, "connectFront", Qt::QueuedConnection);
+}
+
+void PaperTraderApi::connectFront()
+{
+    spi->OnFrontConnected();
+}
+
+const char *PaperTraderApi::GetTradingDay()
+{
+    return tradingDay.c_str();
+}
+
+int PaperTraderApi::ReqUserLogin(CThostFtdcReqUserLoginField *pReqUserLoginField, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    brokerID = pReqUserLoginField->BrokerID;
+    userID = pReqUserLoginField->UserID;
+    int maxOrderRef = 0;
+    for (auto &po : orders)
+        maxOrderRef = max(maxOrderRef, atoi(po.field.OrderRef));
+
+    CThostFtdcRspUserLoginField login;
+    memset(&login, 0, sizeof(login));
+    string now = QTime::currentTime().toString("hh:mm:ss").toStdString();
+    copyStr(login.TradingDay, tradingDay.c_str());
+    copyStr(login.LoginTime, now.c_str());
+    copyStr(login.BrokerID, brokerID.c_str());
+    copyStr(login.UserID, userID.c_str());
+    copyStr(login.SystemName, "paper");
+    copyStr(login.MaxOrderRef, to_string(maxOrderRef).c_str());
+    copyStr(login.SHFETime, now.c_str());
+    copyStr(login.DCETime, now.c_str());
+    copyStr(login.CZCETime, now.c_str());
+    copyStr(login.FFEXTime, now.c_str());
+    copyStr(login.INETime, now.c_str());
+    login.FrontID = PAPER_FRONT_ID;
+    login.SessionID = PAPER_SESSION_ID;
+    CThostFtdcRspInfoField rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    spi->OnRspUserLogin(&login, &rsp, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqUserLogout(CThostFtdcUserLogoutField *pUserLogout, int nRequestID)
+{
+    CThostFtdcUserLogoutField logout = *pUserLogout;
+    CThostFtdcRspInfoField rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    spi->OnRspUserLogout(&logout, &rsp, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqSettlementInfoConfirm(CThostFtdcSettlementInfoConfirmField *pSettlementInfoConfirm, int nRequestID)
+{
+    CThostFtdcSettlementInfoConfirmField confirm = *pSettlementInfoConfirm;
+    copyStr(confirm.ConfirmDate, tradingDay.c_str());
+    copyStr(confirm.ConfirmTime, QTime::currentTime().toString("hh:mm:ss").toStdString().c_str());
+    spi->OnRspSettlementInfoConfirm(&confirm, nullptr, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqQrySettlementInfo(CThostFtdcQrySettlementInfoField *pQrySettlementInfo, int nRequestID)
+{
+    CThostFtdcSettlementInfoField info;
+    memset(&info, 0, sizeof(info));
+    copyStr(info.TradingDay, tradingDay.c_str());
+    copyStr(info.BrokerID, pQrySettlementInfo->BrokerID);
+    copyStr(info.InvestorID, pQrySettlementInfo->InvestorID);
+    copyStr(info.Content, "Paper account, no settlement.");
+    spi->OnRspQrySettlementInfo(&info, nullptr, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqQrySettlementInfoConfirm(CThostFtdcQrySettlementInfoConfirmField *pQrySettlementInfoConfirm, int nRequestID)
+{
+    CThostFtdcSettlementInfoConfirmField confirm;
+    memset(&confirm, 0, sizeof(confirm));
+    copyStr(confirm.BrokerID, pQrySettlementInfoConfirm->BrokerID);
+    copyStr(confirm.InvestorID, pQrySettlementInfoConfirm->InvestorID);
+    copyStr(confirm.ConfirmDate, tradingDay.c_str());
+    copyStr(confirm.ConfirmTime, QTime::currentTime().toString("hh:mm:ss").toStdString().c_str());
+    spi->OnRspQrySettlementInfoConfirm(&confirm, nullptr, nRequestID, true);
+    return 0;
+}
+
+// Contract info and rates come from the instrument cache, the paper exchange needs it
+// written by a live login once.
+int PaperTraderApi::ReqQryInstrument(CThostFtdcQryInstrumentField *pQryInstrument, int nRequestID)
+{
+    vector<CThostFtdcInstrumentField> infos;
+    if (instrumentCache != nullptr)
+        infos = instrumentCache->getInstruments();
+    if (infos.empty()) {
+        g_logger->warn("PaperTraderApi: no cached contract info, log in live once to fill the cache");
+        spi->OnRspQryInstrument(nullptr, nullptr, nRequestID, true);
+        return 0;
+    }
+    for (size_t i = 0; i < infos.size(); ++i)
+        spi->OnRspQryInstrument(&infos[i], nullptr, nRequestID, i + 1 == infos.size());
+    return 0;
+}
+
+int PaperTraderApi::ReqQryInstrumentMarginRate(CThostFtdcQryInstrumentMarginRateField *pQryInstrumentMarginRate, int nRequestID)
+{
+    CThostFtdcInstrumentMarginRateField rate;
+    if (instrumentCache != nullptr && instrumentCache->getMarginRate(pQryInstrumentMarginRate->InstrumentID, rate))
+        spi->OnRspQryInstrumentMarginRate(&rate, nullptr, nRequestID, true);
+    else
+        spi->OnRspQryInstrumentMarginRate(nullptr, nullptr, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqQryInstrumentCommissionRate(CThostFtdcQryInstrumentCommissionRateField *pQryInstrumentCommissionRate, int nRequestID)
+{
+    CThostFtdcInstrumentCommissionRateField rate;
+    if (instrumentCache != nullptr && instrumentCache->getCommissionRate(pQryInstrumentCommissionRate->InstrumentID, rate))
+        spi->OnRspQryInstrumentCommissionRate(&rate, nullptr, nRequestID, true);
+    else
+        spi->OnRspQryInstrumentCommissionRate(nullptr, nullptr, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqQryDepthMarketData(CThostFtdcQryDepthMarketDataField *pQryDepthMarketData, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    auto it = books.find(pQryDepthMarketData->InstrumentID);
+    if (it == books.end()) {
+        spi->OnRspQryDepthMarketData(nullptr, nullptr, nRequestID, true);   // no tick seen yet
+        return 0;
+    }
+    CThostFtdcDepthMarketDataField mkt = it->second;
+    spi->OnRspQryDepthMarketData(&mkt, nullptr, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqQryTradingAccount(CThostFtdcQryTradingAccountField *pQryTradingAccount, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    CThostFtdcTradingAccountField acc;
+    memset(&acc, 0, sizeof(acc));
+    copyStr(acc.BrokerID, pQryTradingAccount->BrokerID);
+    copyStr(acc.AccountID, pQryTradingAccount->InvestorID);
+    copyStr(acc.TradingDay, tradingDay.c_str());
+    acc.PreBalance = capital;
+    acc.CloseProfit = closeProfit;
+    acc.Balance = capital + closeProfit;
+    acc.Available = acc.Balance;
+    spi->OnRspQryTradingAccount(&acc, nullptr, nRequestID, true);
+    return 0;
+}
+
+int PaperTraderApi::ReqQryOrder(CThostFtdcQryOrderField *pQryOrder, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    if (orders.empty()) {
+        spi->OnRspQryOrder(nullptr, nullptr, nRequestID, true);
+        return 0;
+    }
+    for (size_t i = 0; i < orders.size(); ++i) {
+        CThostFtdcOrderField of = orders[i].field;
+        spi->OnRspQryOrder(&of, nullptr, nRequestID, i + 1 == orders.size());
+    }
+    return 0;
+}
+
+int PaperTraderApi::ReqQryTrade(CThostFtdcQryTradeField *pQryTrade, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    if (trades.empty()) {
+        spi->OnRspQryTrade(nullptr, nullptr, nRequestID, true);
+        return 0;
+    }
+    for (size_t i = 0; i < trades.size(); ++i) {
+        CThostFtdcTradeField td = trades[i];
+        spi->OnRspQryTrade(&td, nullptr, nRequestID, i + 1 == trades.size());
+    }
+    return 0;
+}
+
+int PaperTraderApi::ReqQryInvestorPositionDetail(CThostFtdcQryInvestorPositionDetailField *pQryInvestorPositionDetail, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    vector<CThostFtdcInvestorPositionDetailField> details;
+    for (auto &pd : posDetails) {
+        if (pQryInvestorPositionDetail->InstrumentID[0] == '\0' || strcmp(pd.InstrumentID, pQryInvestorPositionDetail->InstrumentID) == 0)
+            details.push_back(pd);
+    }
+    if (details.empty()) {
+        spi->OnRspQryInvestorPositionDetail(nullptr, nullptr, nRequestID, true);
+        return 0;
+    }
+    for (size_t i = 0; i < details.size(); ++i)
+        spi->OnRspQryInvestorPositionDetail(&details[i], nullptr, nRequestID, i + 1 == details.size());
+    return 0;
+}
+
+// Positions summed up from the details, all opened on the paper trading day.
+int PaperTraderApi::ReqQryInvestorPosition(CThostFtdcQryInvestorPositionField *pQryInvestorPosition, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    map<pair<string, char>, CThostFtdcInvestorPositionField> positions;
+    for (auto &pd : posDetails) {
+        if (pQryInvestorPosition->InstrumentID[0] != '\0' && strcmp(pd.InstrumentID, pQryInvestorPosition->InstrumentID) != 0)
+            continue;
+        auto &p = positions[{ pd.InstrumentID, pd.Direction }];
+        if (p.InstrumentID[0] == '\0') {
+            memset(&p, 0, sizeof(p));
+            copyStr(p.InstrumentID, pd.InstrumentID);
+            copyStr(p.BrokerID, pd.BrokerID);
+            copyStr(p.InvestorID, pd.InvestorID);
+            copyStr(p.TradingDay, tradingDay.c_str());
+            p.PosiDirection = pd.Direction == THOST_FTDC_D_Buy ? THOST_FTDC_PD_Long : THOST_FTDC_PD_Short;
+            p.HedgeFlag = pd.HedgeFlag;
+            p.PositionDate = THOST_FTDC_PSD_Today;
+        }
+        p.Position += pd.Volume;
+        p.TodayPosition += pd.Volume;
+        p.OpenVolume += pd.Volume + pd.CloseVolume;
+        p.CloseVolume += pd.CloseVolume;
+        p.CloseAmount += pd.CloseAmount;
+        p.CloseProfit += pd.CloseProfitByDate;
+        p.OpenCost += pd.OpenPrice * pd.Volume * multiple(pd.InstrumentID);
+    }
+    if (positions.empty()) {
+        spi->OnRspQryInvestorPosition(nullptr, nullptr, nRequestID, true);
+        return 0;
+    }
+    size_t i = 0;
+    for (auto &kv : positions)
+        spi->OnRspQryInvestorPosition(&kv.second, nullptr, nRequestID, ++i == positions.size());
+    return 0;
+}
+
+int PaperTraderApi::ReqOrderInsert(CThostFtdcInputOrderField *pInputOrder, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    PaperOrder po;
+    auto &of = po.field;
+    memset(&of, 0, sizeof(of));
+    copyStr(of.BrokerID, pInputOrder->BrokerID);
+    copyStr(of.InvestorID, pInputOrder->InvestorID);
+    copyStr(of.InstrumentID, pInputOrder->InstrumentID);
+    copyStr(of.OrderRef, pInputOrder->OrderRef);
+    copyStr(of.UserID, pInputOrder->UserID);
+    copyStr(of.CombOffsetFlag, pInputOrder->CombOffsetFlag);
+    copyStr(of.CombHedgeFlag, pInputOrder->CombHedgeFlag);
+    copyStr(of.ExchangeID, pInputOrder->ExchangeID);
+    if (of.ExchangeID[0] == '\0' && instrumentCache != nullptr) {
+        CThostFtdcInstrumentField info;
+        if (instrumentCache->getInstrument(of.InstrumentID, info))
+            copyStr(of.ExchangeID, info.ExchangeID);
+    }
+    of.OrderPriceType = pInputOrder->OrderPriceType;
+    of.Direction = pInputOrder->Direction;
+    of.LimitPrice = pInputOrder->LimitPrice;
+    of.VolumeTotalOriginal = pInputOrder->VolumeTotalOriginal;
+    of.TimeCondition = pInputOrder->TimeCondition;
+    of.VolumeCondition = pInputOrder->VolumeCondition;
+    of.MinVolume = pInputOrder->MinVolume;
+    of.ContingentCondition = pInputOrder->ContingentCondition;
+    of.StopPrice = pInputOrder->StopPrice;
+    of.ForceCloseReason = pInputOrder->ForceCloseReason;
+    of.RequestID = nRequestID;
+    of.FrontID = PAPER_FRONT_ID;
+    of.SessionID = PAPER_SESSION_ID;
+    of.OrderSubmitStatus = THOST_FTDC_OSS_InsertSubmitted;
+    of.OrderStatus = THOST_FTDC_OST_Unknown;
+    of.VolumeTotal = of.VolumeTotalOriginal;
+    copyStr(of.TradingDay, tradingDay.c_str());
+    copyStr(of.InsertDate, tradingDay.c_str());
+    copyStr(of.InsertTime, clockTime.c_str());
+
+    // like CTP, a close freezes its lots when sent, so closes resting or still in flight count
+    if (of.CombOffsetFlag[0] != THOST_FTDC_OF_Open && of.VolumeTotalOriginal > 0) {
+        string key = closeKey(of);
+        if (heldVolume[key] - frozenClose[key] < of.VolumeTotalOriginal)
+            po.isOverClose = true;
+        else {
+            po.frozenClose = of.VolumeTotalOriginal;
+            frozenClose[key] += po.frozenClose;
+        }
+    }
+
+    po.index = orders.size();
+    orders.push_back(po);
+    size_t idx = po.index;
+    refIndex[refKey(of.FrontID, of.SessionID, of.OrderRef)] = idx;
+    PaperInbound in;
+    in.arriveMs = arrivalMs(of.ExchangeID);
+    in.seq = ++nInbound;
+    in.order = idx;
+    inbound.push(in);
+    return 0;
+}
+
+int PaperTraderApi::ReqOrderAction(CThostFtdcInputOrderActionField *pInputOrderAction, int nRequestID)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    PaperInbound in;
+    auto po = findOrder(*pInputOrderAction);
+    in.arriveMs = arrivalMs(po != nullptr ? po->field.ExchangeID : pInputOrderAction->ExchangeID);
+    in.seq = ++nInbound;
+    in.isCancel = true;
+    in.action = *pInputOrderAction;
+    in.action.RequestID = nRequestID;
+    inbound.push(in);
+    return 0;
+}
+
+void PaperTraderApi::onEvent(QEvent *ev)
+{
+    auto myev = (MyEvent*)ev;
+    if (myev->myType == MarketEvent && myev->mkt != nullptr)
+        onTick(myev->mkt);
+}
+
+// Resting orders of the symbol see the tick first, then whatever reached the exchange by
+// its time is acknowledged and matched against it.
+void PaperTraderApi::onTick(CThostFtdcDepthMarketDataField *mkt)
+{
+    lock_guard<recursive_mutex> lock(mu);
+    long long ms = marketMs(*mkt);
+    if (ms + STALE_MS < clockMs)
+        return;     // snapshot of an earlier session, e.g. of a product closed at night
+    if (ms >= clockMs) {
+        clockMs = ms;
+        clockTime = mkt->UpdateTime;
+    }
+    books[mkt->InstrumentID] = *mkt;
+
+    fills.clear();
+    fillModel.onTick(*mkt, fills);
+    apply(fills);
+    while (!inbound.empty() && inbound.top().arriveMs <= clockMs) {
+        PaperInbound in = inbound.top();
+        inbound.pop();
+        arrive(in);
+    }
+}
+
+void PaperTraderApi::apply(const vector<FillEvent> &fillEvents)
+{
+    for (auto &fe : fillEvents)
+        fill(orders[fe.order], fe.price, fe.volume);
+}
+
+void PaperTraderApi::arrive(const PaperInbound &in)
+{
+    if (in.isCancel) {
+        auto po = findOrder(in.action);
+        char status = po != nullptr ? po->field.OrderStatus : THOST_FTDC_OST_Unknown;
+        if (po != nullptr && po->field.OrderSubmitStatus == THOST_FTDC_OSS_Accepted
+                && status != THOST_FTDC_OST_AllTraded && status != THOST_FTDC_OST_Canceled) {
+            cancel(*po, "Canceled");
+            return;
+        }
+        CThostFtdcOrderActionField action;
+        memset(&action, 0, sizeof(action));
+        copyStr(action.BrokerID, in.action.BrokerID);
+        copyStr(action.InvestorID, in.action.InvestorID);
+        copyStr(action.InstrumentID, in.action.InstrumentID);
+        copyStr(action.OrderRef, in.action.OrderRef);
+        copyStr(action.ExchangeID, in.action.ExchangeID);
+        copyStr(action.OrderSysID, in.action.OrderSysID);
+        action.FrontID = in.action.FrontID;
+        action.SessionID = in.action.SessionID;
+        action.ActionFlag = in.action.ActionFlag;
+        CThostFtdcRspInfoField rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        rsp.ErrorID = po == nullptr ? 25 : 26;
+        copyStr(rsp.ErrorMsg, po == nullptr ? "order not found" : "order not working");
+        spi->OnErrRtnOrderAction(&action, &rsp);
+        return;
+    }
+
+    auto &po = orders[in.order];
+    auto &of = po.field;
+    const char *reject = nullptr;
+    if (of.VolumeTotalOriginal <= 0)
+        reject = "invalid volume";
+    else if (of.ContingentCondition != THOST_FTDC_CC_Immediately)
+        reject = "conditional orders not supported";
+    else if (po.isOverClose)
+        reject = "insufficient position to close";
+    if (reject != nullptr) {
+        releaseClose(po, po.frozenClose);
+        of.OrderSubmitStatus = THOST_FTDC_OSS_InsertRejected;
+        of.OrderStatus = THOST_FTDC_OST_Canceled;
+        copyStr(of.StatusMsg, reject);
+        copyStr(of.CancelTime, clockTime.c_str());
+        spi->OnRtnOrder(&of);
+        return;
+    }
+
+    char sysID[21];
+    snprintf(sysID, sizeof(sysID), "%12d", ++nOrderSysID);
+    copyStr(of.OrderSysID, sysID);
+    sysIndex[sysID] = in.order;
+    of.BrokerOrderSeq = nOrderSysID;
+    of.SequenceNo = nOrderSysID;
+    of.OrderSubmitStatus = THOST_FTDC_OSS_Accepted;
+    of.OrderStatus = THOST_FTDC_OST_NoTradeQueueing;
+    copyStr(of.StatusMsg, "NoTradeQueueing");
+    spi->OnRtnOrder(&of);
+
+    string sym = of.InstrumentID;
+    bool isBuy = of.Direction == THOST_FTDC_D_Buy;
+    bool isMarket = of.OrderPriceType == THOST_FTDC_OPT_AnyPrice;
+    bool isIOC = isMarket || of.TimeCondition == THOST_FTDC_TC_IOC;
+    if (!fillModel.hasBook(sym)) {
+        if (isIOC)
+            cancel(po, "no market to match");
+        else {
+            fillModel.rest(sym, po.index, isBuy, of.LimitPrice, of.VolumeTotal);
+            po.isResting = true;
+        }
+        return;
+    }
+    if (of.VolumeCondition == THOST_FTDC_VC_CV && fillModel.available(sym, isBuy, of.LimitPrice, isMarket) < of.VolumeTotal) {
+        cancel(po, "FOK not filled");
+        return;
+    }
+    fills.clear();
+    fillModel.take(sym, po.index, isBuy, of.LimitPrice, isMarket, of.VolumeTotal, fills);
+    apply(fills);
+    if (of.VolumeTotal == 0)
+        return;
+    if (isIOC)
+        cancel(po, "IOC remainder canceled");
+    else {
+        fillModel.rest(sym, po.index, isBuy, of.LimitPrice, of.VolumeTotal);
+        po.isResting = true;
+    }
+}
+
+void PaperTraderApi::fill(PaperOrder &po, double price, int volume)
+{
+    auto &of = po.field;
+    of.VolumeTraded += volume;
+    of.VolumeTotal -= volume;
+    of.OrderStatus = of.VolumeTotal == 0 ? THOST_FTDC_OST_AllTraded : THOST_FTDC_OST_PartTradedQueueing;
+    copyStr(of.StatusMsg, of.VolumeTotal == 0 ? "AllTraded" : "PartTradedQueueing");
+    if (of.VolumeTotal == 0)
+        po.isResting = false;
+    spi->OnRtnOrder(&of);
+
+    CThostFtdcTradeField td;
+    memset(&td, 0, sizeof(td));
+    copyStr(td.BrokerID, of.BrokerID);
+    copyStr(td.InvestorID, of.InvestorID);
+    copyStr(td.InstrumentID, of.InstrumentID);
+    copyStr(td.OrderRef, of.OrderRef);
+    copyStr(td.UserID, of.UserID);
+    copyStr(td.ExchangeID, of.ExchangeID);
+    copyStr(td.OrderSysID, of.OrderSysID);
+    char tradeID[21];
+    snprintf(tradeID, sizeof(tradeID), "%12d", ++nTradeID);
+    copyStr(td.TradeID, tradeID);
+    td.Direction = of.Direction;
+    td.OffsetFlag = of.CombOffsetFlag[0];
+    td.HedgeFlag = of.CombHedgeFlag[0];
+    td.Price = price;
+    td.Volume = volume;
+    copyStr(td.TradeDate, tradingDay.c_str());
+    copyStr(td.TradeTime, clockTime.c_str());
+    copyStr(td.TradingDay, tradingDay.c_str());
+    td.TradeType = THOST_FTDC_TRDT_Common;
+    td.BrokerOrderSeq = of.BrokerOrderSeq;
+    td.SequenceNo = nTradeID;
+    releaseClose(po, volume);
+    book(td);
+    trades.push_back(td);
+    spi->OnRtnTrade(&td);
+}
+
+void PaperTraderApi::cancel(PaperOrder &po, const char *statusMsg)
+{
+    auto &of = po.field;
+    of.OrderStatus = THOST_FTDC_OST_Canceled;
+    copyStr(of.StatusMsg, statusMsg);
+    copyStr(of.CancelTime, clockTime.c_str());
+    releaseClose(po, of.VolumeTotal);
+    if (po.isResting) {
+        fillModel.remove(of.InstrumentID, po.index);
+        po.isResting = false;
+    }
+    spi->OnRtnOrder(&of);
+}
+
+// Opens add a position detail, closes take the oldest lots of the other side.
+void PaperTraderApi::book(const CThostFtdcTradeField &td)
+{
+    if (td.OffsetFlag == THOST_FTDC_OF_Open) {
+        CThostFtdcInvestorPositionDetailField pd;
+        memset(&pd, 0, sizeof(pd));
+        copyStr(pd.InstrumentID, td.InstrumentID);
+        copyStr(pd.BrokerID, td.BrokerID);
+        copyStr(pd.InvestorID, td.InvestorID);
+        copyStr(pd.OpenDate, td.TradingDay);
+        copyStr(pd.TradeID, td.TradeID);
+        copyStr(pd.TradingDay, td.TradingDay);
+        copyStr(pd.ExchangeID, td.ExchangeID);
+        pd.HedgeFlag = td.HedgeFlag;
+        pd.Direction = td.Direction;
+        pd.Volume = td.Volume;
+        pd.OpenPrice = td.Price;
+        pd.TradeType = td.TradeType;
+        posDetails.push_back(pd);
+        heldVolume[string(td.InstrumentID) + td.Direction] += td.Volume;
+        return;
+    }
+
+    char held = td.Direction == THOST_FTDC_D_Buy ? THOST_FTDC_D_Sell : THOST_FTDC_D_Buy;
+    int mult = multiple(td.InstrumentID);
+    int left = td.Volume;
+    for (auto &pd : posDetails) {
+        if (left == 0)
+            break;
+        if (pd.Direction != held || pd.Volume == 0 || strcmp(pd.InstrumentID, td.InstrumentID) != 0)
+            continue;
+        int n = min(left, pd.Volume);
+        double profit = (held == THOST_FTDC_D_Buy ? 1 : -1) * (td.Price - pd.OpenPrice) * n * mult;
+        pd.Volume -= n;
+        pd.CloseVolume += n;
+        pd.CloseAmount += td.Price * n * mult;
+        pd.CloseProfitByDate += profit;
+        pd.CloseProfitByTrade += profit;
+        closeProfit += profit;
+        left -= n;
+    }
+    heldVolume[string(td.InstrumentID) + held] -= td.Volume - left;
+}
+
+// Lots filled or canceled are no longer held by the close, filled ones leave the position.
+void PaperTraderApi::releaseClose(PaperOrder &po, int volume)
+{
+    int n = min(volume, po.frozenClose);
+    if (n <= 0)
+        return;
+    po.frozenClose -= n;
+    frozenClose[closeKey(po.field)] -= n;
+}
+
+int PaperTraderApi::multiple(const string &sym)
+{
+    CThostFtdcInstrumentField info;
+    if (instrumentCache != nullptr && instrumentCache->getInstrument(sym, info) && info.VolumeMultiple > 0)
+        return info.VolumeMultiple;
+    return 1;
+}
+
+PaperOrder *PaperTraderApi::findOrder(const CThostFtdcInputOrderActionField &action)
+{
+    if (action.OrderSysID[0] != '\0') {
+        auto it = sysIndex.find(action.OrderSysID);
+        return it != sysIndex.end() ? &orders[it->second] : nullptr;
+    }
+    int frontID = action.FrontID != 0 ? action.FrontID : PAPER_FRONT_ID;
+    int sessionID = action.SessionID != 0 ? action.SessionID : PAPER_SESSION_ID;
+    auto it = refIndex.find(refKey(frontID, sessionID, action.OrderRef));
+    return it != refIndex.end() ? &orders[it->second] : nullptr;
+}
+
+// Market time on a clock that never runs back: the tick's trading day, and within it the
+// time from 18:00 so the night session comes before the day session. No midnight guessing.
+long long PaperTraderApi::marketMs(const CThostFtdcDepthMarketDataField &mkt) const
+{
+    int h = 0, m = 0, s = 0;
+    sscanf(mkt.UpdateTime, "%d:%d:%d", &h, &m, &s);
+    long long ms = ((h * 60LL + m) * 60 + s) * 1000 + mkt.UpdateMillisec;
+    QDate day = QDate::fromString(mkt.TradingDay, "yyyyMMdd");
+    if (!day.isValid())
+        day = QDate::fromString(tradingDay.c_str(), "yyyyMMdd");
+    return day.toJulianDay() * DAY_MS + (ms - SESSION_START_MS + DAY_MS) % DAY_MS;
+}
+
+QString PaperTraderApi::summary()
+{
+    lock_guard<recursive_mutex> lock(mu);
+    QString msg = QString("Paper exchange: time=%1 orders=%2 resting=%3 inbound=%4 trades=%5 closeProfit=%6\n")
+        .arg(clockTime.c_str()).arg((int)orders.size()).arg((int)fillModel.restingCount())
+        .arg((int)inbound.size()).arg((int)trades.size()).arg(closeProfit);
+    for (auto &kv : latencies)
+        msg += QString("latency %1 %2ms + %3ms jitter\n").arg(kv.first == "" ? "default" : kv.first.c_str())
+            .arg(kv.second.minMs).arg(kv.second.jitterMs);
+    map<string, int> held;
+    for (auto &kv : heldVolume) {
+        if (kv.second != 0)
+            held[kv.first] = kv.second;
+    }
+    for (auto &kv : held) {
+        string sym = kv.first.substr(0, kv.first.size() - 1);
+        msg += QString("%1 %2 %3\n").arg(sym.c_str()).arg(kv.first.back() == THOST_FTDC_D_Buy ? "L" : "S").arg(kv.second);
+    }
+    return msg;
+}
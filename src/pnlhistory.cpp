@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "include/pnlhistory.h"
+
+using namespace std;
+
+const int SECONDS_PER_DAY = 86400;
+const int STALE_SECONDS = 300;
+
+PnlHistory::PnlHistory(int resolution, int capacity)
+    : resolution(max(resolution, 1)), capacity(capacity), account(capacity)
+{
+}
+
+// UpdateTime of a tick, HH:MM:SS, to a bucket of market time. UpdateTime carries no date, so
+// the clock steps by the change of time of day taken whole days apart as close as possible to
+// the host time passed, which rolls it over midnight and over session breaks. Ticks more than
+// a few minutes behind, e.g. snapshots of a closed product pushed at subscription, are stale:
+// they get -1 and leave the clock alone.
+int64_t PnlHistory::bucketOf(const char *updateTime)
+{
+    int hh = 0, mm = 0, ss = 0;
+    if (sscanf(updateTime, "%d:%d:%d", &hh, &mm, &ss) != 3)
+        return account.lastBucket();
+    int second = hh * 3600 + mm * 60 + ss;
+    int64_t host = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    if (lastSecond < 0) {
+        lastSecond = second;
+        clock = second;
+        hostSecond = host;
+        return clock / resolution;
+    }
+    int64_t step = second - lastSecond;
+    int64_t elapsed = host - hostSecond;
+    step += SECONDS_PER_DAY * (int64_t)floor(double(elapsed - step + SECONDS_PER_DAY / 2) / SECONDS_PER_DAY);
+    if (step < -STALE_SECONDS)
+        return -1;
+    if (step < 0)
+        return (clock + step) / resolution;    // slightly out of order, the clock stays
+    lastSecond = second;
+    clock += step;
+    hostSecond = host;
+    return clock / resolution;
+}
+
+void PnlHistory::record(int64_t bucket, const AccountPoint &ap)
+{
+    account.set(bucket, ap);
+}
+
+// A symbol's ring is allocated the first time it is recorded.
+void PnlHistory::record(int64_t bucket, const string &sym, const SymbolPoint &sp)
+{
+    auto it = symbols.find(sym);
+    if (it == symbols.end())
+        it = symbols.emplace(sym, TimeRing<SymbolPoint>(capacity)).first;
+    it->second.set(bucket, sp);
+}
+
+vector<pair<int64_t, AccountPoint>> PnlHistory::accountRange(int64_t from, int64_t to) const
+{
+    vector<pair<int64_t, AccountPoint>> points;
+    account.forEach(from, to, [&](int64_t b, const AccountPoint &ap) { points.push_back({ b, ap }); });
+    return points;
+}
+
+vector<pair<int64_t, SymbolPoint>> PnlHistory::symbolRange(const string &sym, int64_t from, int64_t to) const
+{
+    vector<pair<int64_t, SymbolPoint>> points;
+    auto it = symbols.find(sym);
+    if (it != symbols.end())
+        it->second.forEach(from, to, [&](int64_t b, const SymbolPoint &sp) { points.push_back({ b, sp }); });
+    return points;
+}
+
+// Largest fall of net PnL from a running high within the range.
+double PnlHistory::maxDrawdown(int64_t from, int64_t to) const
+{
+    bool isFirst = true;
+    double high = 0, drawdown = 0;
+    account.forEach(from, to, [&](int64_t, const AccountPoint &ap) {
+        high = isFirst ? ap.netPnl : max(high, ap.netPnl);
+        isFirst = false;
+        drawdown = max(drawdown, high - ap.netPnl);
+    });
+    return drawdown;
+}
+
+double PnlHistory::maxDrawdown(const string &sym, int64_t from, int64_t to) const
+{
+    auto it = symbols.find(sym);
+    if (it == symbols.end())
+        return 0;
+    bool isFirst = true;
+    double high = 0, drawdown = 0;
+    it->second.forEach(from, to, [&](int64_t, const SymbolPoint &sp) {
+        high = isFirst ? sp.netPnl : max(high, sp.netPnl);
+        isFirst = false;
+        drawdown = max(drawdown, high - sp.netPnl);
+    });
+    return drawdown;
+}
+
+QString PnlHistory::timeOf(int64_t bucket) const
+{
+    int second = (bucket * resolution) % 86400;
+    return QString("%1:%2:%3").arg(second / 3600, 2, 10, QChar('0')).arg(second / 60 % 60, 2, 10, QChar('0'))
+        .arg(second % 60, 2, 10, QChar('0'));
+}
@@ -1,9 +1,12 @@
+#include <algorithm>
+
 #include <QCoreApplication>
 #include <QDebug>
 #include <QVector>
 #include <QMap>
 #include <QTimer>
 #include <QThread>
+#include <QStringList>
 
 //#include "include/ThostFtdcUserApiDataType.h"
 #include "include/ThostFtdcUserApiStruct.h"
@@ -14,26 +17,13 @@
 #include "include/rm.h"
 #include "include/oms.h"
 #include "include/trader.h"
+#include "include/commission.h"
+#include "include/margin.h"
+#include "include/stress.h"
+#include "include/dispatcher.h"
 
 using namespace std;
 
-QString getTimeMsec(string time, int ms)
-{
-    QString msec(QString::number(ms));
-    switch (msec.length())
-    {
-    case 1:
-        msec = "00" + msec;
-        break;
-    case 2:
-        msec = "0" + msec;
-        break;
-    default:
-        break;
-    }
-    return QString(time.c_str()) + "." + msec;
-}
-
 Portfolio::Portfolio()
 {
 }
@@ -54,8 +44,7 @@ Portfolio::~Portfolio()
 
 int Portfolio::rowCount(const QModelIndex &parent /*= QModelIndex()*/) const
 {
-    return netPosList.size();
-    //return 5;
+    return int(rows.size());
 }
 
 int Portfolio::columnCount(const QModelIndex &parent /*= QModelIndex()*/) const
@@ -82,55 +71,64 @@ QVariant Portfolio::headerData(int section, Qt::Orientation orientation, int rol
 
 QVariant Portfolio::data(const QModelIndex &index, int role /*= Qt::DisplayRole*/) const
 {
-    if (role == Qt::DisplayRole) {
-        int row = index.row();
-        int col = index.column();
-        if (row < netPosList.size()) {
-            auto i = netPosList.begin();
-            auto curr_sym = (i + row).value().sym;
-            switch (col)
-            {
-            case 0: return QString(curr_sym.c_str());
-            case 1:
-                if (symList.contains(curr_sym))
-                {
-                    if (symList[curr_sym].mkt != nullptr)
-                        return QString::number(symList[curr_sym].mkt->LastPrice);
-                }
-                else
-                    return "";
-                //case 1: return "test";
-            case 2: return QString::number((i + row).value().netPos);
-            case 3: return QString::number((i + row).value().netPnl, 'f', 2);
-            default:
-                break;
-            }
-        }
-        else
-            return "test";
+    if (role != Qt::DisplayRole || index.row() < 0 || index.row() >= int(rows.size()))
+        return QVariant();
+    auto &r = rows[index.row()];
+    switch (index.column())
+    {
+    case 0: return QString(r.sym.c_str());
+    case 1: return r.lastPrice > 0 ? QString::number(r.lastPrice) : QString("");
+    case 2: return QString::number(r.netPos);
+    case 3: return QString::number(r.netPnl, 'f', 2);
+    default:
+        break;
     }
     return QVariant();
 }
 
-void Portfolio::updatePosTable()
+// Runs on the GUI thread with the snapshot just drawn. Rows keep their place once added,
+// only cells whose value changed are signalled; a symbol leaving the book resets the table.
+void Portfolio::updatePosTable(const UiSnapshot &snap)
 {
-    //auto i = netPosList.begin();
-    //auto role = Qt::EditRole;
-    //for (int row = 0; row < netPosList.size(); ++row) {
-    //	for (int col = 0; col < 3; ++col) {
-    //		switch (col)
-    //		{
-    //		case 0: setData(index(row, col), QString((i + row).value().sym.c_str()), role);
-    //		case 1: setData(index(row, col), QString::number((i + row).value().netPos), role);
-    //		case 2: setData(index(row, col), QString::number((i + row).value().netPos), role);
-    //		}
-    //	}
-    //}
-    beginResetModel();
-    endResetModel();
-    //auto topleft = createIndex(0, 0);
-    //auto bottomright = createIndex(netPosList.size(), 2);
-    //emit dataChanged(topleft, bottomright);
+    bool isGone = false;
+    vector<bool> isSeen(rows.size(), false);
+    vector<const PosRow*> added;
+    for (auto &p : snap.positions) {
+        auto it = rowOf.find(p.sym);
+        if (it == rowOf.end()) {
+            added.push_back(&p);
+            continue;
+        }
+        int row = it->second;
+        isSeen[row] = true;
+        auto &r = rows[row];
+        int first = 4, last = 0;
+        if (r.lastPrice != p.lastPrice) { first = min(first, 1); last = max(last, 1); }
+        if (r.netPos != p.netPos) { first = min(first, 2); last = max(last, 2); }
+        if (r.netPnl != p.netPnl) { first = min(first, 3); last = max(last, 3); }
+        r = p;
+        if (first <= last)
+            emit dataChanged(index(row, first), index(row, last));
+    }
+    for (bool b : isSeen)
+        isGone |= !b;
+
+    if (isGone) {
+        beginResetModel();
+        rows = snap.positions;
+        rowOf.clear();
+        for (size_t i = 0; i < rows.size(); ++i)
+            rowOf[rows[i].sym] = int(i);
+        endResetModel();
+    }
+    else if (!added.empty()) {
+        beginInsertRows(QModelIndex(), int(rows.size()), int(rows.size() + added.size()) - 1);
+        for (auto p : added) {
+            rowOf[p->sym] = int(rows.size());
+            rows.push_back(*p);
+        }
+        endInsertRows();
+    }
 }
 
 void Portfolio::setDispatcher(Dispatcher *ee)
@@ -143,11 +141,50 @@ void Portfolio::setOMS(OMS *oms)
     this->oms = oms;
 }
 
+void Portfolio::setRM(RM *rm)
+{
+    this->rm = rm;
+}
+
+void Portfolio::setCommissionEngine(CommissionEngine *engine)
+{
+    commission = engine;
+}
+
+void Portfolio::setMarginEngine(MarginEngine *engine)
+{
+    marginEngine = engine;
+}
+
+void Portfolio::setSnapshotPublisher(SnapshotPublisher *sp, int fps)
+{
+    publisher = sp;
+    snapshotFps = qMax(fps, 1);
+}
+
+void Portfolio::setStressEngine(StressEngine *engine)
+{
+    stress = engine;
+}
+
 void Portfolio::setPosTableView(QTableView *ptv)
 {
     postableview = ptv;
 }
 
+void Portfolio::addSubAccount(Portfolio *sub)
+{
+    sub->host = this;
+    sub->shareSymbols(symList);
+    subAccounts.push_back(sub);
+}
+
+// Same Symbol entries as the host, so the host's copy of a tick is seen by its sub-accounts too.
+void Portfolio::shareSymbols(const SymbolList &sl)
+{
+    symList = sl;
+}
+
 Trader * Portfolio::getTrader()
 {
     return trader;
@@ -156,6 +193,10 @@ Trader * Portfolio::getTrader()
 void Portfolio::onEvent(QEvent *ev)
 {
     auto myev = (MyEvent*)ev;
+    if (myev->myType == TradeEvent && isDuplicateTrade(myev->trade))
+        return;
+    if (rm != nullptr)
+        rm->onEvent(ev);
     switch (myev->myType)
     {
     case PositionEvent:
@@ -174,46 +215,57 @@ void Portfolio::onEvent(QEvent *ev)
         }*/
         break;
     }
-    case PositionDetailEvent:
+    case PositionDetailSnapshotEvent:
     {
-        if (myev->posDetail->BrokerID[0] != 0)
-        {
-            isInPosStream = true;
-            if (beginUpdate)
-            {
-                Position p(myev->posDetail, symList);
-                posList.insert(p.positionID, p);
-            }
+        // build aside and swap in, the table follows from the next published snapshot
+        PosList pl;
+        for (auto &df : *myev->posDetails) {
+            Position p(&df, symList);
+            pl.insert(p.positionID, p);
         }
-        else
+        posList.swap(pl);
+        aggPosList = constructAggPosList(posList);
+        netPosList = constructNetPosList(aggPosList);
+        isAccDirty = true;
+        isSnapshotDirty = true;
+        if (marginEngine != nullptr) {
+            marginEngine->clearPositions();
+            for (auto it = netPosList.begin(); it != netPosList.end(); ++it)
+                updateMargin(it.value().sym);
+            isMarginLive = true;
+        }
+        if (rm != nullptr)
+            rm->loadPositions(netPosList);
         {
-            aggPosList = constructAggPosList(posList);
-            netPosList = constructNetPosList(aggPosList);
-            isInPosStream = false;
-            beginUpdate = true;
-            // Reset Tableview rows
-            beginResetModel();
-            endResetModel();
+            vector<string> syms;
+            for (auto &kv : reportedNet)
+                syms.push_back(kv.first);
+            for (auto it = netPosList.begin(); it != netPosList.end(); ++it)
+                syms.push_back(it.value().sym);
+            for (auto &sym : syms)
+                reportExposure(sym);
         }
         break;
     }
     case AccountInfoEvent:
     {
         acc = Account(myev->accInfo);
+        isAccDirty = true;
         break;
     }
-    case ContractInfoEvent:
+    case ContractInfoSnapshotEvent:
     {
-        string sym = myev->contractInfo->InstrumentID;
-        if (symList.keys().contains(sym))
-        {
-            symList[sym].info = myev->contractInfo;
-        }
-        else
-        {
-            Symbol s = { new CThostFtdcDepthMarketDataField, myev->contractInfo };
-            symList.insert(sym, s);
+        // copied into each symbol's own info, snapshots of other sessions or the cache may
+        // not list every symbol and are freed once handled
+        for (auto &info : *myev->contractInfos) {
+            string sym = info.InstrumentID;
+            if (symList.contains(sym))
+                *symList[sym].info = info;
+            else
+                symList.insert(sym, Symbol(new CThostFtdcDepthMarketDataField(), new CThostFtdcInstrumentField(info), symList.size()));
         }
+        for (auto sub : subAccounts)
+            sub->shareSymbols(symList);
         break;
     }
     case MarketEvent:
@@ -221,40 +273,79 @@ void Portfolio::onEvent(QEvent *ev)
         string sym = myev->mkt->InstrumentID;
 //        symList[sym].mkt = myev->feed;
         if (!symList.contains(sym)) {
-            auto nmkt = new CThostFtdcDepthMarketDataField;
-            auto ninfo = new CThostFtdcInstrumentField;
-            symList.insert(sym, Symbol(nmkt, ninfo));
+            auto nmkt = new CThostFtdcDepthMarketDataField();
+            auto ninfo = new CThostFtdcInstrumentField();
+            symList.insert(sym, Symbol(nmkt, ninfo, symList.size()));
+            for (auto sub : subAccounts)
+                sub->symList.insert(sym, symList[sym]);
         }
         memcpy(symList[sym].mkt, myev->mkt, sizeof(CThostFtdcDepthMarketDataField));
-
-        evalAccount(acc, aggPosList, symList);	// Choose which price to MTM
+        markToMarket(sym);
+        auto hit = holders.find(sym);
+        if (hit != holders.end()) {
+            for (auto sub : hit->second) {
+                sub->markToMarket(sym);
+                QCoreApplication::postEvent(sub->dispatcher, new MyEvent(AccountUpdateEvent, &sub->acc));
+            }
+        }
         time = myev->mkt->UpdateTime;
         millisec = myev->mkt->UpdateMillisec;
+        int64_t bucket = history.bucketOf(myev->mkt->UpdateTime);
+        if (bucket >= 0) {
+            record(bucket, sym);
+            if (hit != holders.end()) {
+                for (auto sub : hit->second)
+                    sub->record(bucket, sym);
+            }
+        }
 
         auto accEvent = new MyEvent(AccountUpdateEvent, &acc);
         QCoreApplication::postEvent(dispatcher, accEvent);
-        printAcc();
-        printNetPos();
-        updatePosTable();
+        isSnapshotDirty = true;
+        if (publisher != nullptr && snapshotTimer == nullptr) {
+            snapshotTimer = new QTimer(this);
+            connect(snapshotTimer, &QTimer::timeout, this, &Portfolio::publishSnapshot);
+            snapshotTimer->start(1000 / snapshotFps);
+        }
         //postableview->update();
         //qDebug() << QThread::currentThreadId() << "++++++++++++++++++++++ pf";
 
-        kf->onFeed(myev);
-        oms->handleTargets();
+        if (kf != nullptr)
+            kf->onFeed(myev);
+        if (oms != nullptr) {
+            oms->onTick(myev->mkt);
+            oms->handleTargets();
+        }
 
         break;
     }
     case TradeEvent:
     {
-        updatePosOnTrade(aggPosList, posList, myev->trade, symList);
+        acc.commission += updatePosOnTrade(aggPosList, posList, myev->trade, symList);
         netPosList.clear();
         netPosList = constructNetPosList(aggPosList);
-        oms->onEvent(ev);
+        isAccDirty = true;
+        isSnapshotDirty = true;
+        updateMargin(myev->trade->InstrumentID);
+        reportExposure(myev->trade->InstrumentID);
+        if (oms != nullptr)
+            oms->onEvent(ev);
         break;
     }
     case OrderEvent:
     {
-        oms->onEvent(ev);
+        if (marginEngine != nullptr)
+            marginEngine->onOrder(myev->order);
+        if (oms != nullptr)
+            oms->onEvent(ev);
+        break;
+    }
+    case OrderSnapshotEvent:
+    {
+        if (marginEngine != nullptr)
+            marginEngine->loadOrders(*myev->orders);
+        if (oms != nullptr)
+            oms->onEvent(ev);
         break;
     }
     default:
@@ -262,92 +353,85 @@ void Portfolio::onEvent(QEvent *ev)
     }
 }
 
-void Portfolio::printNetPos()
-{
-    QString msg;
-    int fw = -12; // field width left-aligned
-    msg = QString("%1%2%3%4%5%6\n")
-            .arg("Symbol", fw)
-            .arg("NetPos", fw)
-            .arg("AvgCost", fw)
-            .arg("PosPnL", fw)
-            .arg("NetPnL", fw)
-            .arg("Time");
-    for (auto sym : netPosList.keys()) {
-        auto pos = netPosList[sym];
-        msg += QString("%1%2%3%4%5%6\n")
-                .arg(sym, fw)
-                .arg(pos.netPos, fw)
-                .arg(pos.avgCostPrice, fw)
-                .arg(pos.positionProfit, fw)
-                .arg(pos.netPnl, fw)
-                .arg(getTimeMsec(time, millisec));
+// Copies what the GUI shows into the publisher's spare buffer at the GUI frame rate, ticks
+// only mark the snapshot dirty, so a burst of ticks costs one copy per frame.
+void Portfolio::publishSnapshot()
+{
+    if (publisher == nullptr || !isSnapshotDirty)
+        return;
+    isSnapshotDirty = false;
+    auto &s = publisher->back();
+    s.balance = acc.balance;
+    s.netPnl = acc.netPnl;
+    s.closeProfit = acc.closeProfit;
+    s.positionProfit = acc.positionProfit;
+    s.margin = acc.margin;
+    s.commission = acc.commission;
+    s.time = time;
+    s.millisec = millisec;
+    s.positions.resize(netPosList.size());
+    size_t row = 0;
+    for (auto it = netPosList.cbegin(); it != netPosList.cend(); ++it, ++row) {
+        auto &np = it.value();
+        auto &r = s.positions[row];
+        r.sym = np.sym;
+        auto sit = symList.find(np.sym);
+        r.lastPrice = (sit == symList.end() || sit.value().mkt == nullptr ? 0 : sit.value().mkt->LastPrice);
+        r.netPos = np.netPos;
+        r.avgCostPrice = np.avgCostPrice;
+        r.positionProfit = np.positionProfit;
+        r.netPnl = np.netPnl;
     }
-    emit sendToPosMonitor(msg);
-}
-
-void Portfolio::printAcc()
-{
-    QString msg;
-    int fw = -12; // field width left-aligned
-    msg = QString("%1%2%3%4%5%6%7\n")
-            .arg("Balance", fw)
-            .arg("Grs.PnL", fw)
-            .arg("R.PnL", fw)
-            .arg("Unr.PnL", fw)
-            .arg("Margin", fw)
-            .arg("Comm", fw)
-            .arg("Time");
-    msg += QString("%1%2%3%4%5%6%7\n")
-            .arg(acc.balance, fw, 'f', 0)
-            .arg(acc.netPnl, fw)
-            .arg(acc.closeProfit, fw)
-            .arg(acc.positionProfit, fw)
-            .arg(acc.margin, fw)
-            .arg(acc.commission, fw)
-            .arg(getTimeMsec(time, millisec));
-    emit sendToAccMonitor(msg);
-}
-
-AggPosList Portfolio::constructAggPosList(PosList pList)
+    publisher->publish();
+}
+
+AggPosList Portfolio::constructAggPosList(const PosList &pList)
 {
     AggPosList apList;
-    for (auto &pos : pList) {
-        auto id = pos.aggPositionID;
-        if (!apList.keys().contains(id))
-            apList.insert(id, AggPosition(pos));
-        else
-            apList[id].addPosition(pos);
-    }
+    for (auto &pos : pList)
+        apList.add(pos);
     return apList;
 }
 
-NetPosList Portfolio::constructNetPosList(AggPosList apList)
+// Slots of a symbol are adjacent, each net position is summed up before its one insert.
+NetPosList Portfolio::constructNetPosList(const AggPosList &apList)
 {
     NetPosList npList;
-    for (auto &pos : apList) {
-        auto id = QString(pos.sym.c_str());
-        if (!npList.keys().contains(id))
-            npList.insert(id, NetPosition(pos));
+    NetPosition np;
+    int symIndex = -1;
+    for (int key = 0; key < apList.keyCount(); ++key) {
+        auto ap = apList.find(key);
+        if (ap == nullptr)
+            continue;
+        if (key / 4 != symIndex) {
+            if (symIndex >= 0)
+                npList.insert(QString(np.sym.c_str()), np);
+            np = NetPosition(*ap, apList.getBook());
+            symIndex = key / 4;
+        }
         else
-            npList[id].addAggPosition(pos);
+            np.addAggPosition(*ap, apList.getBook());
     }
+    if (symIndex >= 0)
+        npList.insert(QString(np.sym.c_str()), np);
     return npList;
 }
 
-void Portfolio::updatePosOnTrade(AggPosList &al, PosList &pl, CThostFtdcTradeField *td, SymbolList &sl)
+// Returns the commission of the trade, charged to the lots it opened or closed.
+double Portfolio::updatePosOnTrade(AggPosList &al, PosList &pl, CThostFtdcTradeField *td, SymbolList &sl)
 {
+    double fee = 0;
     switch (td->OffsetFlag)
     {
     case THOST_FTDC_OF_Open:
     {
         auto p = Position(td, sl);
+        if (commission != nullptr)
+            fee = commission->openFee(p.sym, td->Price, td->Volume);
+        p.commission = fee;
+        p.netPnl = p.grossPnl - p.commission;
         pl.insert(p.positionID, p);
-        auto id = p.aggPositionID;
-        if (!al.keys().contains(id))
-            al.insert(id, AggPosition(p));
-        else
-            al[id].addPosition(p);
+        al.add(p);
         break;
     }
     case THOST_FTDC_OF_Close:
@@ -369,9 +453,15 @@ void Portfolio::updatePosOnTrade(AggPosList &al, PosList &pl, CThostFtdcTradeFie
                 auto deltaPos = min(p.pos, tdcpy->Volume);
                 if (deltaPos != 0)
                 {
-                    al[p.aggPositionID].delPosition(p);
+                    auto ap = al.find(p.aggKey);
+                    al.delPosition(*ap, p);
                     p.updateOnTrade(tdcpy);
-                    al[p.aggPositionID].addPosition(p);
+                    if (commission != nullptr) {
+                        double lotFee = commission->closeFee(p.sym, p.positionDate == 'T', td->Price, deltaPos);
+                        p.commission += lotFee;
+                        fee += lotFee;
+                    }
+                    al.addPosition(*ap, p);
                 }
                 tdcpy->Volume -= deltaPos;
             }
@@ -406,33 +496,240 @@ void Portfolio::updatePosOnTrade(AggPosList &al, PosList &pl, CThostFtdcTradeFie
     default:
         break;
     }
+    return fee;
+}
+
+bool Portfolio::isDuplicateTrade(CThostFtdcTradeField *td)
+{
+    auto tradeKey = QString("%1+%2+%3").arg(td->ExchangeID).arg(td->TradeID).arg(td->Direction);
+    if (tradeIDs.contains(tradeKey))
+        return true;
+    tradeIDs.insert(tradeKey);
+    return false;
 }
 
 void Portfolio::evalAccount(Account &acc, AggPosList &aplist, SymbolList &sl)
 {
-    acc.positionProfit = 0;
-    acc.closeProfit = 0;
-    acc.grossPnl = 0;
-    acc.netPnl = 0;
-    for (auto &ap : aplist)
-    {
-        if (sl[ap.sym].mkt != nullptr)
-        {
-            if (sl[ap.sym].mkt->Volume == 0)	// TODO: get proper way for night session
-                ap.mtm(sl[ap.sym].mkt->PreSettlementPrice);
-            else
-                ap.mtm(sl[ap.sym].mkt->LastPrice);
-        }
-        acc.positionProfit += ap.positionProfit;
-        acc.closeProfit += ap.dailyCloseProfit;
-        acc.grossPnl += ap.grossPnl;
-        acc.netPnl += ap.netPnl;
-    }
+    aplist.mtm(sl);
+    auto &book = aplist.getBook();
+    acc.positionProfit = PositionBook::total(book.positionProfit);
+    acc.closeProfit = PositionBook::total(book.dailyCloseProfit);
+    acc.grossPnl = PositionBook::total(book.grossPnl);
+    acc.netPnl = PositionBook::total(book.netPnl);
     netPosList.clear();
     netPosList = constructNetPosList(aggPosList);
     //acc.balance = acc.cashBalance + acc.netPnl;
+    isAccDirty = false;
+    evalAvailable(acc);
+}
+
+// A tick only moves the positions of its symbol: re-mark those, swap their share of the
+// account totals and rebuild their net position. Positions change only on trades and
+// snapshots, which make the next tick go through evalAccount and re-sum from scratch.
+void Portfolio::evalSymbol(Account &acc, const string &sym, SymbolList &sl)
+{
+    auto &s = sl[sym];
+    if (s.mkt != nullptr) {
+        double price = markPrice(s);
+        auto &book = aggPosList.getBook();
+        NetPosition np;
+        bool hasPos = false;
+        for (int key = aggPositionKey(s.index, 'L', 'H'); key <= aggPositionKey(s.index, 'S', 'T'); ++key) {
+            auto ap = aggPosList.find(key);
+            if (ap == nullptr)
+                continue;
+            int r = ap->row;
+            acc.positionProfit -= book.positionProfit[r];
+            acc.closeProfit -= book.dailyCloseProfit[r];
+            acc.grossPnl -= book.grossPnl[r];
+            acc.netPnl -= book.netPnl[r];
+            aggPosList.mtm(*ap, price);
+            acc.positionProfit += book.positionProfit[r];
+            acc.closeProfit += book.dailyCloseProfit[r];
+            acc.grossPnl += book.grossPnl[r];
+            acc.netPnl += book.netPnl[r];
+            if (!hasPos)
+                np = NetPosition(*ap, book);
+            else
+                np.addAggPosition(*ap, book);
+            hasPos = true;
+        }
+        if (hasPos)
+            netPosList[QString(sym.c_str())] = np;
+    }
+    evalAvailable(acc);
+}
+
+// Margin from the engine once it holds the positions and has priced them all, else the
+// queried one stands.
+void Portfolio::evalAvailable(Account &acc)
+{
+    if (marginEngine != nullptr && isMarginLive && marginEngine->isComplete()) {
+        acc.margin = marginEngine->getMargin();
+        acc.frozenMargin = marginEngine->getFrozen();
+    }
     acc.balance = acc.cashBalance + acc.grossPnl - acc.commission;
-    acc.available = acc.balance - acc.margin; //TODO: add frozen margin etc.
+    acc.available = acc.balance - acc.margin - acc.frozenMargin;
+    if (rm != nullptr)
+        rm->updateAvailable(acc.balance - acc.margin);
+}
+
+void Portfolio::markToMarket(const string &sym)
+{
+    if (marginEngine != nullptr)
+        marginEngine->setPrice(sym, markPrice(symList[sym]));
+    if (stress != nullptr)
+        stress->setPrice(sym, markPrice(symList[sym]));
+    if (isAccDirty)
+        evalAccount(acc, aggPosList, symList);	// Choose which price to MTM
+    else
+        evalSymbol(acc, sym, symList);
+}
+
+// Adds the change of own net position in sym to the host's exposure.
+void Portfolio::reportExposure(const string &sym)
+{
+    auto it = netPosList.find(QString(sym.c_str()));
+    int net = (it == netPosList.end() ? 0 : it.value().netPos);
+    bool isHeld = it != netPosList.end() && (it.value().longPos > 0 || it.value().shortPos > 0);
+    int &reported = reportedNet[sym];
+    (host == nullptr ? this : host)->onExposure(this, sym, net - reported, isHeld);
+    reported = net;
+}
+
+void Portfolio::onExposure(Portfolio *pf, const string &sym, int delta, bool isHeld)
+{
+    exposure[sym] += delta;
+    if (stress != nullptr && delta != 0) {
+        auto sit = symList.find(sym);
+        stress->setPosition(sym, exposure[sym], sit == symList.end() || sit.value().mkt == nullptr ? 0 : markPrice(sit.value()));
+    }
+    if (pf == this)
+        return;
+    auto &v = holders[sym];
+    auto it = std::find(v.begin(), v.end(), pf);
+    if (isHeld && it == v.end())
+        v.push_back(pf);
+    else if (!isHeld && it != v.end())
+        v.erase(it);
+}
+
+// Account totals and the ticking symbol into the history, sub-accounts use the host's clock.
+void Portfolio::record(int64_t bucket, const string &sym)
+{
+    AccountPoint ap;
+    ap.balance = acc.balance;
+    ap.netPnl = acc.netPnl;
+    ap.margin = acc.margin;
+    ap.available = acc.available;
+    history.record(bucket, ap);
+
+    auto it = netPosList.find(QString(sym.c_str()));
+    if (it == netPosList.end())
+        return;
+    SymbolPoint sp;
+    sp.netPnl = it.value().netPnl;
+    sp.netPos = it.value().netPos;
+    sp.margin = (marginEngine == nullptr ? 0 : marginEngine->getMargin(sym));
+    auto eit = exposure.find(sym);
+    sp.exposure = (host != nullptr || eit == exposure.end() ? sp.netPos : eit->second);
+    history.record(bucket, sym, sp);
+}
+
+template <class T>
+static QString historyLine(const string &name, const PnlHistory &h, const vector<pair<int64_t, T>> &points, double drawdown)
+{
+    if (points.empty())
+        return QString("%1 no history\n").arg(name.c_str());
+    double low = points.front().second.netPnl, high = low;
+    for (auto &p : points) {
+        low = min(low, p.second.netPnl);
+        high = max(high, p.second.netPnl);
+    }
+    return QString("%1 %2-%3 netPnl first=%4 last=%5 low=%6 high=%7 drawdown=%8\n").arg(name.c_str())
+        .arg(h.timeOf(points.front().first)).arg(h.timeOf(points.back().first))
+        .arg(points.front().second.netPnl, 0, 'f', 0).arg(points.back().second.netPnl, 0, 'f', 0)
+        .arg(low, 0, 'f', 0).arg(high, 0, 'f', 0).arg(drawdown, 0, 'f', 0);
+}
+
+QString Portfolio::accountLine(const Account &a)
+{
+    return QString("%1 balance=%2 netPnl=%3 margin=%4 frozen=%5 available=%6\n").arg(a.accountID.c_str())
+        .arg(a.balance, 0, 'f', 0).arg(a.netPnl, 0, 'f', 0).arg(a.margin, 0, 'f', 0)
+        .arg(a.frozenMargin, 0, 'f', 0).arg(a.available, 0, 'f', 0);
+}
+
+void Portfolio::execCmdLine(QString cmdLine)
+{
+    QStringList argv(cmdLine.split(" "));
+    int n = argv.count();
+    if (n > 1 && argv.at(1) == "acc") {
+        QString msg = accountLine(acc);
+        Account total = acc;
+        total.accountID = "Total";
+        for (auto sub : subAccounts) {
+            msg += accountLine(sub->acc);
+            total.balance += sub->acc.balance;
+            total.netPnl += sub->acc.netPnl;
+            total.margin += sub->acc.margin;
+            total.frozenMargin += sub->acc.frozenMargin;
+            total.available += sub->acc.available;
+        }
+        emit sendToTraderMonitor(msg + accountLine(total));
+    }
+    else if (n > 1 && argv.at(1) == "exp") {
+        // net position across accounts, then each account's share
+        QString msg;
+        map<string, int> sorted(exposure.begin(), exposure.end());
+        for (auto &kv : sorted) {
+            if (n > 2 ? kv.first != argv.at(2).toStdString() : kv.second == 0)
+                continue;
+            msg += QString("%1 net=%2 |").arg(kv.first.c_str()).arg(kv.second);
+            auto own = reportedNet.find(kv.first);
+            msg += QString(" %1=%2").arg(acc.accountID.c_str()).arg(own == reportedNet.end() ? 0 : own->second);
+            for (auto sub : subAccounts) {
+                auto it = sub->reportedNet.find(kv.first);
+                msg += QString(" %1=%2").arg(sub->acc.accountID.c_str()).arg(it == sub->reportedNet.end() ? 0 : it->second);
+            }
+            msg += "\n";
+        }
+        emit sendToTraderMonitor(msg == "" ? "No net exposure" : msg);
+    }
+    else if (n > 1 && argv.at(1) == "pnl") {
+        // pf pnl [minutes] [sym], whole history when no minutes given
+        int64_t last = history.lastBucket();
+        int64_t from = 0;
+        bool isNum = false;
+        int minutes = (n > 2 ? argv.at(2).toInt(&isNum) : 0);
+        if (isNum && minutes > 0)
+            from = last - int64_t(minutes) * 60 / history.getResolution() + 1;
+        string sym = (n > 3 ? argv.at(3).toStdString() : (n > 2 && !isNum ? argv.at(2).toStdString() : ""));
+        vector<Portfolio*> accounts{ this };
+        accounts.insert(accounts.end(), subAccounts.begin(), subAccounts.end());
+        QString msg;
+        for (auto pf : accounts) {
+            auto &h = pf->history;
+            if (sym == "")
+                msg += historyLine(pf->acc.accountID, h, h.accountRange(from, last), h.maxDrawdown(from, last));
+            else
+                msg += historyLine(pf->acc.accountID + " " + sym, h, h.symbolRange(sym, from, last), h.maxDrawdown(sym, from, last));
+        }
+        emit sendToTraderMonitor(msg);
+    }
+    else
+        emit sendToTraderMonitor("Invalid cmd");
+}
+
+void Portfolio::updateMargin(const string &sym)
+{
+    if (marginEngine == nullptr)
+        return;
+    auto it = netPosList.find(QString(sym.c_str()));
+    int longPos = (it == netPosList.end() ? 0 : it.value().longPos);
+    int shortPos = (it == netPosList.end() ? 0 : it.value().shortPos);
+    auto sit = symList.find(sym);
+    double price = (sit == symList.end() || sit.value().mkt == nullptr ? 0 : markPrice(sit.value()));
+    marginEngine->setPosition(sym, longPos, shortPos, price);
 }
 
 Account::Account()
@@ -451,6 +748,7 @@ Account::Account(CThostFtdcTradingAccountField *af)
     deposit = af->Deposit;
     withdraw = af->Withdraw;
     margin = af->CurrMargin;
+    frozenMargin = af->FrozenMargin;
     commission = af->Commission;
     cashBalance = preBalance - withdraw + deposit;
     closeProfit = af->CloseProfit;
@@ -36,13 +36,13 @@ Position::Position(CThostFtdcInvestorPositionDetailField *df, const SymbolList &
 	multiple = sl[sym].info->VolumeMultiple;
 	positionDate = (openDate == tradingDay ? 'T' : 'H');
 
-	aggPositionID = QString("%1-%2-%3").arg(sym.c_str()).arg(direction).arg(positionDate);
+	aggKey = aggPositionKey(sl[sym].index, direction, positionDate);
 	positionID = QString("%1-%2-%3-%4-%5").arg(sym.c_str()).arg(direction).arg(positionDate)
 		.arg(openDate.c_str()).arg(tradeID.c_str());
 	side = (direction == 'L' ? 1 : -1);
 	dailyCloseProfit = side*(df->CloseAmount - closeVolume*multiple*(positionDate == 'H' ? lastSttlPrice : entryPrice));
 	grossPnl = dailyCloseProfit + dailyPositionProfit;
-	commission = 0; // TODO: calc
+	commission = 0; // fees of lots opened today are in the account's commission
 	netPnl = grossPnl - commission;
 }
 
@@ -71,12 +71,12 @@ Position::Position(CThostFtdcTradeField *td, const SymbolList &sl)
 
 	multiple = sl[sym].info->VolumeMultiple;
 	positionDate = (openDate == tradingDay ? 'T' : 'H');
-	aggPositionID = QString("%1-%2-%3").arg(sym.c_str()).arg(direction).arg(positionDate);
+	aggKey = aggPositionKey(sl[sym].index, direction, positionDate);
 	positionID = QString("%1-%2-%3-%4-%5").arg(sym.c_str()).arg(direction).arg(positionDate)
 		.arg(openDate.c_str()).arg(tradeID.c_str());
 	side = (direction == 'L' ? 1 : -1);
 	grossPnl = dailyCloseProfit + dailyPositionProfit;
-	commission = 0; // TODO: calc
+	commission = 0; // booked by Portfolio from CommissionEngine
 	netPnl = grossPnl - commission;
 }
 
@@ -112,150 +112,123 @@ void Position::mtm(double price)
 	netPnl = grossPnl - commission;
 }
 
-AggPosition::AggPosition()
+AggPosition *AggPosList::find(int key)
 {
+	if (key < 0 || key >= (int)keyIndex.size() || keyIndex[key] < 0)
+		return nullptr;
+	return &items[keyIndex[key]];
 }
 
-AggPosition::AggPosition(CThostFtdcInvestorPositionField *pf, const SymbolList &sl)
+const AggPosition *AggPosList::find(int key) const
 {
-	sym = pf->InstrumentID;
-	brokerID = pf->BrokerID;
-	investorID = pf->InvestorID;
-	direction = mymap::posiDirection_char.at(pf->PosiDirection);
-	hedgeFlag = mymap::hedgeFlag_char.at(pf->HedgeFlag);
-	positionDate = mymap::positionDate_char.at(pf->PositionDate);
-	ydPos = pf->YdPosition;
-	tdPos = pf->TodayPosition;
-	pos = pf->Position;
-	openVolume = pf->OpenVolume;
-	closVolume = pf->CloseVolume;
-	openAmount = pf->OpenAmount;
-	closeAmount = pf->CloseAmount;
-	positionCost = pf->PositionCost;
-	margin = pf->UseMargin;
-	marginRate = pf->MarginRateByMoney;
-	commission = pf->Commission;
-	closeProfit = pf->CloseProfit;
-	positionProfit = pf->PositionProfit;
-	preSttlPrice = pf->PreSettlementPrice;
-	sttlPrice = pf->SettlementPrice;
-	tradingDay = pf->TradingDay;
-	dailyCloseProfit = pf->CloseProfitByDate;
-	tradeCloseProfit = pf->CloseProfitByTrade;
-
-	multiple = sl[sym].info->VolumeMultiple;
-	avgCostPrice = (pos == 0 ? 0 : positionCost / pos / multiple);
-	aggPositionID = QString("%1-%2-%3").arg(sym.c_str()).arg(direction).arg(positionDate);
-	side = (direction == 'L' ? 1 : -1);
-	grossPnl = closeProfit + positionProfit;
-	netPnl = grossPnl - commission;
+	if (key < 0 || key >= (int)keyIndex.size() || keyIndex[key] < 0)
+		return nullptr;
+	return &items[keyIndex[key]];
 }
 
-AggPosition::AggPosition(const Position &p)
+void AggPosList::add(const Position &p)
 {
-	sym = p.sym;
-	brokerID = p.brokerID;
-	investorID = p.investorID;
-	direction = p.direction;
-	hedgeFlag = p.hedgeFlag;
-	positionDate = p.positionDate;
-	pos = p.pos;
-	ydPos = (positionDate == 'H' ? pos : 0);
-	tdPos = (positionDate == 'T' ? pos : 0);
-	openVolume = p.pos + p.closeVolume;
-	closVolume = p.closeVolume;
-	openAmount = 0;
-	closeAmount = 0;
-	margin = p.margin;
-	marginRate = p.marginRate;
-	commission = p.commission; // TODO: commission calc
-	closeProfit = p.dailyCloseProfit;
-	positionProfit = 0;
-	preSttlPrice = p.lastSttlPrice;
-	sttlPrice = p.sttlPrice;
-	tradingDay = p.tradingDay;
-	dailyCloseProfit = p.dailyCloseProfit;
-	tradeCloseProfit = p.tradeCloseProfit;
-
-	multiple = p.multiple;
-	positionCost = p.pos * multiple * (positionDate == 'H' ? p.lastSttlPrice : p.entryPrice);
-	avgCostPrice = (pos == 0 ? 0 : positionCost / pos / multiple);
-	aggPositionID = QString("%1-%2-%3").arg(sym.c_str()).arg(direction).arg(positionDate);
-	side = (direction == 'L' ? 1 : -1);
-	grossPnl = closeProfit + positionProfit;
-	netPnl = grossPnl - commission;
-}
-
-AggPosition::~AggPosition()
-{
-
-}
-
-void AggPosition::addPosition(const Position &p, int addsub /*= 1*/)
-{
-	if (p.sym == sym && p.direction == direction && p.positionDate == positionDate)
-	{
-		pos += addsub * p.pos;
-		closeProfit += addsub * p.dailyCloseProfit;  // bydate or bytrade??
-		dailyCloseProfit += addsub * p.dailyCloseProfit;
-		tradeCloseProfit += addsub * p.tradeCloseProfit;
-
-		if (positionDate == 'H')
-		{
-			ydPos += addsub * p.pos;
-			positionCost += addsub * p.pos * p.lastSttlPrice * multiple;
-
-		}
-		else
-		{
-			tdPos += addsub * p.pos;
-			positionCost += addsub * p.pos * p.entryPrice * multiple;
-		}
-		avgCostPrice = (pos == 0 ? 0 : positionCost / pos / multiple);
+	auto ap = find(p.aggKey);
+	if (ap != nullptr) {
+		addPosition(*ap, p);
+		return;
+	}
+	if (p.aggKey >= (int)keyIndex.size())
+		keyIndex.resize(p.aggKey + 4, -1);
+	keyIndex[p.aggKey] = (int)items.size();
+
+	AggPosition meta;
+	meta.aggKey = p.aggKey;
+	meta.sym = p.sym;
+	meta.brokerID = p.brokerID;
+	meta.investorID = p.investorID;
+	meta.direction = p.direction;
+	meta.hedgeFlag = p.hedgeFlag;
+	meta.positionDate = p.positionDate;
+	meta.tradingDay = p.tradingDay;
+	meta.row = book.addRow(p.direction == 'L' ? 1 : -1, p.multiple, p.marginRate);
+	book.margin[meta.row] = p.margin;
+	items.push_back(meta);
+	addPosition(meta, p);
+	book.grossPnl[meta.row] = book.closeProfit[meta.row];
+	book.netPnl[meta.row] = book.grossPnl[meta.row] - book.commission[meta.row];
+}
+
+void AggPosList::addPosition(const AggPosition &ap, const Position &p, int addsub /*= 1*/)
+{
+	if (p.sym != ap.sym || p.direction != ap.direction || p.positionDate != ap.positionDate)
+		return;
+	int r = ap.row;
+	book.pos[r] += addsub * p.pos;
+	book.closeProfit[r] += addsub * p.dailyCloseProfit;  // bydate or bytrade??
+	book.dailyCloseProfit[r] += addsub * p.dailyCloseProfit;
+	book.commission[r] += addsub * p.commission;
+	book.positionCost[r] += addsub * p.pos * (ap.positionDate == 'H' ? p.lastSttlPrice : p.entryPrice) * book.multiple[r];
+	book.avgCostPrice[r] = (book.pos[r] == 0 ? 0 : book.positionCost[r] / book.pos[r] / book.multiple[r]);
+}
+
+void AggPosList::delPosition(const AggPosition &ap, const Position &p)
+{
+	addPosition(ap, p, -1);
+}
+
+// Marks every position at its symbol's price in one pass over the book.
+void AggPosList::mtm(const SymbolList &sl)
+{
+	for (auto &ap : items) {
+		auto sit = sl.find(ap.sym);
+		if (sit != sl.end() && sit.value().mkt != nullptr)
+			book.price[ap.row] = markPrice(sit.value());
 	}
+	book.mtm();
 }
 
-void AggPosition::delPosition(const Position &p)
+void AggPosList::mtm(const AggPosition &ap, double price)
 {
-	addPosition(p, -1);
+	book.price[ap.row] = price;
+	book.mtm(ap.row);
 }
 
-void AggPosition::mtm(double price)
+void AggPosList::clear()
 {
-	positionProfit = side*pos*multiple*(price - avgCostPrice);
-	margin = pos*multiple*price*marginRate;
-	grossPnl = closeProfit + positionProfit;
-	netPnl = grossPnl - commission;
+	items.clear();
+	keyIndex.clear();
+	book.clear();
 }
 
 NetPosition::NetPosition()
 {
 }
 
-NetPosition::NetPosition(const AggPosition &ap)
+NetPosition::NetPosition(const AggPosition &ap, const PositionBook &book)
 {
 	sym = ap.sym;
 	brokerID = ap.brokerID;
 	investorID = ap.investorID;
-	addAggPosition(ap);
+	addAggPosition(ap, book);
 }
 
 NetPosition::~NetPosition()
 {
 }
 
-void NetPosition::addAggPosition(const AggPosition &ap)
-{
-	netPos += ap.pos*ap.side;
-	longPos += (ap.side == 1 ? ap.pos : 0);
-	shortPos += (ap.side == -1 ? ap.pos : 0);
-	closeProfit += ap.closeProfit;
-	positionProfit += ap.positionProfit;
-	commission += ap.commission;
-	grossPnl += ap.grossPnl;
-	netPnl += ap.netPnl;
-	multiple = ap.multiple;
-	positionCost += ap.positionCost*ap.side;
+void NetPosition::addAggPosition(const AggPosition &ap, const PositionBook &book)
+{
+	int r = ap.row;
+	int side = (int)book.side[r];
+	int pos = (int)book.pos[r];
+	netPos += pos*side;
+	longPos += (side == 1 ? pos : 0);
+	shortPos += (side == -1 ? pos : 0);
+	int &ydtd = (side == 1 ? (ap.positionDate == 'H' ? longYd : longTd) : (ap.positionDate == 'H' ? shortYd : shortTd));
+	ydtd += pos;
+	closeProfit += book.closeProfit[r];
+	positionProfit += book.positionProfit[r];
+	commission += book.commission[r];
+	grossPnl += book.grossPnl[r];
+	netPnl += book.netPnl[r];
+	multiple = (int)book.multiple[r];
+	positionCost += book.positionCost[r]*side;
 	avgCostPrice = (netPos == 0 ? 0 : positionCost / netPos / multiple);
 	//avgEntryPrice
 }
@@ -0,0 +1,61 @@
+#include <Eigen/Dense>
+
+#include "include/positionbook.h"
+
+using namespace std;
+
+typedef Eigen::Map<Eigen::ArrayXd> Column;
+
+double markPrice(const Symbol &s)
+{
+    if (s.mkt->Volume == 0)	// TODO: get proper way for night session
+        return s.mkt->PreSettlementPrice;
+    return s.mkt->LastPrice;
+}
+
+int PositionBook::addRow(int side, int multiple, double marginRate)
+{
+    for (auto column : { &pos, &positionCost, &avgCostPrice, &closeProfit, &dailyCloseProfit, &commission,
+            &price, &positionProfit, &margin, &grossPnl, &netPnl })
+        column->push_back(0);
+    this->side.push_back(side);
+    this->multiple.push_back(multiple);
+    this->marginRate.push_back(marginRate);
+    return size() - 1;
+}
+
+void PositionBook::clear()
+{
+    for (auto column : { &side, &pos, &multiple, &positionCost, &avgCostPrice, &marginRate, &closeProfit,
+            &dailyCloseProfit, &commission, &price, &positionProfit, &margin, &grossPnl, &netPnl })
+        column->clear();
+}
+
+// Same arithmetic as mtm(row), rows without a price keep their last values.
+void PositionBook::mtm()
+{
+    int n = size();
+    auto col = [n](vector<double> &v) { return Column(v.data(), n); };
+    auto px = col(price);
+    auto isPriced = px > 0;
+    col(positionProfit) = isPriced.select(col(side) * col(pos) * col(multiple) * (px - col(avgCostPrice)), col(positionProfit));
+    col(margin) = isPriced.select(col(pos) * col(multiple) * px * col(marginRate), col(margin));
+    col(grossPnl) = isPriced.select(col(closeProfit) + col(positionProfit), col(grossPnl));
+    col(netPnl) = isPriced.select(col(grossPnl) - col(commission), col(netPnl));
+}
+
+void PositionBook::mtm(int row)
+{
+    double px = price[row];
+    if (px <= 0)
+        return;
+    positionProfit[row] = side[row] * pos[row] * multiple[row] * (px - avgCostPrice[row]);
+    margin[row] = pos[row] * multiple[row] * px * marginRate[row];
+    grossPnl[row] = closeProfit[row] + positionProfit[row];
+    netPnl[row] = grossPnl[row] - commission[row];
+}
+
+double PositionBook::total(const vector<double> &column)
+{
+    return Eigen::Map<const Eigen::ArrayXd>(column.data(), column.size()).sum();
+}
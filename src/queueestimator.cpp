@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "include/queueestimator.h"
+
+using namespace std;
+
+BookLevels toLevels(const CThostFtdcDepthMarketDataField &mkt)
+{
+    BookLevels book;
+    book.bid[0] = mkt.BidPrice1; book.bidVolume[0] = mkt.BidVolume1;
+    book.bid[1] = mkt.BidPrice2; book.bidVolume[1] = mkt.BidVolume2;
+    book.bid[2] = mkt.BidPrice3; book.bidVolume[2] = mkt.BidVolume3;
+    book.bid[3] = mkt.BidPrice4; book.bidVolume[3] = mkt.BidVolume4;
+    book.bid[4] = mkt.BidPrice5; book.bidVolume[4] = mkt.BidVolume5;
+    book.ask[0] = mkt.AskPrice1; book.askVolume[0] = mkt.AskVolume1;
+    book.ask[1] = mkt.AskPrice2; book.askVolume[1] = mkt.AskVolume2;
+    book.ask[2] = mkt.AskPrice3; book.askVolume[2] = mkt.AskVolume3;
+    book.ask[3] = mkt.AskPrice4; book.askVolume[3] = mkt.AskVolume4;
+    book.ask[4] = mkt.AskPrice5; book.askVolume[4] = mkt.AskVolume5;
+    book.lastPrice = mkt.LastPrice;
+    book.volume = mkt.Volume;
+    return book;
+}
+
+// CTP fills missing levels with DBL_MAX
+bool isValidPrice(double px)
+{
+    return px > 0 && px < DBL_MAX / 2;
+}
+
+bool isSamePrice(double px1, double px2)
+{
+    return fabs(px1 - px2) < 1e-6;
+}
+
+// Displayed size at price on our side. A price between or better than the visible levels
+// has nobody queued, a price beyond the last visible level is not visible.
+int displayedVolume(const BookLevels &book, bool isBuy, double price, bool &isVisible)
+{
+    const double *px = isBuy ? book.bid : book.ask;
+    const int *vol = isBuy ? book.bidVolume : book.askVolume;
+    isVisible = true;
+    for (int i = 0; i < BOOK_LEVELS && isValidPrice(px[i]); ++i) {
+        if (isSamePrice(px[i], price))
+            return vol[i];
+        if (isBuy ? price > px[i] : price < px[i])
+            return 0;
+    }
+    isVisible = false;
+    return 0;
+}
+
+// The last trade was beyond our price, whoever was ahead of us is gone.
+bool isTradedThrough(const BookLevels &book, bool isBuy, double price)
+{
+    return isValidPrice(book.lastPrice) && (isBuy ? book.lastPrice < price - 1e-6 : book.lastPrice > price + 1e-6);
+}
+
+// Lots ahead of a resting order after a tick: trades at the price take from the front, the
+// rest of a size decrease leaves pro rata, and nobody is ahead beyond what is displayed.
+int advanceQueue(int ahead, int levelVolume, int size, bool isThrough, int tradedHere)
+{
+    if (isThrough)
+        ahead = 0;
+    ahead -= tradedHere;
+    int cancelled = levelVolume - size - tradedHere;
+    if (cancelled > 0 && levelVolume > 0 && ahead > 0)
+        ahead -= (int)lround(double(cancelled) * ahead / levelVolume);
+    return min(max(ahead, 0), size);
+}
+
+void QueueEstimator::onTick(CThostFtdcDepthMarketDataField *mkt)
+{
+    BookLevels book = toLevels(*mkt);
+
+    lock_guard<mutex> lock(mu);
+    auto &prev = books[mkt->InstrumentID];
+    auto it = symOrders.find(mkt->InstrumentID);
+    if (it != symOrders.end()) {
+        for (auto &orderID : it->second)
+            advance(orders[orderID], prev, book);
+    }
+    prev = book;
+}
+
+// First working return of an order is its acknowledgement, later ones update our volume.
+void QueueEstimator::onOrder(const QString &orderID, CThostFtdcOrderField *of, bool isWorking)
+{
+    lock_guard<mutex> lock(mu);
+    if (!isWorking) {
+        if (orders.contains(orderID)) {
+            symOrders[of->InstrumentID].remove(orderID);
+            orders.remove(orderID);
+        }
+        return;
+    }
+    if (orders.contains(orderID)) {
+        orders[orderID].volume = of->VolumeTotal;
+        return;
+    }
+    QueueSlot qs;
+    qs.sym = of->InstrumentID;
+    qs.isBuy = (of->Direction == THOST_FTDC_D_Buy);
+    qs.price = of->LimitPrice;
+    qs.volume = of->VolumeTotal;
+    auto bit = books.find(qs.sym);
+    if (bit != books.end()) {
+        bool isVisible;
+        int size = displayedVolume(bit->second, qs.isBuy, qs.price, isVisible);
+        // the tick may already show our order, counting it ahead errs on the safe side
+        if (isVisible)
+            qs.ahead = size;
+        qs.levelVolume = size;
+    }
+    orders.insert(orderID, qs);
+    symOrders[qs.sym].insert(orderID);
+}
+
+int QueueEstimator::getAhead(const QString &orderID)
+{
+    lock_guard<mutex> lock(mu);
+    auto it = orders.find(orderID);
+    return it == orders.end() ? -1 : it.value().ahead;
+}
+
+void QueueEstimator::advance(QueueSlot &qs, const BookLevels &prev, const BookLevels &book)
+{
+    bool isVisible;
+    int size = displayedVolume(book, qs.isBuy, qs.price, isVisible);
+    if (!isVisible)
+        return;     // level out of view, keep the estimate until it shows again
+    if (qs.ahead < 0) {
+        qs.ahead = size;
+        qs.levelVolume = size;
+        return;
+    }
+    int tradedHere = isSamePrice(book.lastPrice, qs.price) ? max(book.volume - prev.volume, 0) : 0;
+    qs.ahead = advanceQueue(qs.ahead, qs.levelVolume, size, isTradedThrough(book, qs.isBuy, qs.price), tradedHere);
+    qs.levelVolume = size;
+}
+
+QString QueueEstimator::summary()
+{
+    lock_guard<mutex> lock(mu);
+    QString msg;
+    for (auto it = orders.begin(); it != orders.end(); ++it) {
+        auto &qs = it.value();
+        msg += QString("%1 %2 %3 @%4 vol=%5 ahead=%6 level=%7\n").arg(it.key()).arg(qs.sym.c_str())
+            .arg(qs.isBuy ? "B" : "S").arg(qs.price).arg(qs.volume)
+            .arg(qs.ahead < 0 ? QString("?") : QString::number(qs.ahead)).arg(qs.levelVolume);
+    }
+    if (msg == "")
+        msg = "No passive order working";
+    return msg;
+}
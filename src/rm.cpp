@@ -1,10 +1,446 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+
+#include <QStringList>
+
 #include "include/rm.h"
+#include "include/exchangebudget.h"
+#include "include/margin.h"
+#include "include/stress.h"
+#include "include/myevent.h"
+
+using namespace std;
+
+bool RateCounter::tryAcquire(long long nowMs, int limit)
+{
+	if (nowMs - windowStart >= 1000) {
+		windowStart = nowMs;
+		count = 0;
+	}
+	if (count >= limit)
+		return false;
+	++count;
+	return true;
+}
+
+int RateCounter::available(long long nowMs, int limit) const
+{
+	if (nowMs - windowStart >= 1000)
+		return limit;
+	return std::max(limit - count, 0);
+}
 
 RM::RM(QObject *parent)
 	: QObject(parent)
 {
+	g_logger = spdlog::get("file_logger");
 }
 
 RM::~RM()
 {
 }
+
+string RM::orderKey(int frontID, int sessionID, const char *orderRef)
+{
+	// OrderRef may come back right-justified, normalize it through atoi
+	return to_string(frontID) + "-" + to_string(sessionID) + "-" + to_string(atoi(orderRef));
+}
+
+void RM::onEvent(QEvent *ev)
+{
+	auto myev = (MyEvent*)ev;
+	lock_guard<mutex> lock(mu);
+	switch (myev->myType)
+	{
+	case MarketEvent:
+	{
+		auto it = symRisk.find(myev->mkt->InstrumentID);
+		if (it != symRisk.end()) {
+			it->second.lastPrice = myev->mkt->LastPrice;
+			it->second.upperLimitPrice = myev->mkt->UpperLimitPrice;
+			it->second.lowerLimitPrice = myev->mkt->LowerLimitPrice;
+		}
+		break;
+	}
+	case ContractInfoSnapshotEvent:
+		for (auto &info : *myev->contractInfos)
+			onContractInfo(&info);
+		if (budget != nullptr)
+			budget->setInstruments(*myev->contractInfos);
+		break;
+	case AccountInfoEvent:
+		available = myev->accInfo->Available + myev->accInfo->FrozenMargin;
+		hasAccount = true;
+		break;
+	case OrderEvent:
+		onOrder(myev->order);
+		break;
+	case OrderSnapshotEvent:
+		for (auto &of : *myev->orders)
+			onOrder(&of);
+		if (budget != nullptr)
+			budget->loadOrders(*myev->orders);
+		break;
+	case TradeEvent:
+		onTrade(myev->trade);
+		if (budget != nullptr)
+			budget->onTrade(myev->trade);
+		break;
+	default:
+		break;
+	}
+}
+
+void RM::loadPositions(const NetPosList &npl)
+{
+	lock_guard<mutex> lock(mu);
+	accountPos = 0;
+	for (auto &rs : symRisk) {
+		rs.second.longPos = 0;
+		rs.second.shortPos = 0;
+	}
+	for (auto &np : npl) {
+		auto &rs = symRisk[np.sym];
+		rs.longPos = np.longPos;
+		rs.shortPos = np.shortPos;
+		accountPos += np.longPos + np.shortPos;
+	}
+}
+
+void RM::setExchangeBudget(ExchangeBudget *budget)
+{
+	this->budget = budget;
+}
+
+void RM::setMarginEngine(MarginEngine *engine)
+{
+	marginEngine = engine;
+}
+
+void RM::setStressEngine(StressEngine *engine)
+{
+	stress = engine;
+}
+
+// Money left after position margin, the margin of working orders is RM's own frozenMargin.
+void RM::updateAvailable(double available)
+{
+	lock_guard<mutex> lock(mu);
+	this->available = available;
+}
+
+// Notice: every branch below is a hash lookup or a compare against preloaded state,
+// the multisets are only touched on order updates, never here.
+EnumRiskCheckType RM::checkOrder(const string &sym, EnumOffsetFlagType offsetFlag, EnumDirectionType direction, double price, int volume)
+{
+	lock_guard<mutex> lock(mu);
+	if (!isWorking)
+		return RiskPassed;
+
+	auto it = symRisk.find(sym);
+	if (it == symRisk.end())
+		return RiskUnknownSymbol;
+	const RiskSymbol &rs = it->second;
+
+	int maxVolume = (price == 0 ? rs.maxMktOrderVolume : rs.maxLmtOrderVolume);
+	if (volume <= 0 || (maxVolume > 0 && volume > maxVolume))
+		return RiskOrderSize;
+
+	char side = mymap::direction_char.at(direction);
+	bool isOpen = (offsetFlag == EnumOffsetFlagType::Open);
+	if (isOpen) {
+		int symPos = (side == 'L' ? rs.longPos + rs.workingOpenLong : rs.shortPos + rs.workingOpenShort);
+		if (symPos + volume > limits.maxInstrumentPos)
+			return RiskInstrumentPos;
+		if (accountPos + accountWorkingOpen + volume > limits.maxAccountPos)
+			return RiskAccountPos;
+	}
+
+	if (price != 0) {
+		if ((rs.upperLimitPrice > 0 && price > rs.upperLimitPrice) ||
+			(rs.lowerLimitPrice > 0 && price < rs.lowerLimitPrice))
+			return RiskPriceBand;
+		if (rs.lastPrice > 0 && abs(price - rs.lastPrice) > limits.priceBand * rs.lastPrice)
+			return RiskPriceBand;
+	}
+
+	double px = (price == 0 ? rs.lastPrice : price);
+	if (side == 'L' && rs.bestWorkingSell > 0 && px >= rs.bestWorkingSell)
+		return RiskSelfTrade;
+	if (side == 'S' && rs.bestWorkingBuy > 0 && px <= rs.bestWorkingBuy)
+		return RiskSelfTrade;
+
+	if (isOpen && hasAccount) {
+		if (marginOf(rs, side, px, volume) > available - frozenMargin - limits.marginBuffer)
+			return RiskMargin;
+	}
+
+	if (budget != nullptr && !budget->canOrder(sym))
+		return RiskOrderBudget;
+
+	if (!orderRate.tryAcquire(nowMs(), limits.maxOrdersPerSec))
+		return RiskOrderRate;
+
+	return RiskPassed;
+}
+
+EnumRiskCheckType RM::checkCancel(const string &sym)
+{
+	lock_guard<mutex> lock(mu);
+	if (!isWorking)
+		return RiskPassed;
+	if (budget != nullptr && !budget->canCancel(sym))
+		return RiskCancelBudget;
+	if (!cancelRate.tryAcquire(nowMs(), limits.maxCancelsPerSec))
+		return RiskCancelRate;
+	return RiskPassed;
+}
+
+// Orders that can still pass the rate check in the current one-second window.
+int RM::orderBudget()
+{
+	lock_guard<mutex> lock(mu);
+	if (!isWorking)
+		return INT_MAX;
+	return orderRate.available(nowMs(), limits.maxOrdersPerSec);
+}
+
+void RM::onOrderInsert(const string &orderID, const string &sym, EnumOffsetFlagType offsetFlag, EnumDirectionType direction, double price, int volume)
+{
+	lock_guard<mutex> lock(mu);
+	RiskWorkingOrder wo;
+	wo.sym = sym;
+	wo.direction = mymap::direction_char.at(direction);
+	wo.isOpen = (offsetFlag == EnumOffsetFlagType::Open);
+	wo.isMarket = (price == 0);
+	wo.price = price;
+	wo.volume = volume;
+	addWorkingOrder(orderID, wo);
+	if (budget != nullptr)
+		budget->onOrderInsert(sym);
+}
+
+void RM::onOrderAction(const string &sym)
+{
+	if (budget != nullptr)
+		budget->onCancel(sym);
+}
+
+void RM::switchOn()
+{
+	isWorking = true;
+	g_logger->critical("RM switched ON");
+	emit sendToTraderMonitor("RM switched ON", Qt::yellow);
+}
+
+void RM::switchOff()
+{
+	isWorking = false;
+	g_logger->critical("RM switched OFF");
+	emit sendToTraderMonitor("RM switched OFF", Qt::red);
+}
+
+void RM::onContractInfo(CThostFtdcInstrumentField *info)
+{
+	auto &rs = symRisk[info->InstrumentID];
+	rs.maxLmtOrderVolume = info->MaxLimitOrderVolume;
+	rs.maxMktOrderVolume = info->MaxMarketOrderVolume;
+	rs.multiple = info->VolumeMultiple;
+	rs.longMarginRatio = info->LongMarginRatio;
+	rs.shortMarginRatio = info->ShortMarginRatio;
+}
+
+void RM::onOrder(CThostFtdcOrderField *of)
+{
+	auto orderID = orderKey(of->FrontID, of->SessionID, of->OrderRef);
+	delWorkingOrder(orderID);
+
+	switch (of->OrderStatus)
+	{
+	case THOST_FTDC_OST_PartTradedQueueing:
+	case THOST_FTDC_OST_NoTradeQueueing:
+	case THOST_FTDC_OST_Unknown:
+	case THOST_FTDC_OST_NotTouched:
+	{
+		RiskWorkingOrder wo;
+		wo.sym = of->InstrumentID;
+		wo.direction = mymap::direction_char.at(of->Direction);
+		wo.isOpen = (of->CombOffsetFlag[0] == THOST_FTDC_OF_Open);
+		wo.isMarket = (of->OrderPriceType != THOST_FTDC_OPT_LimitPrice);
+		wo.price = of->LimitPrice;
+		wo.volume = of->VolumeTotal;
+		addWorkingOrder(orderID, wo);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void RM::onTrade(CThostFtdcTradeField *td)
+{
+	auto &rs = symRisk[td->InstrumentID];
+	char side = mymap::direction_char.at(td->Direction);
+	if (td->OffsetFlag == THOST_FTDC_OF_Open) {
+		if (side == 'L')
+			rs.longPos += td->Volume;
+		else
+			rs.shortPos += td->Volume;
+		accountPos += td->Volume;
+	}
+	else {
+		// closing direction is opposite to position direction
+		if (side == 'L')
+			rs.shortPos = max(rs.shortPos - td->Volume, 0);
+		else
+			rs.longPos = max(rs.longPos - td->Volume, 0);
+		accountPos = max(accountPos - td->Volume, 0);
+	}
+}
+
+void RM::addWorkingOrder(const string &orderID, const RiskWorkingOrder &order)
+{
+	if (order.volume <= 0)
+		return;
+	auto &rs = symRisk[order.sym];
+	RiskWorkingOrder wo = order;
+	if (wo.isMarket)
+		wo.price = rs.lastPrice;
+	if (wo.isOpen) {
+		if (wo.direction == 'L')
+			rs.workingOpenLong += wo.volume;
+		else
+			rs.workingOpenShort += wo.volume;
+		accountWorkingOpen += wo.volume;
+		frozenMargin += marginOf(rs, wo.direction, wo.price, wo.volume);
+	}
+	if (!wo.isMarket) {
+		if (wo.direction == 'L')
+			rs.workingBuyPrices.insert(wo.price);
+		else
+			rs.workingSellPrices.insert(wo.price);
+		refreshBestWorking(rs);
+	}
+	workingOrders[orderID] = wo;
+}
+
+void RM::delWorkingOrder(const string &orderID)
+{
+	auto it = workingOrders.find(orderID);
+	if (it == workingOrders.end())
+		return;
+	const RiskWorkingOrder &wo = it->second;
+	auto &rs = symRisk[wo.sym];
+	if (wo.isOpen) {
+		if (wo.direction == 'L')
+			rs.workingOpenLong -= wo.volume;
+		else
+			rs.workingOpenShort -= wo.volume;
+		accountWorkingOpen -= wo.volume;
+		frozenMargin -= marginOf(rs, wo.direction, wo.price, wo.volume);
+	}
+	if (!wo.isMarket) {
+		auto &prices = (wo.direction == 'L' ? rs.workingBuyPrices : rs.workingSellPrices);
+		auto pit = prices.find(wo.price);
+		if (pit != prices.end())
+			prices.erase(pit);
+		refreshBestWorking(rs);
+	}
+	workingOrders.erase(it);
+}
+
+void RM::refreshBestWorking(RiskSymbol &rs)
+{
+	rs.bestWorkingBuy = (rs.workingBuyPrices.empty() ? 0 : *rs.workingBuyPrices.rbegin());
+	rs.bestWorkingSell = (rs.workingSellPrices.empty() ? 0 : *rs.workingSellPrices.begin());
+}
+
+double RM::marginOf(const RiskSymbol &rs, char direction, double price, int volume) const
+{
+	return price * volume * rs.multiple * (direction == 'L' ? rs.longMarginRatio : rs.shortMarginRatio);
+}
+
+long long RM::nowMs() const
+{
+	return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RM::execCmdLine(QString cmdLine)
+{
+	QStringList argv(cmdLine.split(" "));
+	int n = argv.count();
+	if (n > 1)
+	{
+		if (argv.at(1) == "on")
+			switchOn();
+		else if (argv.at(1) == "off")
+			switchOff();
+		else if (argv.at(1) == "lim" && n == 4)
+		{
+			bool ok;
+			int val = argv.at(3).toInt(&ok);
+			if (!ok) {
+				emit sendToTraderMonitor("Invalid cmd");
+				return;
+			}
+			lock_guard<mutex> lock(mu);
+			if (argv.at(2) == "inst")
+				limits.maxInstrumentPos = val;
+			else if (argv.at(2) == "acc")
+				limits.maxAccountPos = val;
+			else if (argv.at(2) == "ord")
+				limits.maxOrdersPerSec = val;
+			else if (argv.at(2) == "cxl")
+				limits.maxCancelsPerSec = val;
+			else
+				emit sendToTraderMonitor("Invalid cmd");
+		}
+		else if (argv.at(1) == "budget" && budget != nullptr)
+		{
+			emit sendToTraderMonitor(budget->summary(n == 3 ? argv.at(2).toStdString() : ""));
+		}
+		else if (argv.at(1) == "margin" && marginEngine != nullptr)
+		{
+			emit sendToTraderMonitor(marginEngine->summary());
+		}
+		else if (argv.at(1) == "stress" && stress != nullptr)
+		{
+			if (n == 2) {
+				emit sendToTraderMonitor(stress->summary());
+				return;
+			}
+			StressScenario sc;
+			sc.name = argv.at(2).toStdString();
+			if (n != 4 || !StressEngine::parseShocks(argv.at(3), sc.shocks)) {
+				emit sendToTraderMonitor("Invalid cmd");
+				return;
+			}
+			stress->addScenario(sc);
+		}
+		else if (argv.at(1) == "blim" && n == 5 && budget != nullptr)
+		{
+			bool ok;
+			int val = argv.at(4).toInt(&ok);
+			if (!ok || !budget->setLimit(argv.at(2).toStdString(), argv.at(3).toStdString(), val))
+				emit sendToTraderMonitor("Invalid cmd");
+		}
+		else if (argv.at(1) == "show")
+		{
+			lock_guard<mutex> lock(mu);
+			QString msg = QString("RM %1: inst=%2 acc=%3 ord/s=%4 cxl/s=%5 band=%6 | accPos=%7 wkOpen=%8 avail=%9 frozen=%10")
+				.arg(isWorking ? "ON" : "OFF")
+				.arg(limits.maxInstrumentPos).arg(limits.maxAccountPos)
+				.arg(limits.maxOrdersPerSec).arg(limits.maxCancelsPerSec).arg(limits.priceBand)
+				.arg(accountPos).arg(accountWorkingOpen).arg(available, 0, 'f', 0).arg(frozenMargin, 0, 'f', 0);
+			emit sendToTraderMonitor(msg);
+		}
+		else {
+			emit sendToTraderMonitor("Invalid cmd");
+		}
+	}
+	else {
+		emit sendToTraderMonitor("invalid cmd");
+	}
+}
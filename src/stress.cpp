@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <chrono>
+
+#include <QSettings>
+#include <QStringList>
+
+#include "include/stress.h"
+#include "include/instrumentcache.h"
+
+using namespace std;
+
+StressEngine::StressEngine()
+{
+    g_logger = spdlog::get("file_logger");
+}
+
+void StressEngine::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+}
+
+// Scenarios from an ini file, moves in percent of price:
+//   [groups]
+//   ferrous=rb,hc,i,j,jm,SF,SM
+//   [scenarios]
+//   size=1
+//   1\name=ferrous-3
+//   1\shocks=ferrous:-3,T:-0.8,TF:-0.5
+bool StressEngine::load(const QString &path)
+{
+    QSettings settings(path, QSettings::IniFormat);
+    settings.beginGroup("groups");
+    for (auto &name : settings.childKeys()) {
+        vector<string> products;
+        for (auto &p : settings.value(name).toStringList())
+            products.push_back(p.trimmed().toStdString());
+        setGroup(name.toStdString(), products);
+    }
+    settings.endGroup();
+    int n = settings.beginReadArray("scenarios");
+    for (int i = 0; i < n; ++i) {
+        settings.setArrayIndex(i);
+        StressScenario sc;
+        sc.name = settings.value("name").toString().toStdString();
+        if (!parseShocks(settings.value("shocks").toStringList().join(","), sc.shocks)) {
+            g_logger->warn("StressEngine: invalid shocks of scenario {}", sc.name);
+            continue;
+        }
+        addScenario(sc);
+    }
+    settings.endArray();
+    g_logger->info("StressEngine: {} scenarios, {} groups", scenarios.size(), groups.size());
+    return n > 0;
+}
+
+void StressEngine::setGroup(const string &name, const vector<string> &products)
+{
+    groups[name] = products;
+}
+
+// Adds a row to the matrix, a scenario of an existing name is replaced in place.
+void StressEngine::addScenario(const StressScenario &sc)
+{
+    auto it = find_if(scenarios.begin(), scenarios.end(), [&](const StressScenario &s) { return s.name == sc.name; });
+    int row = int(it - scenarios.begin());
+    if (it == scenarios.end()) {
+        scenarios.push_back(sc);
+        shocks.conservativeResize(scenarios.size(), instruments.size());
+        pnl.conservativeResize(scenarios.size());
+    }
+    else
+        *it = sc;
+    for (size_t c = 0; c < instruments.size(); ++c)
+        shocks(row, c) = shockOf(sc, instruments[c]);
+    pnl(row) = shocks.row(row).dot(value);
+}
+
+// "key:move,key:move", move in percent.
+bool StressEngine::parseShocks(const QString &spec, vector<StressShock> &shocks)
+{
+    for (auto &item : spec.split(",", QString::SkipEmptyParts)) {
+        auto kv = item.split(":");
+        bool ok = false;
+        StressShock s;
+        s.key = kv.at(0).trimmed().toStdString();
+        if (kv.count() == 2)
+            s.move = kv.at(1).toDouble(&ok);
+        if (!ok || s.key == "")
+            return false;
+        shocks.push_back(s);
+    }
+    return !shocks.empty();
+}
+
+double StressEngine::shockOf(const StressScenario &sc, const StressInstrument &si) const
+{
+    int best = -1;
+    double move = 0;
+    for (auto &s : sc.shocks) {
+        int rank = -1;
+        if (s.key == si.sym)
+            rank = 3;
+        else if (s.key == si.product)
+            rank = 2;
+        else if (s.key == si.exchange)
+            rank = 0;
+        else {
+            auto git = groups.find(s.key);
+            if (git != groups.end() && find(git->second.begin(), git->second.end(), si.product) != git->second.end())
+                rank = 1;
+        }
+        if (rank > best) {
+            best = rank;
+            move = s.move / 100;
+        }
+    }
+    return move;
+}
+
+// Column of sym, added on first use, -1 if the contract is unknown.
+int StressEngine::column(const string &sym)
+{
+    auto it = columns.find(sym);
+    if (it != columns.end())
+        return it->second;
+    CThostFtdcInstrumentField info;
+    if (instrumentCache == nullptr || !instrumentCache->getInstrument(sym, info))
+        return -1;
+    StressInstrument si;
+    si.sym = sym;
+    si.product = info.ProductID;
+    si.exchange = info.ExchangeID;
+    si.multiple = info.VolumeMultiple;
+    int col = int(instruments.size());
+    instruments.push_back(si);
+    columns[sym] = col;
+    shocks.conservativeResize(scenarios.size(), instruments.size());
+    for (size_t r = 0; r < scenarios.size(); ++r)
+        shocks(r, col) = shockOf(scenarios[r], si);
+    value.conservativeResize(instruments.size());
+    value(col) = 0;
+    return col;
+}
+
+void StressEngine::setValue(int col, double v)
+{
+    double delta = v - value(col);
+    if (delta == 0)
+        return;
+    pnl += shocks.col(col) * delta;
+    value(col) = v;
+}
+
+void StressEngine::setPosition(const string &sym, int netPos, double price)
+{
+    int col = (netPos == 0 ? (columns.count(sym) ? columns[sym] : -1) : column(sym));
+    if (col < 0)
+        return;
+    auto &si = instruments[col];
+    si.netPos = netPos;
+    if (price > 0)
+        si.price = price;
+    setValue(col, si.netPos * si.multiple * si.price);
+}
+
+void StressEngine::setPrice(const string &sym, double price)
+{
+    auto it = columns.find(sym);
+    if (it == columns.end() || price <= 0)
+        return;
+    auto &si = instruments[it->second];
+    si.price = price;
+    setValue(it->second, si.netPos * si.multiple * si.price);
+}
+
+// Full product, drops the rounding the incremental updates pile up.
+void StressEngine::revalue()
+{
+    pnl = shocks * value;
+}
+
+QString StressEngine::summary()
+{
+    auto start = chrono::steady_clock::now();
+    revalue();
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    QString msg;
+    for (size_t r = 0; r < scenarios.size(); ++r) {
+        QString spec;
+        for (auto &s : scenarios[r].shocks)
+            spec += QString("%1%2:%3").arg(spec == "" ? "" : ",").arg(s.key.c_str()).arg(s.move);
+        msg += QString("%1 pnl=%2 | %3\n").arg(scenarios[r].name.c_str()).arg(pnl(r), 0, 'f', 0).arg(spec);
+    }
+    msg += QString("%1 scenarios x %2 instruments, revalued in %3 us").arg(int(scenarios.size())).arg(int(instruments.size())).arg(us);
+    return msg;
+}
@@ -1,4 +1,5 @@
 ﻿#include <chrono>
+#include <climits>
 #include <set>
 #include <thread>
 //#include <stdio.h>
@@ -18,6 +19,11 @@
 #include "include/myevent.h"
 #include "include/position.h"
 #include "include/struct.h"
+#include "include/rm.h"
+#include "include/journal.h"
+#include "include/instrumentcache.h"
+#include "include/latency.h"
+#include "include/papertraderapi.h"
 
 using namespace std;
 using namespace spdlog::level;
@@ -56,7 +62,12 @@ void Trader::init()
 
 void Trader::reqConnect()
 {
-    tdapi = CThostFtdcTraderApi::CreateFtdcTraderApi();
+    if (FrontAddress.compare(0, 8, "paper://") == 0) {
+        paperApi = new PaperTraderApi(atoi(FrontAddress.c_str() + 8));
+        tdapi = paperApi;
+    }
+    else
+        tdapi = CThostFtdcTraderApi::CreateFtdcTraderApi(accountTag == "" ? "" : ("td" + accountTag + "_").c_str());
     tdapi->RegisterSpi(this);
     tdapi->SubscribePublicTopic(THOST_TERT_RESTART);
     tdapi->SubscribePrivateTopic(THOST_TERT_RESUME);
@@ -138,6 +149,10 @@ void Trader::OnRspUserLogin(CThostFtdcRspUserLoginField *pRspUserLogin, CThostFt
         FrontID = pRspUserLogin->FrontID;
         SessionID = pRspUserLogin->SessionID;
         tradingDay = pRspUserLogin->TradingDay;
+        if (journal != nullptr)
+            journal->open(tradingDay);
+        if (instrumentCache != nullptr)
+            instrumentCache->setTradingDay(tradingDay);
 
         QString msg;
         QString preSpaces = "\n" + QString(" ").repeated(31);
@@ -232,15 +247,23 @@ void Trader::OnRspQrySettlementInfoConfirm(CThostFtdcSettlementInfoConfirmField
             ReqSettlementInfoConfirm();  // need not to wait 1 sec?
         }
     }
-    // login workflow #3
-    if (isLoginWorkflow)
-        QtConcurrent::run(timerReq, this, SLOT(ReqQryInstrument()));
+    // login workflow #3, contract info of today already cached needs no query
+    if (isLoginWorkflow) {
+        if (instrumentCache != nullptr && instrumentCache->isFresh(tradingDay))
+            onInstrumentsReady();
+        else
+            QtConcurrent::run(timerReq, this, SLOT(ReqQryInstrument()));
+    }
 }
 
 void Trader::OnRspOrderInsert(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
 {
+    if (latency != nullptr && pInputOrder != nullptr)
+        latency->onRspInsert(pInputOrder->OrderRef);
     if (!isErrorRspInfo(pRspInfo, "Thost RspOrderInsert Failed: "))
         logger(info, "Thost RspOrderInsert Success: OrderRef={}", pInputOrder->OrderRef);
+    else if (pInputOrder != nullptr)
+        postInsertRejected(pInputOrder, pRspInfo);
 }
 
 void Trader::OnRspOrderAction(CThostFtdcInputOrderActionField *pInputOrderAction, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
@@ -270,13 +293,13 @@ void Trader::OnRspQryOrder(CThostFtdcOrderField *pOrder, CThostFtdcRspInfoField
             //msg.append(" ActiveTime=").append(pOrder->ActiveTime);
             emit sendToTraderMonitor(msg);
 
-            auto fcpy = new CThostFtdcOrderField;
-            memcpy(fcpy, pOrder, sizeof(CThostFtdcOrderField));
-            auto orderEvent = new MyEvent(OrderEvent, fcpy);
-            QCoreApplication::postEvent(dispatcher, orderEvent);
+            orderBuffer.push_back(*pOrder);
         }
         if (bIsLast)
         {
+            auto snapshot = make_shared<vector<CThostFtdcOrderField>>();
+            snapshot->swap(orderBuffer);
+            QCoreApplication::postEvent(dispatcher, new MyEvent(OrderSnapshotEvent, snapshot));
             logger(info, "Qry Order Finished.");
             emit sendToTraderMonitor("Query Order Finished.");
         }
@@ -347,20 +370,19 @@ void Trader::OnRspQryInvestorPositionDetail(CThostFtdcInvestorPositionDetailFiel
             msg.append(" Margin=").append(QString::number(pInvestorPositionDetail->Margin));
             emit sendToTraderMonitor(msg);
 
-            auto fcpy = new CThostFtdcInvestorPositionDetailField;
-            memcpy(fcpy, pInvestorPositionDetail, sizeof(CThostFtdcInvestorPositionDetailField));
-            auto posDetailEvent = new MyEvent(PositionDetailEvent, fcpy);
-            QCoreApplication::postEvent(dispatcher, posDetailEvent);
+            posDetailBuffer.push_back(*pInvestorPositionDetail);
         }
         if (bIsLast) {
             logger(info, "Qry InvestorPositionDetail Finished");
             emit sendToTraderMonitor("Qry InvestorPositionDetail Finished.");
 
-            // Send isLast signal event
-            auto fcpy = new CThostFtdcInvestorPositionDetailField;
-            memset(fcpy, 0, sizeof(CThostFtdcInvestorPositionDetailField));
-            auto posDetailEvent = new MyEvent(PositionDetailEvent, fcpy);
-            QCoreApplication::postEvent(dispatcher, posDetailEvent);
+            auto snapshot = make_shared<vector<CThostFtdcInvestorPositionDetailField>>();
+            snapshot->swap(posDetailBuffer);
+            if (journal != nullptr)
+                journal->append(*snapshot);
+            QCoreApplication::postEvent(dispatcher, new MyEvent(PositionDetailSnapshotEvent, snapshot));
+            if (isRateRefreshDue)
+                startRateRefresh();
         }
     }
 }
@@ -401,15 +423,61 @@ void Trader::OnRspQryInstrument(CThostFtdcInstrumentField *pInstrument, CThostFt
             //msg.append(" ").append(pInstrument->ExchangeID);
             //msg.append(" ").append(pInstrument->ExpireDate);
             //emit sendToTraderMonitor(msg);
-            auto fcpy = new CThostFtdcInstrumentField;
-            memcpy(fcpy, pInstrument, sizeof(CThostFtdcInstrumentField));
-            auto contractInfoEvent = new MyEvent(ContractInfoEvent, fcpy);
-            QCoreApplication::postEvent(dispatcher, contractInfoEvent);
-
-            if (bIsLast) {
-                // login workflow #4
-                if (isLoginWorkflow)
-                    QtConcurrent::run(timerReq, this, SLOT(ReqQryTradingAccount()));
+            instrumentBuffer.push_back(*pInstrument);
+        }
+        if (bIsLast) {
+            auto snapshot = make_shared<vector<CThostFtdcInstrumentField>>();
+            snapshot->swap(instrumentBuffer);
+            QCoreApplication::postEvent(dispatcher, new MyEvent(ContractInfoSnapshotEvent, snapshot));
+            if (instrumentCache != nullptr) {
+                instrumentCache->setInstruments(*snapshot);
+                instrumentCache->save();
+            }
+            onInstrumentsReady();
+        }
+    }
+}
+
+void Trader::onInstrumentsReady()
+{
+    // Contract info is in, safe to rebuild positions and orders from the journal
+    // before the live order flow held meanwhile.
+    if (journal != nullptr && !journal->isRecovered()) {
+        journal->recover(dispatcher);
+        for (auto ev : pendingOrderFlow)
+            QCoreApplication::postEvent(dispatcher, ev);
+        pendingOrderFlow.clear();
+    }
+
+    // login workflow #4, its queries share the flow control with the rate refresh, which
+    // waits for the last of them
+    if (isLoginWorkflow) {
+        isRateRefreshDue = true;
+        QtConcurrent::run(timerReq, this, SLOT(ReqQryTradingAccount()));
+    }
+    else
+        startRateRefresh();
+}
+
+void Trader::startRateRefresh()
+{
+    isRateRefreshDue = false;
+    if (instrumentCache != nullptr && !isRefreshingRates.exchange(true))
+        QtConcurrent::run(refreshRates, this);
+}
+
+void Trader::OnRspQryInstrumentMarginRate(CThostFtdcInstrumentMarginRateField *pInstrumentMarginRate, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
+{
+    if (!isErrorRspInfo(pRspInfo, "RspQryInstrumentMarginRate: ")) {
+        if (pInstrumentMarginRate != nullptr) {
+            if (instrumentCache != nullptr)
+                instrumentCache->updateMarginRate(pInstrumentMarginRate);
+            if (!isRefreshingRates) {
+                QString msg = QString("MarginRate: %1 Long=%2/%3 Short=%4/%5")
+                    .arg(pInstrumentMarginRate->InstrumentID)
+                    .arg(pInstrumentMarginRate->LongMarginRatioByMoney).arg(pInstrumentMarginRate->LongMarginRatioByVolume)
+                    .arg(pInstrumentMarginRate->ShortMarginRatioByMoney).arg(pInstrumentMarginRate->ShortMarginRatioByVolume);
+                emit sendToTraderMonitor(msg);
             }
         }
     }
@@ -417,12 +485,25 @@ void Trader::OnRspQryInstrument(CThostFtdcInstrumentField *pInstrument, CThostFt
 
 void Trader::OnRspQryInstrumentCommissionRate(CThostFtdcInstrumentCommissionRateField *pInstrumentCommissionRate, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
 {
-    // TODO: RETURN NULL
+    if (!isErrorRspInfo(pRspInfo, "RspQryInstrumentCommissionRate: ")) {
+        if (pInstrumentCommissionRate != nullptr) {
+            if (instrumentCache != nullptr)
+                instrumentCache->updateCommissionRate(pInstrumentCommissionRate);
+            if (!isRefreshingRates) {
+                QString msg = QString("CommissionRate: %1 Open=%2/%3 Close=%4/%5 CloseToday=%6/%7")
+                    .arg(pInstrumentCommissionRate->InstrumentID)
+                    .arg(pInstrumentCommissionRate->OpenRatioByMoney).arg(pInstrumentCommissionRate->OpenRatioByVolume)
+                    .arg(pInstrumentCommissionRate->CloseRatioByMoney).arg(pInstrumentCommissionRate->CloseRatioByVolume)
+                    .arg(pInstrumentCommissionRate->CloseTodayRatioByMoney).arg(pInstrumentCommissionRate->CloseTodayRatioByVolume);
+                emit sendToTraderMonitor(msg);
+            }
+        }
+    }
 }
 
 void Trader::OnRspQryDepthMarketData(CThostFtdcDepthMarketDataField *pDepthMarketData, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast)
 {
-    if (!isErrorRspInfo(pRspInfo, "RspQryDepthMarketData: ")) {
+    if (pDepthMarketData != nullptr && !isErrorRspInfo(pRspInfo, "RspQryDepthMarketData: ")) {
         auto fcpy = new CThostFtdcDepthMarketDataField;
         memcpy(fcpy, pDepthMarketData, sizeof(CThostFtdcDepthMarketDataField));
         auto feedEvent = new MyEvent(MarketEvent, fcpy);
@@ -433,6 +514,8 @@ void Trader::OnRspQryDepthMarketData(CThostFtdcDepthMarketDataField *pDepthMarke
 void Trader::OnRtnOrder(CThostFtdcOrderField *pOrder)
 {
     if (pOrder != nullptr) {
+        if (latency != nullptr && pOrder->FrontID == FrontID && pOrder->SessionID == SessionID)
+            latency->onOrder(pOrder);
         QString msg;
         msg += QString("OnRtnOrder: OrderRef=%1, %2, StatusMsg=%3").arg(pOrder->OrderRef, pOrder->InstrumentID, QString::fromLocal8Bit(pOrder->StatusMsg));
         //msg.append(" ExchangeID=").append(pOrder->ExchangeID);
@@ -448,10 +531,13 @@ void Trader::OnRtnOrder(CThostFtdcOrderField *pOrder)
         //logger(info, "OnRtnOrder: OrderRef={}, Status={}, Status Msg={}", pOrder->OrderRef, pOrder->OrderStatus, pOrder->StatusMsg);
         logger(info, msg.toStdString().c_str());
 
+        if (journal != nullptr)
+            journal->append(pOrder);
+
         auto fcpy = new CThostFtdcOrderField;
         memcpy(fcpy, pOrder, sizeof(CThostFtdcOrderField));
         auto orderEvent = new MyEvent(OrderEvent, fcpy);
-        QCoreApplication::postEvent(dispatcher, orderEvent);
+        postOrderFlowEvent(orderEvent);
     }
     else
         logger(err, "OnRtnOrder nullptr or null data");
@@ -460,6 +546,8 @@ void Trader::OnRtnOrder(CThostFtdcOrderField *pOrder)
 void Trader::OnRtnTrade(CThostFtdcTradeField *pTrade)
 {
     if (pTrade != nullptr) {
+        if (latency != nullptr)
+            latency->onTrade(pTrade);
         QString msg;
         msg += QString("OnRtnTrade: OrderRef=%1, %2").arg(pTrade->OrderRef, pTrade->InstrumentID);
         //msg.append("\nExchangeID=").append(pTrade->ExchangeID);
@@ -475,19 +563,58 @@ void Trader::OnRtnTrade(CThostFtdcTradeField *pTrade)
         logger(info, msg.toStdString().c_str());
         emit sendToTraderMonitor(msg);
 
+        if (journal != nullptr)
+            journal->append(pTrade);
+
         auto fcpy = new CThostFtdcTradeField;
         memcpy(fcpy, pTrade, sizeof(CThostFtdcTradeField));
         auto tradeEvent = new MyEvent(TradeEvent, fcpy);
-        QCoreApplication::postEvent(dispatcher, tradeEvent);
+        postOrderFlowEvent(tradeEvent);
     }
     else
         logger(err, "OnRtnTrade nullptr or null data");
 }
 
+void Trader::postOrderFlowEvent(MyEvent *ev)
+{
+    // Notice: all spi callbacks come from the same api thread, no lock needed here.
+    if (journal != nullptr && !journal->isRecovered())
+        pendingOrderFlow.push_back(ev);
+    else
+        QCoreApplication::postEvent(dispatcher, ev);
+}
+
 void Trader::OnErrRtnOrderInsert(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo)
 {
     QString msg = QString("ErrRtnOrderInsert: OrderRef=%1 ").arg(pInputOrder->OrderRef);
-    isErrorRspInfo(pRspInfo, msg.toStdString().c_str());
+    if (isErrorRspInfo(pRspInfo, msg.toStdString().c_str()))
+        postInsertRejected(pInputOrder, pRspInfo);
+}
+
+// A rejected insert gets no order return from CTP, a cancelled order in its place releases
+// what OMS, RM and the margin engine hold for it. Handlers take it again if the exchange
+// also returns the order.
+void Trader::postInsertRejected(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo)
+{
+    auto of = new CThostFtdcOrderField();
+    strcpy(of->BrokerID, pInputOrder->BrokerID);
+    strcpy(of->InvestorID, pInputOrder->InvestorID);
+    strcpy(of->UserID, pInputOrder->UserID);
+    strcpy(of->InstrumentID, pInputOrder->InstrumentID);
+    strcpy(of->OrderRef, pInputOrder->OrderRef);
+    of->FrontID = FrontID;
+    of->SessionID = SessionID;
+    of->Direction = pInputOrder->Direction;
+    of->CombOffsetFlag[0] = pInputOrder->CombOffsetFlag[0];
+    of->CombHedgeFlag[0] = pInputOrder->CombHedgeFlag[0];
+    of->OrderPriceType = pInputOrder->OrderPriceType;
+    of->LimitPrice = pInputOrder->LimitPrice;
+    of->VolumeTotalOriginal = pInputOrder->VolumeTotalOriginal;
+    of->OrderSubmitStatus = THOST_FTDC_OSS_InsertRejected;
+    of->OrderStatus = THOST_FTDC_OST_Canceled;
+    if (pRspInfo != nullptr)
+        strncpy(of->StatusMsg, pRspInfo->ErrorMsg, sizeof(of->StatusMsg) - 1);
+    postOrderFlowEvent(new MyEvent(OrderEvent, of));
 }
 
 void Trader::OnErrRtnOrderAction(CThostFtdcOrderActionField * pOrderAction, CThostFtdcRspInfoField * pRspInfo)
@@ -529,7 +656,13 @@ int Trader::ReqQrySettlementInfo(string TradingDay)
 
 int Trader::ReqOrderInsert(CThostFtdcInputOrderField *pInputOrder)
 {
+    if (journal != nullptr)
+        journal->append(pInputOrder);
     int ret = tdapi->ReqOrderInsert(pInputOrder, ++nRequestID);
+    if (ret != 0)
+        LatencyTracker::clearDecision();
+    else if (latency != nullptr && pInputOrder->OrderRef[0] != '\0')
+        latency->onInsert(pInputOrder->OrderRef, pInputOrder->InstrumentID);
     showApiReturn(ret, "--> ReqOrderInsert", "--x ReqOrderInsert Sent Error");
     return ret;
 }
@@ -537,6 +670,11 @@ int Trader::ReqOrderInsert(CThostFtdcInputOrderField *pInputOrder)
 // Limit Order
 int Trader::ReqOrderInsert(string InstrumentID, EnumOffsetFlagType OffsetFlag, EnumDirectionType Direction, double Price, int Volume)
 {
+    if (rm != nullptr && isRiskRejected(rm->checkOrder(InstrumentID, OffsetFlag, Direction, Price, Volume), InstrumentID, "--x LimitOrderInsert ")) {
+        LatencyTracker::clearDecision();
+        return -4;
+    }
+
     auto order = new CThostFtdcInputOrderField();
     strcpy(order->BrokerID, BROKER_ID.c_str());
     strcpy(order->UserID, USER_ID.c_str());
@@ -558,19 +696,32 @@ int Trader::ReqOrderInsert(string InstrumentID, EnumOffsetFlagType OffsetFlag, E
     order->LimitPrice = Price;
     order->VolumeTotalOriginal = Volume;
 
+    if (journal != nullptr)
+        journal->append(order);
     int ret = tdapi->ReqOrderInsert(order, ++nRequestID);
+    if (ret != 0)
+        LatencyTracker::clearDecision();
+    else if (latency != nullptr)
+        latency->onInsert(order->OrderRef, InstrumentID);
     showApiReturn(ret, "--> LimitOrderInsert", "--x LimitOrderInsert Sent Error");
+    if (ret == 0 && rm != nullptr)
+        rm->onOrderInsert(RM::orderKey(FrontID, SessionID, order->OrderRef), InstrumentID, OffsetFlag, Direction, Price, Volume);
     return ret;
 }
 
 // Market Order
 int Trader::ReqOrderInsert(string InstrumentID, EnumOffsetFlagType OffsetFlag, EnumDirectionType Direction, int Volume)
 {
+    if (rm != nullptr && isRiskRejected(rm->checkOrder(InstrumentID, OffsetFlag, Direction, 0, Volume), InstrumentID, "--x MarketOrderInsert ")) {
+        LatencyTracker::clearDecision();
+        return -4;
+    }
+
     auto order = new CThostFtdcInputOrderField();
     strcpy(order->BrokerID, BROKER_ID.c_str());
     strcpy(order->UserID, USER_ID.c_str());
     strcpy(order->InvestorID, USER_ID.c_str());
-    //strcpy(order->OrderRef, QString::number(++nMaxOrderRef).toStdString().c_str());
+    strcpy(order->OrderRef, QString::number(++nMaxOrderRef).toStdString().c_str());
     order->ContingentCondition = Immediately;
     order->ForceCloseReason = NotForceClose;
     order->IsAutoSuspend = false;
@@ -587,8 +738,16 @@ int Trader::ReqOrderInsert(string InstrumentID, EnumOffsetFlagType OffsetFlag, E
     order->LimitPrice = 0;
     order->VolumeTotalOriginal = Volume;
 
+    if (journal != nullptr)
+        journal->append(order);
     int ret = tdapi->ReqOrderInsert(order, ++nRequestID);
+    if (ret != 0)
+        LatencyTracker::clearDecision();
+    else if (latency != nullptr)
+        latency->onInsert(order->OrderRef, InstrumentID);
     showApiReturn(ret, "--> MarketOrderInsert", "--x MarketOrderInsert Sent Error");
+    if (ret == 0 && rm != nullptr)
+        rm->onOrderInsert(RM::orderKey(FrontID, SessionID, order->OrderRef), InstrumentID, OffsetFlag, Direction, 0, Volume);
     return ret;
 }
 
@@ -596,11 +755,16 @@ int Trader::ReqOrderInsert(string InstrumentID, EnumOffsetFlagType OffsetFlag, E
 int Trader::ReqOrderInsert(string InstrumentID, EnumContingentConditionType ConditionType, double conditionPrice,
     EnumOffsetFlagType OffsetFlag, EnumDirectionType Direction, EnumOrderPriceTypeType PriceType, double Price, int Volume)
 {
+    if (rm != nullptr && isRiskRejected(rm->checkOrder(InstrumentID, OffsetFlag, Direction, (PriceType == LimitPrice ? Price : 0), Volume), InstrumentID, "--x ConditionOrderInsert ")) {
+        LatencyTracker::clearDecision();
+        return -4;
+    }
+
     auto order = new CThostFtdcInputOrderField();
     strcpy(order->BrokerID, BROKER_ID.c_str());
     strcpy(order->UserID, USER_ID.c_str());
     strcpy(order->InvestorID, USER_ID.c_str());
-    //strcpy(order->OrderRef, QString::number(++nMaxOrderRef).toStdString().c_str());
+    strcpy(order->OrderRef, QString::number(++nMaxOrderRef).toStdString().c_str());
     order->ForceCloseReason = NotForceClose;
     order->IsAutoSuspend = false;
     order->MinVolume = 1;
@@ -619,15 +783,28 @@ int Trader::ReqOrderInsert(string InstrumentID, EnumContingentConditionType Cond
     order->LimitPrice = Price;  // Effective only if PriceType == LimitPrice
     order->VolumeTotalOriginal = Volume;
 
+    if (journal != nullptr)
+        journal->append(order);
     int ret = tdapi->ReqOrderInsert(order, ++nRequestID);
+    if (ret != 0)
+        LatencyTracker::clearDecision();
+    else if (latency != nullptr)
+        latency->onInsert(order->OrderRef, InstrumentID);
     showApiReturn(ret, "--> MarketOrderInsert", "--x MarketOrderInsert Sent Error");
+    if (ret == 0 && rm != nullptr)
+        rm->onOrderInsert(RM::orderKey(FrontID, SessionID, order->OrderRef), InstrumentID, OffsetFlag, Direction, (PriceType == LimitPrice ? Price : 0), Volume);
     return ret;
 }
 
 int Trader::ReqOrderAction(CThostFtdcInputOrderActionField *pInputOrderAction)
 {
+    if (rm != nullptr && isRiskRejected(rm->checkCancel(pInputOrderAction->InstrumentID), pInputOrderAction->InstrumentID, "--x ReqOrderAction "))
+        return -4;
+
     int ret = tdapi->ReqOrderAction(pInputOrderAction, ++nRequestID);
     showApiReturn(ret, "--> ReqOrderAction", "--x ReqOrderAction Sent Error");
+    if (ret == 0 && rm != nullptr)
+        rm->onOrderAction(pInputOrderAction->InstrumentID);
     return ret;
 }
 
@@ -673,9 +850,9 @@ int Trader::ReqOrderAction(string InstrumentID, int FrontID, int SessionID, stri
         strcpy(action->ExchangeID, ExchangeID.c_str());
     if (OrderSysID != "")
     {
-        // OrderSysID has format "     xxxxx", length set 20 here.
-        if (OrderRef.length() > 20) return -101;
-        strcpy(action->OrderRef, QString::fromStdString(OrderRef).rightJustified(20, ' ').toStdString().c_str());
+        // OrderSysID is padded by the exchange, pass it as returned, max length 20.
+        if (OrderSysID.length() > 20) return -101;
+        strcpy(action->OrderSysID, OrderSysID.c_str());
     }
     return ReqOrderAction(action);
 }
@@ -790,10 +967,11 @@ void Trader::handleDispatch(int tt)
 void Trader::setLogger()
 {
     //console = spdlog::get("console");
-    console = spdlog::stdout_color_mt("trader");
+    accountTag = (spdlog::get("trader") == nullptr ? "" : "_" + USER_ID);
+    console = spdlog::stdout_color_mt("trader" + accountTag);
     console->set_pattern("[%H:%M:%S.%f] [%L] [%n] %v");
     g_logger = spdlog::get("file_logger");
-    trader_logger = spdlog::rotating_logger_mt("trader_logger", "logs/trader_log", 1024 * 1024 * 5, 3);
+    trader_logger = spdlog::rotating_logger_mt("trader_logger" + accountTag, "logs/trader_log" + accountTag, 1024 * 1024 * 5, 3);
     //trader_logger = spdlog::daily_logger_mt("trader_logger", "logs/trader_log", 5, 0);
     trader_logger->flush_on(spdlog::level::info);
 }
@@ -809,21 +987,107 @@ void Trader::timerReq(Trader *trader, const char *req)
     el.exec();
 }
 
+// Background refresh of rates not yet queried for the trading day, paced under
+// CTP's one query per second flow control. Rates cached from an older day serve until then.
+void Trader::refreshRates(Trader *trader)
+{
+    auto cache = trader->instrumentCache;
+    auto marginSyms = cache->staleMarginRates();
+    auto commissionSyms = cache->staleCommissionRates();
+    trader->logger(info, "Refreshing rates: {} margin, {} commission", marginSyms.size(), commissionSyms.size());
+
+    int n{ 0 };
+    auto query = [&](const string &sym, bool isMargin) {
+        for (int retry = 0; retry < 3; ++retry) {
+            this_thread::sleep_for(chrono::milliseconds(1100));
+            int ret;
+            if (isMargin) {
+                CThostFtdcQryInstrumentMarginRateField field;
+                memset(&field, 0, sizeof(field));
+                strcpy(field.BrokerID, trader->BROKER_ID.c_str());
+                strcpy(field.InvestorID, trader->USER_ID.c_str());
+                strcpy(field.InstrumentID, sym.c_str());
+                field.HedgeFlag = THOST_FTDC_HF_Speculation;
+                ret = trader->tdapi->ReqQryInstrumentMarginRate(&field, ++trader->nRequestID);
+            }
+            else {
+                CThostFtdcQryInstrumentCommissionRateField field;
+                memset(&field, 0, sizeof(field));
+                strcpy(field.BrokerID, trader->BROKER_ID.c_str());
+                strcpy(field.InvestorID, trader->USER_ID.c_str());
+                strcpy(field.InstrumentID, sym.c_str());
+                ret = trader->tdapi->ReqQryInstrumentCommissionRate(&field, ++trader->nRequestID);
+            }
+            if (ret != -2 && ret != -3)  // retry only on flow control
+                break;
+        }
+        if (++n % 50 == 0)
+            cache->save();
+    };
+    for (auto &sym : marginSyms)
+        query(sym, true);
+    for (auto &sym : commissionSyms)
+        query(sym, false);
+
+    this_thread::sleep_for(chrono::milliseconds(1100));
+    cache->save();
+    trader->isRefreshingRates = false;
+    trader->logger(info, "Rates refreshed");
+}
+
 Dispatcher* Trader::getDispatcher()
 {
     return dispatcher;
 }
 
+PaperTraderApi* Trader::getPaperApi()
+{
+    return paperApi;
+}
+
 void Trader::setDispatcher(Dispatcher *ee)
 {
     dispatcher = ee;
 }
 
+void Trader::setRM(RM *rm)
+{
+    this->rm = rm;
+}
+
+void Trader::setJournal(Journal *journal)
+{
+    this->journal = journal;
+}
+
+void Trader::setInstrumentCache(InstrumentCache *cache)
+{
+    instrumentCache = cache;
+    if (paperApi != nullptr)
+        paperApi->setInstrumentCache(cache);
+}
+
+void Trader::setLatencyTracker(LatencyTracker *latency)
+{
+    this->latency = latency;
+}
+
 string Trader::getTradingDay()
 {
     return tradingDay;
 }
 
+// OrderRef of the last limit order sent, valid right after ReqOrderInsert returns
+int Trader::getLastOrderRef()
+{
+    return nMaxOrderRef;
+}
+
+int Trader::getOrderBudget()
+{
+    return rm != nullptr ? rm->orderBudget() : INT_MAX;
+}
+
 // Note: not restoring and showing corresponding nRequestID. can be implemented if need.
 bool Trader::isErrorRspInfo(CThostFtdcRspInfoField *pRspInfo, const char *msg)
 {
@@ -837,6 +1101,17 @@ bool Trader::isErrorRspInfo(CThostFtdcRspInfoField *pRspInfo, const char *msg)
     return isError;
 }
 
+bool Trader::isRiskRejected(int riskCheck, const string &InstrumentID, const char *msg)
+{
+    bool isRejected = (riskCheck != RiskPassed);
+    if (isRejected) {
+        QString errMsg = QString(msg).append(InstrumentID.c_str()).append(" <Rejected by RM: ")
+                .append(mymap::riskCheck_string.at((EnumRiskCheckType)riskCheck).c_str()).append(">");
+        logger(warn, errMsg.toStdString().c_str());
+        emit sendToTraderMonitor(errMsg, Qt::red);
+    }
+    return isRejected;
+}
 
 void Trader::showApiReturn(int ret, QString outputIfSuccess, QString outputIfError)
 {
@@ -849,23 +1124,23 @@ void Trader::showApiReturn(int ret, QString outputIfSuccess, QString outputIfErr
         switch (ret) {
         case 0:
             //msg = outputIfSuccess.append("0: Sent successfully ").append(QString("ReqID=%1").arg(QString::number(nRequestID)));
-            msg = outputIfSuccess.append(QString(" <Sent successfully. ReqID=%1>").arg(nRequestID));
+            msg = outputIfSuccess.append(QString(" <Sent successfully. ReqID=%1>").arg(nRequestID.load()));
             msg_t = green + msg + reset;
             logger(info, msg_t.toStdString().c_str());
             emit sendToTraderMonitor(msg, Qt::darkGreen);
             break;
         case -1:
-            msg = outputIfSuccess.append(QString(" <Failed, network problem. ReqID=%1>").arg(nRequestID));
+            msg = outputIfSuccess.append(QString(" <Failed, network problem. ReqID=%1>").arg(nRequestID.load()));
             logger(err, msg.toStdString().c_str());
             emit sendToTraderMonitor(msg, Qt::red);
             break;
         case -2:
-            msg = outputIfSuccess.append(QString(" <Failed, number of unhandled request queues passes limit. ReqID=%1>").arg(nRequestID));
+            msg = outputIfSuccess.append(QString(" <Failed, number of unhandled request queues passes limit. ReqID=%1>").arg(nRequestID.load()));
             logger(err, msg.toStdString().c_str());
             emit sendToTraderMonitor(msg, Qt::red);
             break;
         case -3:
-            msg = outputIfSuccess.append(QString(" <Failed, requests per sec pass limit.  ReqID=%1>").arg(nRequestID));
+            msg = outputIfSuccess.append(QString(" <Failed, requests per sec pass limit.  ReqID=%1>").arg(nRequestID.load()));
             logger(err, msg.toStdString().c_str());
             emit sendToTraderMonitor(msg, Qt::red);
             break;
@@ -956,6 +1231,17 @@ void Trader::execCmdLine(QString cmdLine)
         else if (argv.at(0) == "qc" || argv.at(0) == "qinst") {
             ReqQryInstrument();
         }
+        else if (argv.at(0) == "lat" && latency != nullptr) {
+            if (n > 1 && argv.at(1) == "dump")
+                latency->dump("logs/latency_" + tradingDay + ".csv");
+            else
+                emit sendToTraderCmdMonitor(latency->summary(n > 1 ? argv.at(1).toStdString() : ""), Qt::cyan);
+        }
+        else if (argv.at(0) == "paper" && paperApi != nullptr) {
+            if (n >= 3 && argv.at(1) == "lat")
+                paperApi->setLatency(argv.at(2).toInt(), n > 3 ? argv.at(3).toInt() : 0, n > 4 ? argv.at(4).toStdString() : "");
+            emit sendToTraderCmdMonitor(paperApi->summary(), Qt::cyan);
+        }
         else if (argv.at(0) == "login") {
             login();
         }
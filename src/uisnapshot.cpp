@@ -0,0 +1,78 @@
+#include "include/uisnapshot.h"
+
+using namespace std;
+
+QString UiSnapshot::timeText() const
+{
+    return QString("%1.%2").arg(time.c_str()).arg(millisec, 3, 10, QChar('0'));
+}
+
+QString UiSnapshot::accountText() const
+{
+    QString msg;
+    int fw = -12; // field width left-aligned
+    msg = QString("%1%2%3%4%5%6%7\n")
+            .arg("Balance", fw)
+            .arg("Grs.PnL", fw)
+            .arg("R.PnL", fw)
+            .arg("Unr.PnL", fw)
+            .arg("Margin", fw)
+            .arg("Comm", fw)
+            .arg("Time");
+    msg += QString("%1%2%3%4%5%6%7\n")
+            .arg(balance, fw, 'f', 0)
+            .arg(netPnl, fw)
+            .arg(closeProfit, fw)
+            .arg(positionProfit, fw)
+            .arg(margin, fw)
+            .arg(commission, fw)
+            .arg(timeText());
+    return msg;
+}
+
+QString UiSnapshot::positionText() const
+{
+    QString msg;
+    int fw = -12; // field width left-aligned
+    msg = QString("%1%2%3%4%5%6\n")
+            .arg("Symbol", fw)
+            .arg("NetPos", fw)
+            .arg("AvgCost", fw)
+            .arg("PosPnL", fw)
+            .arg("NetPnL", fw)
+            .arg("Time");
+    QString t = timeText();
+    for (auto &pos : positions) {
+        msg += QString("%1%2%3%4%5%6\n")
+                .arg(pos.sym.c_str(), fw)
+                .arg(pos.netPos, fw)
+                .arg(pos.avgCostPrice, fw)
+                .arg(pos.positionProfit, fw)
+                .arg(pos.netPnl, fw)
+                .arg(t);
+    }
+    return msg;
+}
+
+SnapshotPublisher::SnapshotPublisher()
+    : front(make_shared<UiSnapshot>()), spare(make_shared<UiSnapshot>())
+{
+}
+
+void SnapshotPublisher::publish()
+{
+    spare->seq = ++seq;
+    shared_ptr<const UiSnapshot> published = spare;
+    auto old = atomic_exchange(&front, published);
+    published.reset();
+    // old is out of reach of new readers, if nobody kept it the next write fills it in place
+    if (old.use_count() == 1)
+        spare = const_pointer_cast<UiSnapshot>(old);
+    else
+        spare = make_shared<UiSnapshot>();
+}
+
+shared_ptr<const UiSnapshot> SnapshotPublisher::latest() const
+{
+    return atomic_load(&front);
+}